@@ -1,8 +1,50 @@
 #include <SFML/Graphics.hpp>
+#include <SFML/Network.hpp>
 #include <vector>
 #include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <SFML/Graphics/Shader.hpp>
 
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
 const int WINDOW_WIDTH = 800;
 const int WINDOW_HEIGHT = 600;
 const float PLAYER_SPEED = 300.f;
@@ -12,11 +54,153 @@ const float BULLET_SPEED = 800.f;
 const int VOXEL_SIZE = 4;                    // Size of each "2D voxel"
 const float DRAW_RADIUS = 3.0f * VOXEL_SIZE; // Radius for voxel spawning
 const float STEP_HEIGHT = VOXEL_SIZE * 1.0f; // Maximum height player can automatically step up
-const float GLOW_STRENGTH = 1000.0f;
 const float EXPLOSION_RADIUS = VOXEL_SIZE * 4.0f;
-const float PARTICLE_LIFETIME = 1.2f;
 const float SCREEN_SHAKE_DURATION = 0.2f;
 const float SCREEN_SHAKE_INTENSITY = 8.0f;
+const std::size_t JOURNAL_MEMORY_CAP = 16 * 1024 * 1024; // Undo history budget in bytes
+const unsigned SIMULATION_SEED = 1337;
+const float AUTOSAVE_INTERVAL = 30.f;               // Seconds between background world saves
+const char *const AUTOSAVE_PATH = "autosave.vox";
+const sf::Uint8 IMPORT_ALPHA_THRESHOLD = 127;       // Image pixels more opaque than this become voxels
+const int GRID_WIDTH = WINDOW_WIDTH / VOXEL_SIZE;   // World size in voxel cells
+const int GRID_HEIGHT = WINDOW_HEIGHT / VOXEL_SIZE;
+const int ISLAND_SEARCH_LIMIT = 4096;               // Terrain pieces at least this big are assumed anchored
+const float BODY_RESTITUTION = 0.2f;                // Debris bounciness
+const float BODY_FRICTION = 0.6f;
+const float BODY_OVERLAP_SLOP = 0.5f;               // Overlap between debris (px) that is left alone
+const int BODY_CONTACT_PASSES = 2;                  // Contact resolution passes per physics sub-step
+const float BODY_BOUNCE_SPEED = 60.f;               // Debris hitting slower than this (px/s) doesn't bounce
+const float BODY_REST_DISTANCE = VOXEL_SIZE * 1.0f; // Debris that moves less than this (px)...
+const float BODY_REST_TIME = 0.5f;                  // ...for this long is at rest and written back into the grid
+const int CHUNK_SIZE = 64;                          // Chunk side in cells; unit of replication. One chunk row is one 64-bit occupancy word
+const float FLUID_TICK_RATE = 60.f;                 // Fluid steps per second, independent of the frame rate
+const int FLUID_POUR_RADIUS = 1;                    // Cells around the mouse filled per frame while pouring
+const int FLUID_SPREAD_LEVEL = 16;                  // Water lower than this (of 255) doesn't spread onto dry cells; lava 4x
+const float FIRE_TICK_RATE = 30.f;                  // Heat steps per second
+const int FIRE_IGNITION = 128;                      // Flammable cells at least this hot (of 255) burn
+const int FIRE_SPREAD_HEAT = 24;                    // Heat a burning cell gives each flammable neighbor per step
+const int FIRE_COOLING = 8;                         // Heat lost per step by cells that aren't burning
+const int DISTANCE_BLOCK = 8;                       // Side in cells of one distance field block
+const int DISTANCE_FIELD_MAX = 32;                  // Distances (in blocks) are capped here; bounds the work of an edit
+const int RAY_LANES = 8;                            // Rays a batched ray cast advances in lockstep
+const float VISIBILITY_RADIUS = 320.f;              // How far (px) the local player sees; fog of war beyond
+const int VISIBILITY_RING_RAYS = 128;               // Evenly spaced rays outlining the edge of that radius
+const int ATLAS_TILE = 16;                          // Side in texels of one texture atlas tile
+const int ATLAS_TILE_CELLS = 4;                     // A material tile spans this many cells each way
+
+// Networking
+const unsigned short DEFAULT_SERVER_PORT = 54000;
+const float CLIENT_TIMEOUT = 5.0f;           // Server drops clients it has not heard from for this long
+const int MAX_PLAYERS = 64;
+const std::size_t MAX_QUEUED_INPUTS = 8;     // Server-side input buffer per client; older inputs are dropped
+const std::size_t MAX_PREDICTED_INPUTS = 128; // Client-side inputs kept for re-simulation (about two seconds)
+const float VOXEL_RESEND_INTERVAL = 0.2f;    // Unacknowledged chunk deltas are repeated after this long
+const int VOXEL_HISTORY_LENGTH = 32;         // Chunk versions the server keeps as delta bases
+const std::size_t VOXEL_PACKET_BUDGET = 1200; // Chunk deltas are batched into datagrams of about this size
+const unsigned short DEFAULT_METRICS_PORT = 9464; // Loopback HTTP port of the metrics endpoint (--metrics)
+const float METRICS_SCRAPE_TIMEOUT = 2.f;      // Scrapers that haven't sent their request by then are dropped
+const char *const PERF_BASELINE_PATH = "scenarios/baseline.txt";
+const int PROFILE_REPORT_FRAMES = 300;         // --profile prints its table this often
+const float PERF_TOLERANCE = 0.25f;            // Allowed slowdown (or memory growth) over the baseline...
+const float PERF_NOISE_FLOOR_MS = 0.02f;       // ...unless it is smaller than this much tick time
+const float PERF_NOISE_FLOOR_MB = 0.25f;       // ...or this much memory
+const char *const SETTINGS_PATH = "settings.cfg"; // Read at startup if present; --config names another
+
+// Tuning that can change without recompiling: read from the settings file
+// (one "name value" per line, # comments) and then --set name=value.
+struct Settings
+{
+    float tickRate = 60.f;          // Fixed simulation rate of the authoritative server; clients must use the same
+    int threads = 0;                // Workers for fluid, morphology, generation and import; 0 is one per hardware thread
+    int maxParticles = 20000;       // Effects are dropped while this many particles are alive
+    float particleLifetime = 1.2f;  // Seconds
+    int glowQuality = 2;            // Bullet glow layer: 0 off, 1 half resolution, 2 full resolution
+    float glowStrength = 1000.f;
+    std::string pacing = "adaptive"; // vsync, limit (SFML's sleep), adaptive (sleep, then spin) or uncapped
+    int frameRateLimit = 60;        // Target of limit and adaptive pacing; 0 is uncapped
+
+    // False for an unknown name or a value out of range; nothing changes then
+    bool set(const std::string &name, const std::string &value)
+    {
+        Settings changed = *this;
+        try
+        {
+            std::size_t used = 0;
+            if (name == "tickRate")
+                changed.tickRate = std::stof(value, &used);
+            else if (name == "threads")
+                changed.threads = std::stoi(value, &used);
+            else if (name == "maxParticles")
+                changed.maxParticles = std::stoi(value, &used);
+            else if (name == "particleLifetime")
+                changed.particleLifetime = std::stof(value, &used);
+            else if (name == "glowQuality")
+                changed.glowQuality = std::stoi(value, &used);
+            else if (name == "glowStrength")
+                changed.glowStrength = std::stof(value, &used);
+            else if (name == "pacing")
+            {
+                changed.pacing = value;
+                used = value.size();
+            }
+            else if (name == "frameRateLimit")
+                changed.frameRateLimit = std::stoi(value, &used);
+            else
+                return false;
+            if (used != value.size())
+                return false;
+        }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+        if (!(std::isfinite(changed.tickRate) && changed.tickRate > 0.f && changed.threads >= 0 &&
+              changed.maxParticles >= 0 && std::isfinite(changed.particleLifetime) && changed.particleLifetime > 0.f &&
+              std::isfinite(changed.glowStrength) && changed.glowStrength >= 0.f && changed.glowQuality >= 0 &&
+              changed.glowQuality <= 2 &&
+              changed.frameRateLimit >= 0 &&
+              (changed.pacing == "vsync" || changed.pacing == "limit" || changed.pacing == "adaptive" ||
+               changed.pacing == "uncapped")))
+            return false;
+        *this = changed;
+        return true;
+    }
+
+    // A missing file is only an error if required
+    bool load(const std::string &path, bool required, std::string &error)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            if (required)
+                error = "can't open " + path;
+            return !required;
+        }
+        std::string line;
+        for (int lineNumber = 1; std::getline(file, line); ++lineNumber)
+        {
+            std::istringstream words(line.substr(0, line.find('#')));
+            std::string name, value, extra;
+            if (!(words >> name))
+                continue;
+            if (!(words >> value) || words >> extra || !set(name, value))
+            {
+                error = path + ":" + std::to_string(lineNumber) + ": can't read \"" + line + "\"";
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+Settings settings;
+
+// Threads for the parallel grid passes
+unsigned workerThreads()
+{
+    return settings.threads > 0 ? static_cast<unsigned>(settings.threads)
+                                : std::max(std::thread::hardware_concurrency(), 1u);
+}
 
 // Helper functions for vector operations
 float vectorLength(const sf::Vector2f &vec)
@@ -30,18 +214,84 @@ sf::Vector2f normalize(const sf::Vector2f &vec)
     return length > 0 ? vec / length : vec;
 }
 
+float dot(const sf::Vector2f &a, const sf::Vector2f &b)
+{
+    return a.x * b.x + a.y * b.y;
+}
+
+// z of the 3D cross product
+float cross(const sf::Vector2f &a, const sf::Vector2f &b)
+{
+    return a.x * b.y - a.y * b.x;
+}
+
+// Rotates vec by the angle whose cosine and sine are axis.x and axis.y
+sf::Vector2f rotateBy(const sf::Vector2f &vec, const sf::Vector2f &axis)
+{
+    return sf::Vector2f(vec.x * axis.x - vec.y * axis.y, vec.x * axis.y + vec.y * axis.x);
+}
+
+sf::Vector2f unrotateBy(const sf::Vector2f &vec, const sf::Vector2f &axis)
+{
+    return sf::Vector2f(vec.x * axis.x + vec.y * axis.y, vec.y * axis.x - vec.x * axis.y);
+}
+
+// Heap allocations since startup, for the metrics endpoint. Counting is one
+// relaxed atomic add per allocation. The replacements stay out of line so GCC
+// doesn't mistake their malloc/free for a mismatched new/delete pair.
+std::atomic<sf::Uint64> allocationCount(0);
+
+#if defined(__GNUC__)
+#define OUT_OF_LINE __attribute__((noinline))
+#else
+#define OUT_OF_LINE
+#endif
+
+OUT_OF_LINE void *operator new(std::size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void *memory = std::malloc(size ? size : 1))
+        return memory;
+    throw std::bad_alloc();
+}
+
+OUT_OF_LINE void operator delete(void *memory) noexcept
+{
+    std::free(memory);
+}
+
+OUT_OF_LINE void operator delete(void *memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+// Everything a client is allowed to tell the simulation about its player.
+// Captured once per frame in Game::handleEvents and sent verbatim to the server.
+struct PlayerInput
+{
+    sf::Uint32 sequence = 0;
+    sf::Int8 moveX = 0;       // -1 left, 0 idle, 1 right
+    bool jump = false;
+    bool drawing = false;
+    sf::Uint16 fireCount = 0; // Incremented per shot so a lost packet doesn't lose the shot
+    sf::Vector2f aim;         // Mouse position in world coordinates
+};
+
 class Player
 {
 public:
     sf::RectangleShape shape;
     sf::Vector2f velocity;
     bool isJumping;
+    sf::Uint8 id;
+    PlayerInput input;
+    sf::Uint16 lastFireCount;
 
-    Player() : isJumping(false)
+    Player(sf::Uint8 id = 0) : isJumping(false), id(id), lastFireCount(0)
     {
         shape.setSize(sf::Vector2f(30.f, 30.f));
         shape.setFillColor(sf::Color::Green);
-        shape.setPosition(100.f, WINDOW_HEIGHT - 100.f);
+        shape.setPosition(100.f + (id % 16) * 40.f, WINDOW_HEIGHT - 100.f);
         velocity = sf::Vector2f(0.f, 0.f);
     }
 };
@@ -60,16 +310,449 @@ public:
     }
 };
 
-class Voxel
+enum class Material : sf::Uint8
+{
+    Empty,
+    Stone,
+    Dirt,
+    Grass,
+    Sand,
+    Wood,
+    Leaves,
+    Count
+};
+
+sf::Color materialColor(Material material)
+{
+    switch (material)
+    {
+    case Material::Stone:
+        return sf::Color::White;
+    case Material::Dirt:
+        return sf::Color(121, 85, 58);
+    case Material::Grass:
+        return sf::Color(80, 170, 60);
+    case Material::Sand:
+        return sf::Color(220, 200, 120);
+    case Material::Wood:
+        return sf::Color(110, 70, 35);
+    case Material::Leaves:
+        return sf::Color(40, 120, 40);
+    default:
+        return sf::Color::Transparent;
+    }
+}
+
+// Tiles of the texture atlas every game object is drawn from (see
+// TextureAtlas), side by side in one row. Tiles are white and tinted by the
+// vertex color, so a whole layer of objects is one draw with one texture.
+enum class AtlasTile
+{
+    White,        // Flat color
+    Particle,     // Soft round dot
+    Bullet,       // Round with a bright core
+    Player,       // Square with a darker rim
+    FirstMaterial // One grain tile per solid material from here on, in Material order
+};
+
+inline sf::FloatRect atlasTile(AtlasTile tile)
+{
+    return sf::FloatRect(static_cast<float>(static_cast<int>(tile) * ATLAS_TILE), 0.f, ATLAS_TILE, ATLAS_TILE);
+}
+
+// Part of the material's tile that cell (x, y) shows; neighboring cells continue the grain
+inline sf::FloatRect materialTexture(Material material, int x, int y)
+{
+    const float texels = static_cast<float>(ATLAS_TILE / ATLAS_TILE_CELLS);
+    sf::FloatRect tile = atlasTile(static_cast<AtlasTile>(static_cast<int>(AtlasTile::FirstMaterial) +
+                                                          static_cast<int>(material) - 1));
+    int column = ((x % ATLAS_TILE_CELLS) + ATLAS_TILE_CELLS) % ATLAS_TILE_CELLS;
+    int row = ((y % ATLAS_TILE_CELLS) + ATLAS_TILE_CELLS) % ATLAS_TILE_CELLS;
+    return sf::FloatRect(tile.left + column * texels, tile.top + row * texels, texels, texels);
+}
+
+inline void appendQuad(sf::VertexArray &vertices, const sf::FloatRect &bounds, const sf::FloatRect &texture,
+                       const sf::Color &color)
+{
+    float right = bounds.left + bounds.width, bottom = bounds.top + bounds.height;
+    float textureRight = texture.left + texture.width, textureBottom = texture.top + texture.height;
+    vertices.append(sf::Vertex(sf::Vector2f(bounds.left, bounds.top), color, sf::Vector2f(texture.left, texture.top)));
+    vertices.append(sf::Vertex(sf::Vector2f(right, bounds.top), color, sf::Vector2f(textureRight, texture.top)));
+    vertices.append(sf::Vertex(sf::Vector2f(right, bottom), color, sf::Vector2f(textureRight, textureBottom)));
+    vertices.append(sf::Vertex(sf::Vector2f(bounds.left, bottom), color, sf::Vector2f(texture.left, textureBottom)));
+}
+
+// Heat a burning cell of the material gains per fire step; 0 if it doesn't burn
+int burnRate(Material material)
+{
+    switch (material)
+    {
+    case Material::Wood:
+        return 2;
+    case Material::Leaves:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+// Solid material whose color is closest to the given one
+Material nearestMaterial(const sf::Color &color)
+{
+    // Lookup table over 5-bit-per-channel colors, built once
+    static const std::vector<Material> table = []() {
+        std::vector<Material> result(32 * 32 * 32);
+        for (int i = 0; i < 32 * 32 * 32; ++i)
+        {
+            int r = ((i >> 10) & 31) * 255 / 31;
+            int g = ((i >> 5) & 31) * 255 / 31;
+            int b = (i & 31) * 255 / 31;
+            int bestDistance = 1 << 30;
+            for (int m = static_cast<int>(Material::Stone); m < static_cast<int>(Material::Count); ++m)
+            {
+                sf::Color candidate = materialColor(static_cast<Material>(m));
+                int dr = r - candidate.r, dg = g - candidate.g, db = b - candidate.b;
+                int distance = dr * dr + dg * dg + db * db;
+                if (distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    result[i] = static_cast<Material>(m);
+                }
+            }
+        }
+        return result;
+    }();
+    return table[((color.r >> 3) << 10) | ((color.g >> 3) << 5) | (color.b >> 3)];
+}
+
+static_assert(CHUNK_SIZE == 64, "chunk occupancy rows are single 64-bit words");
+static_assert(CHUNK_SIZE % DISTANCE_BLOCK == 0, "distance field blocks tile chunks");
+
+struct VoxelChunk
+{
+    Material cells[CHUNK_SIZE * CHUNK_SIZE];
+    sf::Uint64 rows[CHUNK_SIZE]; // Occupancy bitmask, bit x of rows[y] set if that cell is solid
+};
+
+inline int popCount(sf::Uint64 word)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(word);
+#else
+    int bits = 0;
+    for (; word; word &= word - 1)
+        ++bits;
+    return bits;
+#endif
+}
+
+// Index of the lowest set bit; word must not be zero
+inline int lowestBit(sf::Uint64 word)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    int bit = 0;
+    for (; !(word & 1); word >>= 1)
+        ++bit;
+    return bit;
+#endif
+}
+
+// Calls work(i) for every i in [0, count) on threadCount threads, the calling thread included
+template <typename Work>
+void parallelFor(int count, unsigned threadCount, Work work)
+{
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        for (int i = next++; i < count; i = next++)
+            work(i);
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < std::max(threadCount, 1u); ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &thread : threads)
+        thread.join();
+}
+
+// True if any of the count row words has a bit of mask set
+inline bool rowsIntersect(const sf::Uint64 *rows, int count, sf::Uint64 mask)
+{
+    sf::Uint64 hits = 0;
+    for (int i = 0; i < count; ++i)
+        hits |= rows[i] & mask;
+    return hits != 0;
+}
+
+// Same test, four (AVX2) or two (SSE2) rows per instruction; pays off for tall boxes
+inline bool rowsIntersectSimd(const sf::Uint64 *rows, int count, sf::Uint64 mask)
+{
+    int i = 0;
+#if defined(__AVX2__)
+    __m256i wideMask = _mm256_set1_epi64x(static_cast<long long>(mask));
+    __m256i wideHits = _mm256_setzero_si256();
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256i words = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rows + i));
+        wideHits = _mm256_or_si256(wideHits, _mm256_and_si256(words, wideMask));
+    }
+    if (!_mm256_testz_si256(wideHits, wideHits))
+        return true;
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128i wideMask = _mm_set1_epi64x(static_cast<long long>(mask));
+    __m128i wideHits = _mm_setzero_si128();
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows + i));
+        wideHits = _mm_or_si128(wideHits, _mm_and_si128(words, wideMask));
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(wideHits, _mm_setzero_si128())) != 0xFFFF)
+        return true;
+#endif
+    return rowsIntersect(rows + i, count - i, mask);
+}
+
+// Dense voxel world of width x height cells, each VOXEL_SIZE pixels wide.
+// Cells are stored chunk by chunk (CHUNK_SIZE x CHUNK_SIZE) so a chunk is one
+// contiguous block, and every chunk carries a revision that is bumped on each
+// change so consumers (replication, rendering) can tell what they have seen.
+//
+// Chunks are shared copy-on-write: copying a grid only copies chunk pointers,
+// and a chunk is cloned the first time it is written while shared. All empty
+// chunks start out as one shared instance.
+//
+// Each chunk also keeps one 64-bit occupancy word per row, so box queries
+// (collision) are a masked AND per row instead of a loop over cells.
+class VoxelGrid
 {
 public:
-    sf::RectangleShape shape;
+    static const int CHUNK_CELLS = CHUNK_SIZE * CHUNK_SIZE;
+
+    VoxelGrid(int width, int height)
+        : width(width), height(height),
+          chunksX((width + CHUNK_SIZE - 1) / CHUNK_SIZE),
+          chunksY((height + CHUNK_SIZE - 1) / CHUNK_SIZE),
+          chunks(static_cast<std::size_t>(chunksX) * chunksY, emptyChunk()),
+          chunkRevisions(static_cast<std::size_t>(chunksX) * chunksY, 0),
+          chunkCounts(static_cast<std::size_t>(chunksX) * chunksY, 0)
+    {
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getChunksX() const { return chunksX; }
+    int getChunksY() const { return chunksY; }
+    int getChunkCount() const { return chunksX * chunksY; }
+    std::size_t getCount() const { return count; }
+
+    // Sum of all chunk changes; cheap "did anything change" check
+    sf::Uint32 getRevision() const { return revision; }
+    sf::Uint32 getChunkRevision(int chunk) const { return chunkRevisions[chunk]; }
+    int getChunkSolidCount(int chunk) const { return chunkCounts[chunk]; }
+
+    bool contains(int x, int y) const
+    {
+        return x >= 0 && y >= 0 && x < width && y < height;
+    }
+
+    Material get(int x, int y) const
+    {
+        return contains(x, y) ? chunks[chunkOf(x, y)]->cells[cellOf(x, y)] : Material::Empty;
+    }
+
+    bool isSolid(int x, int y) const
+    {
+        return get(x, y) != Material::Empty;
+    }
+
+    // Writes outside the grid are ignored. Returns true if the cell changed.
+    bool set(int x, int y, Material material)
+    {
+        if (!contains(x, y))
+            return false;
+
+        int chunk = chunkOf(x, y);
+        if (chunks[chunk]->cells[cellOf(x, y)] == material)
+            return false;
+
+        VoxelChunk &storage = writableChunk(chunk);
+        Material &cell = storage.cells[cellOf(x, y)];
+        sf::Uint64 bit = sf::Uint64(1) << (x % CHUNK_SIZE);
+        if (material == Material::Empty)
+            storage.rows[y % CHUNK_SIZE] &= ~bit;
+        else
+            storage.rows[y % CHUNK_SIZE] |= bit;
+
+        if (cell == Material::Empty)
+        {
+            ++count;
+            ++chunkCounts[chunk];
+        }
+        else if (material == Material::Empty)
+        {
+            --count;
+            --chunkCounts[chunk];
+        }
+
+        cell = material;
+        ++chunkRevisions[chunk];
+        ++revision;
+        return true;
+    }
+
+    // True if any cell in the inclusive cell range is solid; the range is clipped to the grid
+    bool anySolid(int x0, int y0, int x1, int y1) const
+    {
+        return anySolidMasked(x0, y0, x1, y1, rowsIntersectSimd);
+    }
+
+    // anySolid without the SIMD row test, for comparison
+    bool anySolidScalar(int x0, int y0, int x1, int y1) const
+    {
+        return anySolidMasked(x0, y0, x1, y1, rowsIntersect);
+    }
+
+    // Occupancy words of one chunk, one per row (see VoxelChunk::rows)
+    const sf::Uint64 *getChunkRows(int chunk) const
+    {
+        return chunks[chunk]->rows;
+    }
+
+    // Cells of one chunk, row-major CHUNK_SIZE x CHUNK_SIZE. Cells past the grid edge stay empty.
+    const Material *getChunkCells(int chunk) const
+    {
+        return chunks[chunk]->cells;
+    }
+
+    // Rewrites whole chunks on threadCount threads. write(chunk, cells) must
+    // fill all CHUNK_CELLS cells of that chunk (row-major, origin from
+    // chunkOrigin) and may only touch its own chunk. Cells past the grid edge
+    // must stay empty.
+    template <typename Write>
+    void writeChunksParallel(Write write, unsigned threadCount)
+    {
+        parallelFor(getChunkCount(), threadCount, [&](int chunk) { rewriteChunk(chunk, write); });
+
+        count = 0;
+        for (int solid : chunkCounts)
+            count += solid;
+        revision += getChunkCount();
+    }
+
+    // Single-chunk version of writeChunksParallel, on the calling thread
+    template <typename Write>
+    void writeChunk(int chunk, Write write)
+    {
+        int before = chunkCounts[chunk];
+        rewriteChunk(chunk, write);
+        count = count - before + chunkCounts[chunk];
+        ++revision;
+    }
+
+    // True if both grids hold the very same (shared) storage for this chunk
+    bool sharesChunk(const VoxelGrid &other, int chunk) const
+    {
+        return chunks[chunk] == other.chunks[chunk];
+    }
+
+    void chunkOrigin(int chunk, int &x, int &y) const
+    {
+        x = (chunk % chunksX) * CHUNK_SIZE;
+        y = (chunk / chunksX) * CHUNK_SIZE;
+    }
+
+private:
+    int width;
+    int height;
+    int chunksX;
+    int chunksY;
+    std::vector<std::shared_ptr<VoxelChunk>> chunks;
+    std::vector<sf::Uint32> chunkRevisions;
+    std::vector<int> chunkCounts; // Solid cells per chunk
+    sf::Uint32 revision = 0;
+    std::size_t count = 0;
+
+    static std::shared_ptr<VoxelChunk> emptyChunk()
+    {
+        auto chunk = std::make_shared<VoxelChunk>();
+        std::fill(std::begin(chunk->cells), std::end(chunk->cells), Material::Empty);
+        std::fill(std::begin(chunk->rows), std::end(chunk->rows), 0);
+        return chunk;
+    }
+
+    // Chunk-local part of the bulk writes; leaves the grid-wide totals to the caller
+    template <typename Write>
+    void rewriteChunk(int chunk, Write &write)
+    {
+        VoxelChunk &storage = writableChunk(chunk);
+        write(chunk, storage.cells);
+
+        // Rebuild the occupancy words; the solid count falls out of them
+        int solid = 0;
+        for (int y = 0; y < CHUNK_SIZE; ++y)
+        {
+            const Material *row = storage.cells + y * CHUNK_SIZE;
+            sf::Uint64 word = 0;
+            for (int x = 0; x < CHUNK_SIZE; ++x)
+                word |= sf::Uint64(row[x] != Material::Empty) << x;
+            storage.rows[y] = word;
+            solid += popCount(word);
+        }
+        chunkCounts[chunk] = solid;
+        ++chunkRevisions[chunk];
+    }
+
+    // Clips the range, then tests each overlapped chunk column with one mask
+    // over the rows it covers
+    template <typename RowTest>
+    bool anySolidMasked(int x0, int y0, int x1, int y1, RowTest rowTest) const
+    {
+        x0 = std::max(x0, 0);
+        y0 = std::max(y0, 0);
+        x1 = std::min(x1, width - 1);
+        y1 = std::min(y1, height - 1);
+        if (x0 > x1 || y0 > y1)
+            return false;
+
+        for (int cy = y0 / CHUNK_SIZE; cy <= y1 / CHUNK_SIZE; ++cy)
+        {
+            int rowStart = std::max(y0 - cy * CHUNK_SIZE, 0);
+            int rowEnd = std::min(y1 - cy * CHUNK_SIZE, CHUNK_SIZE - 1);
+            for (int cx = x0 / CHUNK_SIZE; cx <= x1 / CHUNK_SIZE; ++cx)
+            {
+                int first = std::max(x0 - cx * CHUNK_SIZE, 0);
+                int last = std::min(x1 - cx * CHUNK_SIZE, CHUNK_SIZE - 1);
+                sf::Uint64 mask = (~sf::Uint64(0) >> (CHUNK_SIZE - 1 - last)) & (~sf::Uint64(0) << first);
+                if (rowTest(chunks[cy * chunksX + cx]->rows + rowStart, rowEnd - rowStart + 1, mask))
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    VoxelChunk &writableChunk(int chunk)
+    {
+        std::shared_ptr<VoxelChunk> &storage = chunks[chunk];
+        if (storage.use_count() > 1)
+        {
+            storage = std::make_shared<VoxelChunk>(*storage);
+        }
+        // Copies may be released on other threads (autosave); make sure their
+        // reads are done before we write into a chunk we now own alone
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return *storage;
+    }
 
-    Voxel(float x, float y)
+    int chunkOf(int x, int y) const
     {
-        shape.setSize(sf::Vector2f(VOXEL_SIZE, VOXEL_SIZE));
-        shape.setFillColor(sf::Color::White);
-        shape.setPosition(x, y);
+        return (y / CHUNK_SIZE) * chunksX + x / CHUNK_SIZE;
+    }
+
+    int cellOf(int x, int y) const
+    {
+        return (y % CHUNK_SIZE) * CHUNK_SIZE + x % CHUNK_SIZE;
     }
 };
 
@@ -81,7 +764,7 @@ public:
     float lifetime;
 
     Particle(const sf::Vector2f &pos, const sf::Vector2f &vel, const sf::Color &color)
-        : velocity(vel), lifetime(PARTICLE_LIFETIME)
+        : velocity(vel), lifetime(settings.particleLifetime)
     {
         shape.setRadius(2.f);
         shape.setFillColor(color);
@@ -96,440 +779,7533 @@ public:
             shape.getFillColor().r,
             shape.getFillColor().g,
             shape.getFillColor().b,
-            static_cast<sf::Uint8>(255 * (lifetime / PARTICLE_LIFETIME))));
+            static_cast<sf::Uint8>(255 * (lifetime / settings.particleLifetime))));
         return lifetime > 0;
     }
 };
 
-class Game
+// If point lies in a solid cell, finds the shortest way out of it through a
+// face whose neighbor is empty: the outward normal and the distance to that
+// face. A cell buried on all sides is left upward. solidAt(x, y) tells which
+// cells are solid.
+template <typename SolidAt>
+bool cellPenetration(const sf::Vector2f &point, SolidAt solidAt, sf::Vector2f &normal, float &depth)
 {
-private:
-    sf::RenderWindow window;
-    Player player;
-    std::vector<Bullet> bullets;
-    std::vector<Voxel> voxels;
-    std::vector<Particle> particles;
-    bool isDrawing;
-    sf::Shader backgroundShader;
-    sf::Shader glowShader;
-    sf::RenderTexture bulletLayer;
-    sf::Clock shaderClock;
-    float screenShakeTime = 0.0f;
-    sf::Vector2f screenShakeOffset;
+    int x = static_cast<int>(std::floor(point.x / VOXEL_SIZE));
+    int y = static_cast<int>(std::floor(point.y / VOXEL_SIZE));
+    if (!solidAt(x, y))
+        return false;
+
+    const struct
+    {
+        sf::Vector2f normal;
+        float depth;
+        int x, y;
+    } faces[4] = {
+        {{0.f, -1.f}, point.y - y * VOXEL_SIZE, x, y - 1},
+        {{-1.f, 0.f}, point.x - x * VOXEL_SIZE, x - 1, y},
+        {{1.f, 0.f}, (x + 1) * VOXEL_SIZE - point.x, x + 1, y},
+        {{0.f, 1.f}, (y + 1) * VOXEL_SIZE - point.y, x, y + 1},
+    };
+    normal = faces[0].normal;
+    depth = faces[0].depth;
+    bool found = false;
+    for (const auto &face : faces)
+    {
+        if (!solidAt(face.x, face.y) && (!found || face.depth < depth))
+        {
+            normal = face.normal;
+            depth = face.depth;
+            found = true;
+        }
+    }
+    return true;
+}
 
+// A piece of terrain that broke loose, simulated as a rigid body. Cells keep
+// their material and are laid out in cells from the body's local origin.
+// position is the world position of the center of mass and angle rotates the
+// body around it. updateShape() derives everything below the state from the
+// cells and must be called whenever they change.
+class VoxelBody
+{
 public:
-    Game() : window(sf::VideoMode(WINDOW_WIDTH, WINDOW_HEIGHT), "2D Shooter"), isDrawing(false)
+    struct Cell
     {
-        window.setFramerateLimit(60);
+        sf::Int16 x;
+        sf::Int16 y;
+        Material material;
+    };
 
-        // Initialize shaders
-        if (!sf::Shader::isAvailable())
+    std::vector<Cell> cells;
+    sf::Vector2f position;
+    sf::Vector2f velocity;
+    float angle = 0.f;           // Radians
+    float angularVelocity = 0.f;
+    sf::Vector2f restPosition;   // Where the body was when it last moved noticeably
+    float restAngle = 0.f;
+    float restTime = 0.f;        // Seconds spent near restPosition
+
+    sf::Vector2f centerOfMass;               // Local pixels from the cell origin
+    float inverseMass = 0.f;
+    float inverseInertia = 0.f;
+    float radius = 0.f;                      // Bounding circle around the center of mass
+    std::vector<sf::Vector2f> contactPoints; // Outline corners, relative to the center of mass
+    sf::VertexArray vertices{sf::Quads};     // Relative to the center of mass; drawn with getTransform() and the atlas
+
+    void updateShape()
+    {
+        columns = rows = 0;
+        for (const auto &cell : cells)
         {
-            throw std::runtime_error("Shaders are not available!");
+            columns = std::max(columns, cell.x + 1);
+            rows = std::max(rows, cell.y + 1);
         }
+        occupied.assign(static_cast<std::size_t>(columns) * rows, 0);
 
-        if (!backgroundShader.loadFromFile("shaders/background.frag", sf::Shader::Fragment))
+        // Every cell weighs one; a cell's own inertia around its center is VOXEL_SIZE^2 / 6
+        centerOfMass = sf::Vector2f();
+        for (const auto &cell : cells)
         {
-            throw std::runtime_error("Could not load background shader!");
+            occupied[cell.y * columns + cell.x] = 1;
+            centerOfMass += sf::Vector2f((cell.x + 0.5f) * VOXEL_SIZE, (cell.y + 0.5f) * VOXEL_SIZE);
         }
+        centerOfMass /= static_cast<float>(std::max<std::size_t>(cells.size(), 1));
 
-        if (!glowShader.loadFromFile("shaders/glow.frag", sf::Shader::Fragment))
+        float inertia = 0.f;
+        radius = 0.f;
+        vertices.clear();
+        for (const auto &cell : cells)
         {
-            throw std::runtime_error("Could not load glow shader!");
-        }
+            sf::Vector2f corner = sf::Vector2f(cell.x * VOXEL_SIZE, cell.y * VOXEL_SIZE) - centerOfMass;
+            sf::Vector2f center = corner + sf::Vector2f(VOXEL_SIZE * 0.5f, VOXEL_SIZE * 0.5f);
+            inertia += center.x * center.x + center.y * center.y + VOXEL_SIZE * VOXEL_SIZE / 6.f;
+            radius = std::max(radius, vectorLength(center) + VOXEL_SIZE * 0.71f);
 
-        // Initialize render texture for bullet layer
-        bulletLayer.create(WINDOW_WIDTH, WINDOW_HEIGHT);
+            appendQuad(vertices, sf::FloatRect(corner.x, corner.y, VOXEL_SIZE, VOXEL_SIZE),
+                       materialTexture(cell.material, cell.x, cell.y), materialColor(cell.material));
+        }
+        inverseMass = cells.empty() ? 0.f : 1.f / cells.size();
+        inverseInertia = inertia > 0.f ? 1.f / inertia : 0.f;
 
-        // Set shader parameters
-        backgroundShader.setUniform("resolution", sf::Vector2f(WINDOW_WIDTH, WINDOW_HEIGHT));
-        glowShader.setUniform("glowStrength", GLOW_STRENGTH);
+        // Corners of cells on the outline, each once
+        contactPoints.clear();
+        std::vector<char> seen(static_cast<std::size_t>(columns + 1) * (rows + 1), 0);
+        for (const auto &cell : cells)
+        {
+            if (solidAt(cell.x - 1, cell.y) && solidAt(cell.x + 1, cell.y) &&
+                solidAt(cell.x, cell.y - 1) && solidAt(cell.x, cell.y + 1))
+                continue;
+            for (int corner = 0; corner < 4; ++corner)
+            {
+                int x = cell.x + (corner & 1), y = cell.y + (corner >> 1);
+                if (seen[y * (columns + 1) + x])
+                    continue;
+                seen[y * (columns + 1) + x] = 1;
+                contactPoints.push_back(sf::Vector2f(x * VOXEL_SIZE, y * VOXEL_SIZE) - centerOfMass);
+            }
+        }
     }
 
-    void run()
+    // Whether a cell of the body's local layout is occupied; everything outside is empty
+    bool solidAt(int x, int y) const
     {
-        sf::Clock clock;
+        return x >= 0 && y >= 0 && x < columns && y < rows && occupied[y * columns + x];
+    }
 
-        while (window.isOpen())
-        {
-            sf::Time deltaTime = clock.restart();
-            handleEvents();
-            update(deltaTime.asSeconds());
-            render();
-        }
+    sf::Transform getTransform() const
+    {
+        sf::Transform transform;
+        transform.translate(position);
+        transform.rotate(angle * 180.f / 3.14159265f);
+        return transform;
     }
 
 private:
-    bool checkVoxelCollision(const sf::FloatRect &bounds)
+    int columns = 0;
+    int rows = 0;
+    std::vector<sf::Uint8> occupied;
+};
+
+void writeVarint(std::vector<sf::Uint8> &out, sf::Uint32 value)
+{
+    while (value >= 0x80)
     {
-        for (const auto &voxel : voxels)
-        {
-            if (bounds.intersects(voxel.shape.getGlobalBounds()))
-            {
-                return true;
-            }
-        }
-        return false;
+        out.push_back(static_cast<sf::Uint8>(value | 0x80));
+        value >>= 7;
     }
+    out.push_back(static_cast<sf::Uint8>(value));
+}
 
-    bool canStepUp(const sf::Vector2f &pos)
+bool readVarint(const sf::Uint8 *&data, const sf::Uint8 *end, sf::Uint32 &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 32 && data < end; shift += 7)
     {
-        sf::FloatRect playerBounds = player.shape.getGlobalBounds();
+        sf::Uint8 byte = *data++;
+        value |= static_cast<sf::Uint32>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
 
-        // Check if there's a block in front of us
-        playerBounds.left = pos.x;
-        playerBounds.top = pos.y;
-        if (!checkVoxelCollision(playerBounds))
+// Encodes the difference between two versions of a chunk (base may be null for
+// an empty chunk). The changed-cell mask is run-length coded as alternating
+// unchanged/changed run lengths, and each changed run is followed by its new
+// materials as (material, count) runs. Returns false if nothing changed.
+bool encodeChunkDelta(const Material *base, const Material *current, std::vector<sf::Uint8> &out)
+{
+    const int cellCount = VoxelGrid::CHUNK_CELLS;
+    auto changed = [base, current](int i) {
+        return current[i] != (base ? base[i] : Material::Empty);
+    };
+
+    bool any = false;
+    int i = 0;
+    while (i < cellCount)
+    {
+        int start = i;
+        while (i < cellCount && !changed(i))
+            ++i;
+        writeVarint(out, i - start);
+        if (i == cellCount)
+            break;
+
+        start = i;
+        while (i < cellCount && changed(i))
+            ++i;
+        writeVarint(out, i - start);
+        any = true;
+
+        for (int j = start; j < i;)
         {
-            return false; // No need to step if no collision
+            int runStart = j;
+            while (j < i && current[j] == current[runStart])
+                ++j;
+            out.push_back(static_cast<sf::Uint8>(current[runStart]));
+            writeVarint(out, j - runStart);
         }
-
-        // Try stepping up
-        playerBounds.top = pos.y - STEP_HEIGHT;
-        return !checkVoxelCollision(playerBounds);
     }
+    return any;
+}
 
-    void spawnVoxelsInRadius(float centerX, float centerY)
+// Calls write(cellIndex, material) for every cell in an encoded delta. Returns false on malformed data,
+// including materials that don't exist; cells before the error have been written by then.
+template <typename Write>
+bool decodeChunkDelta(const sf::Uint8 *data, const sf::Uint8 *end, Write write)
+{
+    const sf::Uint32 cellCount = VoxelGrid::CHUNK_CELLS;
+    sf::Uint32 i = 0;
+    while (i < cellCount)
     {
-        for (float x = -DRAW_RADIUS; x <= DRAW_RADIUS; x += VOXEL_SIZE)
-        {
-            for (float y = -DRAW_RADIUS; y <= DRAW_RADIUS; y += VOXEL_SIZE)
-            {
-                float distance = std::sqrt(x * x + y * y);
-                if (distance <= DRAW_RADIUS)
-                {
-                    float snapX = round((centerX + x) / VOXEL_SIZE) * VOXEL_SIZE;
-                    float snapY = round((centerY + y) / VOXEL_SIZE) * VOXEL_SIZE;
+        sf::Uint32 skip, run;
+        if (!readVarint(data, end, skip) || skip > cellCount - i)
+            return false;
+        i += skip;
+        if (i == cellCount)
+            break;
 
-                    // Check if voxel already exists
-                    bool voxelExists = false;
-                    for (const auto &voxel : voxels)
-                    {
-                        if (voxel.shape.getPosition().x == snapX &&
-                            voxel.shape.getPosition().y == snapY)
-                        {
-                            voxelExists = true;
-                            break;
-                        }
-                    }
+        if (!readVarint(data, end, run) || run == 0 || run > cellCount - i)
+            return false;
 
-                    if (!voxelExists)
-                    {
-                        voxels.emplace_back(snapX, snapY);
-                    }
-                }
-            }
+        for (sf::Uint32 left = run; left > 0;)
+        {
+            sf::Uint32 count;
+            if (data == end)
+                return false;
+            if (*data >= static_cast<sf::Uint8>(Material::Count))
+                return false;
+            Material material = static_cast<Material>(*data++);
+            if (!readVarint(data, end, count) || count == 0 || count > left)
+                return false;
+            for (sf::Uint32 k = 0; k < count; ++k)
+                write(i++, material);
+            left -= count;
         }
     }
+    return data == end;
+}
 
-    void handleCollisions(sf::Vector2f &newPos, float deltaTime)
+// Undo history of voxel edits. Each entry is one brush stroke or one
+// explosion, stored compactly as per-chunk lists of changed cells with their
+// old and new materials. Entries live in a ring bounded by JOURNAL_MEMORY_CAP;
+// the oldest ones are dropped once the cap is exceeded.
+class EditJournal
+{
+public:
+    // Adds a cell change to the open entry, opening one if needed
+    void record(int x, int y, Material before, Material after)
     {
-        sf::FloatRect playerBounds = player.shape.getGlobalBounds();
-        sf::Vector2f oldPos = player.shape.getPosition();
+        openChanges.push_back({x, y, before, after});
+    }
 
-        // First, try horizontal movement
-        playerBounds.left = newPos.x;
-        playerBounds.top = oldPos.y;
-        if (checkVoxelCollision(playerBounds))
-        {
-            // Try stepping up before blocking horizontal movement
-            if (canStepUp(sf::Vector2f(newPos.x, oldPos.y)))
-            {
-                // Move up by step height
-                newPos.y = oldPos.y - STEP_HEIGHT;
-            }
-            else
-            {
-                // Can't step up, block horizontal movement
-                newPos.x = oldPos.x;
-                player.velocity.x = 0;
-            }
-        }
+    // Closes the open entry. Recording something new discards the redo history.
+    void commit()
+    {
+        if (openChanges.empty())
+            return;
 
-        // Then, try vertical movement
-        playerBounds.left = newPos.x;
-        playerBounds.top = newPos.y;
-        if (checkVoxelCollision(playerBounds))
-        {
-            if (player.velocity.y > 0)
-            {
-                newPos.y = oldPos.y;
-                player.velocity.y = 0;
-                player.isJumping = false;
-            }
-            else if (player.velocity.y < 0)
-            {
-                newPos.y = oldPos.y;
-                player.velocity.y = 0;
-            }
-        }
+        for (std::size_t i = cursor; i < entries.size(); ++i)
+            memoryUsage -= entries[i].data.size();
+        entries.erase(entries.begin() + cursor, entries.end());
+        entries.push_back(compress(openChanges));
+        memoryUsage += entries.back().data.size();
+        cursor = entries.size();
+        openChanges.clear();
 
-        // Apply gravity after stepping
-        if (!checkVoxelCollision(playerBounds))
+        while (memoryUsage > JOURNAL_MEMORY_CAP && entries.size() > 1)
         {
-            sf::FloatRect groundCheck = playerBounds;
-            groundCheck.top += 1.0f;
-            if (!checkVoxelCollision(groundCheck))
-            {
-                player.isJumping = true;
-            }
+            memoryUsage -= entries.front().data.size();
+            entries.pop_front();
+            --cursor;
         }
     }
 
-    void handleEvents()
+    bool undo(VoxelGrid &grid)
     {
-        sf::Event event;
-        while (window.pollEvent(event))
-        {
-            if (event.type == sf::Event::Closed)
-                window.close();
+        commit();
+        if (cursor == 0)
+            return false;
+        apply(entries[--cursor], grid, false);
+        return true;
+    }
 
-            if (event.type == sf::Event::MouseButtonPressed)
-            {
-                if (event.mouseButton.button == sf::Mouse::Left)
-                {
-                    isDrawing = true;
-                }
-            }
-            if (event.type == sf::Event::MouseButtonReleased)
-            {
-                if (event.mouseButton.button == sf::Mouse::Left)
-                {
-                    isDrawing = false;
-                }
-            }
-            if (event.type == sf::Event::MouseButtonPressed)
-            {
-                if (event.mouseButton.button == sf::Mouse::Right)
-                {
-                    // Shoot bullet
-                    sf::Vector2i mousePos = sf::Mouse::getPosition(window);
-                    sf::Vector2f playerCenter = player.shape.getPosition() +
-                                                sf::Vector2f(player.shape.getSize().x / 2, player.shape.getSize().y / 2);
+    bool redo(VoxelGrid &grid)
+    {
+        commit();
+        if (cursor == entries.size())
+            return false;
+        apply(entries[cursor++], grid, true);
+        return true;
+    }
 
-                    sf::Vector2f direction = sf::Vector2f(mousePos.x - playerCenter.x,
-                                                          mousePos.y - playerCenter.y);
-                    float length = std::sqrt(direction.x * direction.x + direction.y * direction.y);
-                    direction /= length;
+    void clear()
+    {
+        entries.clear();
+        openChanges.clear();
+        cursor = 0;
+        memoryUsage = 0;
+    }
 
-                    bullets.emplace_back(playerCenter, direction * BULLET_SPEED);
-                }
-            }
-        }
+    std::size_t getEntryCount() const { return entries.size(); }
+    std::size_t getMemoryUsage() const { return memoryUsage; }
 
-        // Handle continuous drawing while mouse is held
-        if (isDrawing)
-        {
-            sf::Vector2i mousePos = sf::Mouse::getPosition(window);
-            spawnVoxelsInRadius(mousePos.x, mousePos.y);
-        }
-    }
+private:
+    struct Change
+    {
+        int x;
+        int y;
+        Material before;
+        Material after;
+    };
 
-    void createExplosion(const sf::Vector2f &position)
+    // Encoded as: chunk count, then per chunk its origin cell, change count and
+    // changes as (cell index gap, old material, new material), all varints
+    struct Entry
     {
-        // Screen shake
-        screenShakeTime = SCREEN_SHAKE_DURATION;
+        std::vector<sf::Uint8> data;
+    };
 
-        // Create explosion particles
-        for (int i = 0; i < 20; ++i)
+    std::deque<Entry> entries;
+    std::size_t cursor = 0; // Entries before the cursor can be undone, the rest redone
+    std::size_t memoryUsage = 0;
+    std::vector<Change> openChanges;
+
+    static Entry compress(std::vector<Change> &changes)
+    {
+        auto chunkKey = [](const Change &change) {
+            return std::make_pair(change.y / CHUNK_SIZE, change.x / CHUNK_SIZE);
+        };
+        auto cellIndex = [](const Change &change) {
+            return (change.y % CHUNK_SIZE) * CHUNK_SIZE + change.x % CHUNK_SIZE;
+        };
+
+        // Group by chunk, then by cell; a cell changed twice keeps its first old and last new value
+        std::stable_sort(changes.begin(), changes.end(), [&](const Change &a, const Change &b) {
+            return chunkKey(a) != chunkKey(b) ? chunkKey(a) < chunkKey(b) : cellIndex(a) < cellIndex(b);
+        });
+
+        Entry entry;
+        std::vector<sf::Uint8> &out = entry.data;
+        std::size_t chunkCount = 0;
+        for (std::size_t i = 0; i < changes.size(); ++i)
         {
-            float angle = (rand() % 360) * 3.14159f / 180.f;
-            float speed = 100.f + (rand() % 100);
-            sf::Vector2f velocity(cos(angle) * speed, sin(angle) * speed);
-            particles.emplace_back(position, velocity, sf::Color(255, 200, 0));
+            if (i == 0 || chunkKey(changes[i]) != chunkKey(changes[i - 1]))
+                ++chunkCount;
         }
+        writeVarint(out, static_cast<sf::Uint32>(chunkCount));
 
-        // Destroy nearby voxels
-        for (auto it = voxels.begin(); it != voxels.end();)
+        for (std::size_t i = 0; i < changes.size();)
         {
-            sf::Vector2f voxelPos = it->shape.getPosition();
-            float dx = voxelPos.x - position.x;
-            float dy = voxelPos.y - position.y;
-            float distance = sqrt(dx * dx + dy * dy);
+            std::size_t end = i;
+            while (end < changes.size() && chunkKey(changes[end]) == chunkKey(changes[i]))
+                ++end;
 
-            if (distance < EXPLOSION_RADIUS)
+            // Merge repeated writes to the same cell
+            std::vector<Change> merged;
+            for (std::size_t j = i; j < end; ++j)
             {
-                // Create debris particles
-                for (int i = 0; i < 3; ++i)
-                {
-                    float angle = (rand() % 360) * 3.14159f / 180.f;
-                    float speed = 50.f + (rand() % 50);
-                    sf::Vector2f velocity(cos(angle) * speed, sin(angle) * speed);
-                    particles.emplace_back(voxelPos, velocity, sf::Color::White);
-                }
-                it = voxels.erase(it);
+                if (!merged.empty() && cellIndex(merged.back()) == cellIndex(changes[j]))
+                    merged.back().after = changes[j].after;
+                else
+                    merged.push_back(changes[j]);
             }
-            else
+
+            writeVarint(out, static_cast<sf::Uint32>(changes[i].x / CHUNK_SIZE * CHUNK_SIZE));
+            writeVarint(out, static_cast<sf::Uint32>(changes[i].y / CHUNK_SIZE * CHUNK_SIZE));
+            writeVarint(out, static_cast<sf::Uint32>(merged.size()));
+            int previous = 0;
+            for (const auto &change : merged)
             {
-                ++it;
+                writeVarint(out, static_cast<sf::Uint32>(cellIndex(change) - previous));
+                out.push_back(static_cast<sf::Uint8>(change.before));
+                out.push_back(static_cast<sf::Uint8>(change.after));
+                previous = cellIndex(change);
             }
+            i = end;
         }
+        return entry;
     }
 
-    void updateScreenShake(float deltaTime)
+    static void apply(const Entry &entry, VoxelGrid &grid, bool forward)
     {
-        if (screenShakeTime > 0)
-        {
-            screenShakeTime -= deltaTime;
-            float intensity = (screenShakeTime / SCREEN_SHAKE_DURATION) * SCREEN_SHAKE_INTENSITY;
-            screenShakeOffset = sf::Vector2f(
-                (rand() % 100 - 50) * 0.01f * intensity,
-                (rand() % 100 - 50) * 0.01f * intensity);
-        }
-        else
+        const sf::Uint8 *data = entry.data.data();
+        const sf::Uint8 *end = data + entry.data.size();
+
+        sf::Uint32 chunkCount = 0;
+        readVarint(data, end, chunkCount);
+        for (sf::Uint32 chunk = 0; chunk < chunkCount; ++chunk)
         {
-            screenShakeOffset = sf::Vector2f(0, 0);
+            sf::Uint32 originX = 0, originY = 0, changeCount = 0;
+            readVarint(data, end, originX);
+            readVarint(data, end, originY);
+            readVarint(data, end, changeCount);
+
+            sf::Uint32 cell = 0;
+            for (sf::Uint32 i = 0; i < changeCount; ++i)
+            {
+                sf::Uint32 gap = 0;
+                readVarint(data, end, gap);
+                cell += gap;
+                Material before = static_cast<Material>(data[0]);
+                Material after = static_cast<Material>(data[1]);
+                data += 2;
+                grid.set(static_cast<int>(originX + cell % CHUNK_SIZE), static_cast<int>(originY + cell / CHUNK_SIZE),
+                         forward ? after : before);
+            }
         }
     }
+};
 
-    void update(float deltaTime)
+// Persists the voxel world on a background thread. The frame only hands over
+// a copy-on-write copy of the grid (chunk pointers, no cell data); the writer
+// re-encodes just the chunks that are no longer shared with the previous save,
+// writes everything to a temporary file, fsyncs it and renames it over the
+// old save so a crash never leaves a half-written world behind.
+//
+// File layout: "VOXW", format version, width, height, chunk count, then per
+// chunk a varint length and the chunk encoded as a delta from empty. Version 2
+// has 64x64 chunks; version 1 files (32x32) are not read.
+class AutosaveWriter
+{
+public:
+    // Stats of the most recent save, readable from any thread
+    std::atomic<long> lastDurationUs{0};
+    std::atomic<long> lastBytesWritten{0};
+    std::atomic<int> lastChunksEncoded{0};
+    std::atomic<int> saveCount{0};
+
+    AutosaveWriter(const std::string &path) : path(path), thread([this]() { writerLoop(); })
     {
-        // Player movement
-        if (sf::Keyboard::isKeyPressed(sf::Keyboard::A))
-            player.velocity.x = -PLAYER_SPEED;
-        else if (sf::Keyboard::isKeyPressed(sf::Keyboard::D))
-            player.velocity.x = PLAYER_SPEED;
-        else
-            player.velocity.x = 0;
+    }
 
-        if (sf::Keyboard::isKeyPressed(sf::Keyboard::Space) && !player.isJumping)
+    ~AutosaveWriter()
+    {
         {
-            player.velocity.y = JUMP_VELOCITY;
-            player.isJumping = true;
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
         }
+        wake.notify_one();
+        thread.join();
+    }
 
-        // Apply gravity
-        player.velocity.y += GRAVITY * deltaTime;
-
-        // Update player position
-        sf::Vector2f newPos = player.shape.getPosition();
-        newPos += player.velocity * deltaTime;
+    // Queues a save of the grid. If the writer is still busy, an older queued save is replaced.
+    void submit(const VoxelGrid &grid)
+    {
+        std::unique_ptr<VoxelGrid> copy(new VoxelGrid(grid));
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.swap(copy);
+        }
+        wake.notify_one();
+    }
 
-        handleCollisions(newPos, deltaTime);
+    // Loads a world saved by the writer into grid. Returns false if there is no usable file.
+    static bool load(const std::string &path, VoxelGrid &grid)
+    {
+        std::FILE *file = std::fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
 
-        // Window bounds checking
-        if (newPos.x < 0)
-            newPos.x = 0;
-        if (newPos.x > WINDOW_WIDTH - player.shape.getSize().x)
-            newPos.x = WINDOW_WIDTH - player.shape.getSize().x;
-        if (newPos.y > WINDOW_HEIGHT - player.shape.getSize().y)
+        std::vector<sf::Uint8> bytes;
+        sf::Uint8 buffer[65536];
+        std::size_t read;
+        while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
         {
-            newPos.y = WINDOW_HEIGHT - player.shape.getSize().y;
-            player.velocity.y = 0;
-            player.isJumping = false;
+            bytes.insert(bytes.end(), buffer, buffer + read);
         }
+        std::fclose(file);
 
-        player.shape.setPosition(newPos);
+        const sf::Uint8 *data = bytes.data();
+        const sf::Uint8 *end = data + bytes.size();
+        sf::Uint32 version, width, height, chunkCount;
+        if (bytes.size() < 4 || std::memcmp(data, "VOXW", 4) != 0)
+            return false;
+        data += 4;
+        if (!readVarint(data, end, version) || version != 2 ||
+            !readVarint(data, end, width) || !readVarint(data, end, height) || !readVarint(data, end, chunkCount) ||
+            static_cast<int>(width) != grid.getWidth() || static_cast<int>(height) != grid.getHeight() ||
+            static_cast<int>(chunkCount) != grid.getChunkCount())
+            return false;
 
-        // Update bullets
-        for (auto it = bullets.begin(); it != bullets.end();)
+        for (int chunk = 0; chunk < grid.getChunkCount(); ++chunk)
         {
-            it->shape.move(it->velocity * deltaTime);
+            sf::Uint32 size;
+            if (!readVarint(data, end, size) || size > static_cast<std::size_t>(end - data))
+                return false;
 
-            // Create bullet trail particles
-            if (rand() % 2 == 0)
-            {
-                particles.emplace_back(
-                    it->shape.getPosition(),
-                    sf::Vector2f(0, 0),
-                    sf::Color(255, 255, 0, 128));
-            }
+            int originX, originY;
+            grid.chunkOrigin(chunk, originX, originY);
+            bool valid = decodeChunkDelta(data, data + size, [&](sf::Uint32 cell, Material material) {
+                grid.set(originX + static_cast<int>(cell % CHUNK_SIZE), originY + static_cast<int>(cell / CHUNK_SIZE), material);
+            });
+            if (!valid)
+                return false;
+            data += size;
+        }
+        return true;
+    }
 
-            // Check bullet collision with voxels
-            bool bulletHit = false;
-            for (const auto &voxel : voxels)
-            {
-                if (it->shape.getGlobalBounds().intersects(voxel.shape.getGlobalBounds()))
-                {
-                    createExplosion(it->shape.getPosition());
-                    bulletHit = true;
-                    break;
-                }
-            }
+private:
+    std::string path;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::unique_ptr<VoxelGrid> pending;
+    bool stopping = false;
 
-            // Remove bullets that are out of bounds or hit voxels
-            if (bulletHit ||
-                it->shape.getPosition().x < 0 ||
-                it->shape.getPosition().x > WINDOW_WIDTH ||
-                it->shape.getPosition().y < 0 ||
-                it->shape.getPosition().y > WINDOW_HEIGHT)
-            {
-                it = bullets.erase(it);
-            }
-            else
-            {
-                ++it;
-            }
-        }
+    // Writer thread state: the grid of the previous save and its encoded chunks
+    std::unique_ptr<VoxelGrid> saved;
+    std::vector<std::vector<sf::Uint8>> encodedChunks;
 
-        // Update screen shake
-        updateScreenShake(deltaTime);
+    std::thread thread; // Last, so it starts after everything above is constructed
 
-        // Update particles
-        for (auto it = particles.begin(); it != particles.end();)
+    void writerLoop()
+    {
+        while (true)
         {
-            if (!it->update(deltaTime))
-            {
-                it = particles.erase(it);
-            }
-            else
+            std::unique_ptr<VoxelGrid> grid;
             {
-                ++it;
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return pending || stopping; });
+                if (!pending)
+                    return;
+                grid.swap(pending);
             }
+            write(std::move(grid));
         }
     }
 
-    void render()
+    void write(std::unique_ptr<VoxelGrid> grid)
     {
-        // Clear all layers
-        window.clear();
-        bulletLayer.clear(sf::Color::Transparent);
+        sf::Clock clock;
 
-        // Update background shader time
-        backgroundShader.setUniform("time", shaderClock.getElapsedTime().asSeconds());
+        bool sameShape = saved && saved->getWidth() == grid->getWidth() && saved->getHeight() == grid->getHeight();
+        encodedChunks.resize(grid->getChunkCount());
 
-        // Draw background with shader
-        sf::RectangleShape background(sf::Vector2f(WINDOW_WIDTH, WINDOW_HEIGHT));
-        window.draw(background, &backgroundShader);
+        int encoded = 0;
+        for (int chunk = 0; chunk < grid->getChunkCount(); ++chunk)
+        {
+            // A chunk still shared with the last save cannot have changed since
+            if (sameShape && grid->sharesChunk(*saved, chunk))
+                continue;
 
-        // Apply screen shake to view
-        sf::View view = window.getDefaultView();
-        view.move(screenShakeOffset);
-        window.setView(view);
+            encodedChunks[chunk].clear();
+            encodeChunkDelta(nullptr, grid->getChunkCells(chunk), encodedChunks[chunk]);
+            ++encoded;
+        }
 
-        // Draw voxels
-        for (const auto &voxel : voxels)
+        std::vector<sf::Uint8> header = {'V', 'O', 'X', 'W'};
+        writeVarint(header, 2);
+        writeVarint(header, static_cast<sf::Uint32>(grid->getWidth()));
+        writeVarint(header, static_cast<sf::Uint32>(grid->getHeight()));
+        writeVarint(header, static_cast<sf::Uint32>(grid->getChunkCount()));
+
+        std::string temporaryPath = path + ".tmp";
+        std::FILE *file = std::fopen(temporaryPath.c_str(), "wb");
+        if (!file)
         {
-            window.draw(voxel.shape);
+            std::cerr << "autosave: could not open " << temporaryPath << std::endl;
+            saved.reset(); // encodedChunks no longer match it; the next save encodes everything
+            return;
         }
 
-        // Draw bullets to separate layer with glow shader
-        for (const auto &bullet : bullets)
+        long bytes = 0;
+        bool ok = std::fwrite(header.data(), 1, header.size(), file) == header.size();
+        bytes += static_cast<long>(header.size());
+        std::vector<sf::Uint8> length;
+        for (const auto &chunk : encodedChunks)
         {
-            bulletLayer.draw(bullet.shape);
+            length.clear();
+            writeVarint(length, static_cast<sf::Uint32>(chunk.size()));
+            ok = ok && std::fwrite(length.data(), 1, length.size(), file) == length.size();
+            ok = ok && std::fwrite(chunk.data(), 1, chunk.size(), file) == chunk.size();
+            bytes += static_cast<long>(length.size() + chunk.size());
         }
-        bulletLayer.display();
 
-        // Draw bullet layer with glow effect
-        sf::Sprite bulletSprite(bulletLayer.getTexture());
-        window.draw(bulletSprite, &glowShader);
+        ok = ok && std::fflush(file) == 0;
+#ifdef _WIN32
+        ok = ok && _commit(_fileno(file)) == 0;
+#else
+        ok = ok && fsync(fileno(file)) == 0;
+#endif
+        ok = std::fclose(file) == 0 && ok;
 
-        // Draw particles
-        for (const auto &particle : particles)
+#ifdef _WIN32
+        // rename() does not replace existing files on Windows
+        std::remove(path.c_str());
+#endif
+        if (!ok || std::rename(temporaryPath.c_str(), path.c_str()) != 0)
         {
-            window.draw(particle.shape);
+            std::cerr << "autosave: could not write " << path << std::endl;
+            saved.reset();
+            return;
         }
 
-        // Draw player
-        window.draw(player.shape);
-
-        window.display();
+        saved = std::move(grid);
+        lastDurationUs = static_cast<long>(clock.getElapsedTime().asMicroseconds());
+        lastBytesWritten = bytes;
+        lastChunksEncoded = encoded;
+        ++saveCount;
     }
 };
 
-int main()
+// Replaces the grid contents with an image, one pixel per cell: pixels with
+// alpha above alphaThreshold become the material nearest to their color.
+// Chunks are converted in parallel straight into the grid's storage.
+void importImage(const sf::Image &image, VoxelGrid &grid, sf::Uint8 alphaThreshold, unsigned threadCount)
 {
-    Game game;
-    game.run();
-    return 0;
-}
\ No newline at end of file
+    const int imageWidth = static_cast<int>(image.getSize().x);
+    const int imageHeight = static_cast<int>(image.getSize().y);
+    const sf::Uint8 *pixels = image.getPixelsPtr();
+    nearestMaterial(sf::Color::White); // Build the lookup table before the workers race for it
+
+    auto convert = [&](int chunk, Material *cells) {
+        int originX, originY;
+        grid.chunkOrigin(chunk, originX, originY);
+        std::fill(cells, cells + VoxelGrid::CHUNK_CELLS, Material::Empty);
+
+        int width = std::min(CHUNK_SIZE, std::min(imageWidth, grid.getWidth()) - originX);
+        int height = std::min(CHUNK_SIZE, std::min(imageHeight, grid.getHeight()) - originY);
+        for (int y = 0; y < height; ++y)
+        {
+            const sf::Uint8 *pixel = pixels + (static_cast<std::size_t>(originY + y) * imageWidth + originX) * 4;
+            Material *row = cells + y * CHUNK_SIZE;
+            for (int x = 0; x < width; ++x, pixel += 4)
+            {
+                if (pixel[3] > alphaThreshold)
+                    row[x] = nearestMaterial(sf::Color(pixel[0], pixel[1], pixel[2]));
+            }
+        }
+    };
+    grid.writeChunksParallel(convert, threadCount);
+}
+
+// Deterministic terrain: a value-noise heightmap with grass, dirt and stone
+// layers, sandy lowlands and noise-carved caves. Every cell is a pure function
+// of (seed, x, y), so chunks can be generated independently, in any order, on
+// any thread, and regenerated later instead of being stored.
+class TerrainGenerator
+{
+public:
+    TerrainGenerator(sf::Uint32 seed, int worldHeight) : seed(seed), worldHeight(worldHeight)
+    {
+    }
+
+    // Row of the topmost solid cell in column x
+    int surfaceAt(int x) const
+    {
+        float height = fractalNoise1D(x / 96.f, 4);
+        return static_cast<int>(worldHeight * (0.55f + (height - 0.5f) * 0.35f));
+    }
+
+    Material cellAt(int x, int y, int surface) const
+    {
+        if (y < surface)
+            return Material::Empty;
+
+        int depth = y - surface;
+        if (depth > 6 && fractalNoise2D(x / 24.f, y / 16.f, 3) > 0.62f)
+            return Material::Empty; // Cave
+
+        bool lowland = surface > worldHeight * 0.62f;
+        if (depth < 2)
+            return lowland ? Material::Sand : Material::Grass;
+        if (depth < 10)
+            return lowland ? Material::Sand : Material::Dirt;
+        return Material::Stone;
+    }
+
+    // Fills one chunk of a grid (row-major CHUNK_SIZE x CHUNK_SIZE cells)
+    void generateChunk(const VoxelGrid &grid, int chunk, Material *cells) const
+    {
+        int originX, originY;
+        grid.chunkOrigin(chunk, originX, originY);
+        std::fill(cells, cells + VoxelGrid::CHUNK_CELLS, Material::Empty);
+
+        int width = std::min(CHUNK_SIZE, grid.getWidth() - originX);
+        int height = std::min(CHUNK_SIZE, grid.getHeight() - originY);
+        for (int x = 0; x < width; ++x)
+        {
+            int surface = surfaceAt(originX + x);
+            for (int y = std::max(0, surface - originY); y < height; ++y)
+            {
+                cells[y * CHUNK_SIZE + x] = cellAt(originX + x, originY + y, surface);
+            }
+        }
+
+        // Trees reaching into this chunk, including ones rooted in the neighbors
+        for (int treeX = originX - TREE_CROWN; treeX < originX + width + TREE_CROWN; ++treeX)
+        {
+            int surface = surfaceAt(treeX);
+            // One in 25 upland columns
+            if (hash(treeX, 0, 50) >= 0.04f || surface > worldHeight * 0.62f)
+                continue;
+
+            int top = surface - 8 - static_cast<int>(hash(treeX, 0, 51) * 8.f);
+            for (int y = top - TREE_CROWN; y < surface; ++y)
+            {
+                for (int x = treeX - TREE_CROWN; x <= treeX + TREE_CROWN; ++x)
+                {
+                    int localX = x - originX, localY = y - originY;
+                    if (localX < 0 || localY < 0 || localX >= width || localY >= height)
+                        continue;
+                    Material &cell = cells[localY * CHUNK_SIZE + localX];
+                    int dx = x - treeX, dy = y - top;
+                    if (cell != Material::Empty)
+                        continue;
+                    if (x == treeX && y >= top)
+                        cell = Material::Wood;
+                    else if (dx * dx + dy * dy <= TREE_CROWN * TREE_CROWN)
+                        cell = Material::Leaves;
+                }
+            }
+        }
+    }
+
+private:
+    static const int TREE_CROWN = 4; // Crown radius in cells
+    sf::Uint32 seed;
+    int worldHeight;
+
+    // Integer hash to [0, 1)
+    float hash(sf::Int32 x, sf::Int32 y, sf::Uint32 salt) const
+    {
+        sf::Uint32 h = seed ^ salt;
+        h ^= static_cast<sf::Uint32>(x) * 0x27d4eb2dU;
+        h = (h ^ (h >> 15)) * 0x85ebca6bU;
+        h ^= static_cast<sf::Uint32>(y) * 0x165667b1U;
+        h = (h ^ (h >> 13)) * 0xc2b2ae35U;
+        h ^= h >> 16;
+        return (h & 0xFFFFFF) / static_cast<float>(0x1000000);
+    }
+
+    static float smooth(float t)
+    {
+        return t * t * (3.f - 2.f * t);
+    }
+
+    float valueNoise1D(float x, sf::Uint32 salt) const
+    {
+        float cell = std::floor(x);
+        float t = smooth(x - cell);
+        sf::Int32 i = static_cast<sf::Int32>(cell);
+        return hash(i, 0, salt) + (hash(i + 1, 0, salt) - hash(i, 0, salt)) * t;
+    }
+
+    float valueNoise2D(float x, float y, sf::Uint32 salt) const
+    {
+        float cellX = std::floor(x), cellY = std::floor(y);
+        float tx = smooth(x - cellX), ty = smooth(y - cellY);
+        sf::Int32 i = static_cast<sf::Int32>(cellX), j = static_cast<sf::Int32>(cellY);
+        float top = hash(i, j, salt) + (hash(i + 1, j, salt) - hash(i, j, salt)) * tx;
+        float bottom = hash(i, j + 1, salt) + (hash(i + 1, j + 1, salt) - hash(i, j + 1, salt)) * tx;
+        return top + (bottom - top) * ty;
+    }
+
+    // Octaves of noise summed with halving amplitude, normalized to [0, 1)
+    float fractalNoise1D(float x, int octaves) const
+    {
+        float sum = 0.f, amplitude = 1.f, total = 0.f;
+        for (int octave = 0; octave < octaves; ++octave)
+        {
+            sum += valueNoise1D(x, octave) * amplitude;
+            total += amplitude;
+            x *= 2.f;
+            amplitude *= 0.5f;
+        }
+        return sum / total;
+    }
+
+    float fractalNoise2D(float x, float y, int octaves) const
+    {
+        float sum = 0.f, amplitude = 1.f, total = 0.f;
+        for (int octave = 0; octave < octaves; ++octave)
+        {
+            sum += valueNoise2D(x, y, 100 + octave) * amplitude;
+            total += amplitude;
+            x *= 2.f;
+            y *= 2.f;
+            amplitude *= 0.5f;
+        }
+        return sum / total;
+    }
+};
+
+void generateTerrain(VoxelGrid &grid, sf::Uint32 seed, unsigned threadCount)
+{
+    TerrainGenerator generator(seed, grid.getHeight());
+    auto generate = [&generator, &grid](int chunk, Material *cells) {
+        generator.generateChunk(grid, chunk, cells);
+    };
+    grid.writeChunksParallel(generate, threadCount);
+}
+
+// One bit per cell of a grid-sized area. Rows are 64-bit words aligned with
+// the voxel grid's chunk columns, so word wx of row y holds the same cells as
+// VoxelChunk::rows of chunk column wx and masks are built by copying words.
+class VoxelMask
+{
+public:
+    VoxelMask(int width, int height)
+        : width(width), height(height), wordsPerRow((width + 63) / 64),
+          words(static_cast<std::size_t>(wordsPerRow) * height, 0)
+    {
+    }
+
+    // The solid cells of a grid
+    static VoxelMask solidCells(const VoxelGrid &grid)
+    {
+        VoxelMask mask(grid.getWidth(), grid.getHeight());
+        for (int chunk = 0; chunk < grid.getChunkCount(); ++chunk)
+        {
+            int originX, originY;
+            grid.chunkOrigin(chunk, originX, originY);
+            int rows = std::min(CHUNK_SIZE, grid.getHeight() - originY);
+            const sf::Uint64 *source = grid.getChunkRows(chunk);
+            for (int y = 0; y < rows; ++y)
+                mask.word(originX / 64, originY + y) = source[y];
+        }
+        return mask;
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getWordsPerRow() const { return wordsPerRow; }
+
+    bool get(int x, int y) const
+    {
+        return x >= 0 && y >= 0 && x < width && y < height && (word(x / 64, y) >> (x % 64) & 1);
+    }
+
+    void set(int x, int y)
+    {
+        if (x >= 0 && y >= 0 && x < width && y < height)
+            word(x / 64, y) |= sf::Uint64(1) << (x % 64);
+    }
+
+    sf::Uint64 &word(int wx, int y) { return words[static_cast<std::size_t>(y) * wordsPerRow + wx]; }
+    sf::Uint64 word(int wx, int y) const { return words[static_cast<std::size_t>(y) * wordsPerRow + wx]; }
+
+    // Word with every position outside the area (past the edges, or past the
+    // width in the last word) reading as the bits of outside
+    sf::Uint64 wordOr(int wx, int y, sf::Uint64 outside) const
+    {
+        if (wx < 0 || y < 0 || wx >= wordsPerRow || y >= height)
+            return outside;
+        return word(wx, y) | (outside & ~validBits(wx));
+    }
+
+    // Bits of word wx that lie inside the width
+    sf::Uint64 validBits(int wx) const
+    {
+        int used = width - wx * 64;
+        return used >= 64 ? ~sf::Uint64(0) : (sf::Uint64(1) << used) - 1;
+    }
+
+    std::size_t count() const
+    {
+        std::size_t total = 0;
+        for (sf::Uint64 bits : words)
+            total += popCount(bits);
+        return total;
+    }
+
+    // Calls visit(x, y) for every set cell, row by row
+    template <typename Visit>
+    void forEach(Visit visit) const
+    {
+        for (int y = 0; y < height; ++y)
+        {
+            for (int wx = 0; wx < wordsPerRow; ++wx)
+            {
+                for (sf::Uint64 bits = word(wx, y); bits; bits &= bits - 1)
+                    visit(wx * 64 + lowestBit(bits), y);
+            }
+        }
+    }
+
+private:
+    int width;
+    int height;
+    int wordsPerRow;
+    std::vector<sf::Uint64> words;
+};
+
+// Grows the set bits of g through the set bits of p toward higher (fillHigh)
+// or lower (fillLow) bit positions, a whole word at a time. g must lie inside p.
+inline sf::Uint64 fillHigh(sf::Uint64 g, sf::Uint64 p)
+{
+    g |= p & (g << 1);
+    p &= p << 1;
+    g |= p & (g << 2);
+    p &= p << 2;
+    g |= p & (g << 4);
+    p &= p << 4;
+    g |= p & (g << 8);
+    p &= p << 8;
+    g |= p & (g << 16);
+    p &= p << 16;
+    return g | (p & (g << 32));
+}
+
+inline sf::Uint64 fillLow(sf::Uint64 g, sf::Uint64 p)
+{
+    g |= p & (g >> 1);
+    p &= p >> 1;
+    g |= p & (g >> 2);
+    p &= p >> 2;
+    g |= p & (g >> 4);
+    p &= p >> 4;
+    g |= p & (g >> 8);
+    p &= p >> 8;
+    g |= p & (g >> 16);
+    p &= p >> 16;
+    return g | (p & (g >> 32));
+}
+
+// Dilation (or erosion) of a mask by a disk of the given radius (at most 63
+// cells). Each output word is the OR (AND) of the neighboring rows' words
+// shifted across the disk's width; tiles of 64x64 cells run on threadCount
+// threads. Erosion treats everything outside the area as set, so the world's
+// edges don't erode.
+VoxelMask morphology(const VoxelMask &source, int radius, bool erode, unsigned threadCount)
+{
+    radius = std::max(0, std::min(radius, 63));
+    std::vector<int> halfWidth(radius + 1);
+    for (int dy = 0; dy <= radius; ++dy)
+        halfWidth[dy] = static_cast<int>(std::sqrt(static_cast<float>(radius * radius - dy * dy)) + 0.001f);
+
+    const sf::Uint64 outside = erode ? ~sf::Uint64(0) : 0;
+    VoxelMask result(source.getWidth(), source.getHeight());
+    int tilesX = source.getWordsPerRow();
+    int tilesY = (source.getHeight() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    parallelFor(tilesX * tilesY, threadCount, [&](int tile) {
+        int wx = tile % tilesX;
+        int rowStart = tile / tilesX * CHUNK_SIZE;
+        int rowEnd = std::min(rowStart + CHUNK_SIZE, source.getHeight());
+        for (int y = rowStart; y < rowEnd; ++y)
+        {
+            sf::Uint64 combined = outside;
+            for (int dy = -radius; dy <= radius; ++dy)
+            {
+                sf::Uint64 left = source.wordOr(wx - 1, y + dy, outside);
+                sf::Uint64 center = source.wordOr(wx, y + dy, outside);
+                sf::Uint64 right = source.wordOr(wx + 1, y + dy, outside);
+
+                sf::Uint64 row = center;
+                for (int k = 1; k <= halfWidth[std::abs(dy)]; ++k)
+                {
+                    sf::Uint64 fromRight = (center >> k) | (right << (64 - k));
+                    sf::Uint64 fromLeft = (center << k) | (left >> (64 - k));
+                    row = erode ? row & fromRight & fromLeft : row | fromRight | fromLeft;
+                }
+                combined = erode ? combined & row : combined | row;
+            }
+            result.word(wx, y) = combined & source.validBits(wx);
+        }
+    });
+    return result;
+}
+
+VoxelMask dilate(const VoxelMask &source, int radius, unsigned threadCount)
+{
+    return morphology(source, radius, false, threadCount);
+}
+
+VoxelMask erode(const VoxelMask &source, int radius, unsigned threadCount)
+{
+    return morphology(source, radius, true, threadCount);
+}
+
+// Cells of region 4-connected to (x, y); empty if (x, y) is not in region.
+// Alternating downward and upward sweeps grow the fill a row at a time and
+// along whole runs within each row, until nothing changes.
+VoxelMask floodFill(const VoxelMask &region, int x, int y)
+{
+    VoxelMask fill(region.getWidth(), region.getHeight());
+    if (!region.get(x, y))
+        return fill;
+    fill.set(x, y);
+
+    const int wordsPerRow = region.getWordsPerRow();
+    int top = y, bottom = y; // Rows the fill has reached so far
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            int step = pass == 0 ? 1 : -1;
+            int from = pass == 0 ? std::max(top - 1, 0) : std::min(bottom + 1, region.getHeight() - 1);
+            int to = pass == 0 ? region.getHeight() : -1;
+            for (int row = from; row != to; row += step)
+            {
+                bool rowChanged = false;
+                sf::Uint64 carry = 0;
+                for (int wx = 0; wx < wordsPerRow; ++wx)
+                {
+                    sf::Uint64 p = region.word(wx, row);
+                    sf::Uint64 g = fill.word(wx, row) | (carry & p);
+                    if (row - step >= 0 && row - step < region.getHeight())
+                        g |= fill.word(wx, row - step) & p;
+                    g = fillLow(fillHigh(g, p), p);
+                    carry = g >> 63;
+                    if (g != fill.word(wx, row))
+                    {
+                        fill.word(wx, row) = g;
+                        rowChanged = true;
+                    }
+                }
+                // Runs crossing word boundaries toward lower words
+                carry = 0;
+                for (int wx = wordsPerRow - 1; wx >= 0; --wx)
+                {
+                    sf::Uint64 p = region.word(wx, row);
+                    sf::Uint64 g = fill.word(wx, row) | (carry & p);
+                    g = fillHigh(fillLow(g, p), p);
+                    carry = (g & 1) << 63;
+                    if (g != fill.word(wx, row))
+                    {
+                        fill.word(wx, row) = g;
+                        rowChanged = true;
+                    }
+                }
+                if (rowChanged)
+                {
+                    changed = true;
+                    top = std::min(top, row);
+                    bottom = std::max(bottom, row);
+                }
+                else if (pass == 0 ? row > bottom : row < top)
+                {
+                    break; // Past the filled rows and nothing new reached
+                }
+            }
+        }
+    }
+    return fill;
+}
+
+// Connected (4-neighbor) components of a mask
+struct VoxelComponents
+{
+    int width = 0;
+    std::vector<int> labels; // Row-major, 0 for unset cells, otherwise 1..getCount()
+    std::vector<int> sizes;  // Cells per label; sizes[0] is unused
+
+    int getCount() const { return static_cast<int>(sizes.size()) - 1; }
+    int at(int x, int y) const { return labels[static_cast<std::size_t>(y) * width + x]; }
+};
+
+// Labels the components of a mask. Every 64x64 tile is labeled on its own
+// with word-parallel fills (tiles spread over threadCount threads); labels
+// touching across tile borders are then merged with a union-find.
+VoxelComponents labelComponents(const VoxelMask &mask, unsigned threadCount)
+{
+    const int width = mask.getWidth();
+    const int height = mask.getHeight();
+    const int tilesX = mask.getWordsPerRow();
+    const int tilesY = (height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    VoxelComponents result;
+    result.width = width;
+    result.labels.assign(static_cast<std::size_t>(width) * height, 0);
+    std::vector<std::vector<int>> tileSizes(static_cast<std::size_t>(tilesX) * tilesY);
+
+    // Tile-local labels 1..n
+    parallelFor(tilesX * tilesY, threadCount, [&](int tile) {
+        int wx = tile % tilesX;
+        int rowStart = tile / tilesX * CHUNK_SIZE;
+        int rows = std::min(CHUNK_SIZE, height - rowStart);
+        sf::Uint64 remaining[CHUNK_SIZE];
+        for (int y = 0; y < rows; ++y)
+            remaining[y] = mask.word(wx, rowStart + y);
+
+        for (int seedRow = 0; seedRow < rows; ++seedRow)
+        {
+            while (remaining[seedRow])
+            {
+                sf::Uint64 fill[CHUNK_SIZE] = {};
+                fill[seedRow] = remaining[seedRow] & (~remaining[seedRow] + 1);
+                bool changed = true;
+                while (changed)
+                {
+                    changed = false;
+                    for (int y = seedRow; y < rows; ++y)
+                    {
+                        sf::Uint64 g = fill[y] | (y > seedRow ? fill[y - 1] & remaining[y] : 0);
+                        g = fillLow(fillHigh(g, remaining[y]), remaining[y]);
+                        changed = changed || g != fill[y];
+                        fill[y] = g;
+                    }
+                    for (int y = rows - 2; y >= seedRow; --y)
+                    {
+                        sf::Uint64 g = fill[y] | (fill[y + 1] & remaining[y]);
+                        g = fillLow(fillHigh(g, remaining[y]), remaining[y]);
+                        changed = changed || g != fill[y];
+                        fill[y] = g;
+                    }
+                }
+
+                std::vector<int> &sizes = tileSizes[tile];
+                int label = static_cast<int>(sizes.size()) + 1;
+                int size = 0;
+                for (int y = seedRow; y < rows; ++y)
+                {
+                    remaining[y] &= ~fill[y];
+                    int *labels = &result.labels[static_cast<std::size_t>(rowStart + y) * width + wx * 64];
+                    for (sf::Uint64 bits = fill[y]; bits; bits &= bits - 1)
+                    {
+                        labels[lowestBit(bits)] = label;
+                        ++size;
+                    }
+                }
+                sizes.push_back(size);
+            }
+        }
+    });
+
+    // Global provisional labels: tile offset + local label
+    std::vector<int> offsets(tileSizes.size() + 1, 0);
+    for (std::size_t tile = 0; tile < tileSizes.size(); ++tile)
+        offsets[tile + 1] = offsets[tile] + static_cast<int>(tileSizes[tile].size());
+
+    std::vector<int> parent(offsets.back() + 1);
+    for (std::size_t i = 0; i < parent.size(); ++i)
+        parent[i] = static_cast<int>(i);
+    auto find = [&parent](int label) {
+        while (parent[label] != label)
+        {
+            parent[label] = parent[parent[label]];
+            label = parent[label];
+        }
+        return label;
+    };
+    auto global = [&](int x, int y) {
+        int tile = (y / CHUNK_SIZE) * tilesX + x / 64;
+        return offsets[tile] + result.labels[static_cast<std::size_t>(y) * width + x];
+    };
+    auto unite = [&](int a, int b) {
+        a = find(a);
+        b = find(b);
+        if (a != b)
+            parent[std::max(a, b)] = std::min(a, b);
+    };
+
+    // Merge across tile borders: vertical borders cell by cell, horizontal ones a word at a time
+    for (int y = 0; y < height; ++y)
+    {
+        for (int wx = 0; wx + 1 < tilesX; ++wx)
+        {
+            if ((mask.word(wx, y) >> 63) & mask.word(wx + 1, y) & 1)
+                unite(global(wx * 64 + 63, y), global(wx * 64 + 64, y));
+        }
+    }
+    for (int y = CHUNK_SIZE - 1; y + 1 < height; y += CHUNK_SIZE)
+    {
+        for (int wx = 0; wx < tilesX; ++wx)
+        {
+            for (sf::Uint64 bits = mask.word(wx, y) & mask.word(wx, y + 1); bits; bits &= bits - 1)
+            {
+                int x = wx * 64 + lowestBit(bits);
+                unite(global(x, y), global(x, y + 1));
+            }
+        }
+    }
+
+    // Compact the roots to 1..count and add up the sizes
+    std::vector<int> compact(parent.size(), 0);
+    result.sizes.assign(1, 0);
+    for (std::size_t tile = 0; tile < tileSizes.size(); ++tile)
+    {
+        for (std::size_t local = 0; local < tileSizes[tile].size(); ++local)
+        {
+            int label = offsets[tile] + static_cast<int>(local) + 1;
+            int root = find(label);
+            if (compact[root] == 0)
+            {
+                compact[root] = static_cast<int>(result.sizes.size());
+                result.sizes.push_back(0);
+            }
+            compact[label] = compact[root];
+            result.sizes[compact[root]] += tileSizes[tile][local];
+        }
+    }
+
+    parallelFor(tilesX * tilesY, threadCount, [&](int tile) {
+        int wx = tile % tilesX;
+        int rowStart = tile / tilesX * CHUNK_SIZE;
+        int rowEnd = std::min(rowStart + CHUNK_SIZE, height);
+        int columns = std::min(64, width - wx * 64);
+        for (int y = rowStart; y < rowEnd; ++y)
+        {
+            int *labels = &result.labels[static_cast<std::size_t>(y) * width + wx * 64];
+            for (int x = 0; x < columns; ++x)
+            {
+                if (labels[x])
+                    labels[x] = compact[offsets[tile] + labels[x]];
+            }
+        }
+    });
+    return result;
+}
+
+// Walks the cells along a ray (direction normalized, pixels) from distance
+// start to end, in order. Returns true with the distance where the ray enters
+// the first solid cell. Stops early once the ray has left the grid, or when
+// pause(x, y) returns true for a cell it steps into; t is then the distance
+// where it entered that cell and paused is set.
+template <typename Pause>
+bool walkCells(const VoxelGrid &grid, const sf::Vector2f &origin, const sf::Vector2f &direction,
+               float start, float end, float &t, bool &paused, Pause pause)
+{
+    const float infinity = std::numeric_limits<float>::infinity();
+    sf::Vector2f point = origin + direction * start;
+    int x = static_cast<int>(std::floor(point.x / VOXEL_SIZE));
+    int y = static_cast<int>(std::floor(point.y / VOXEL_SIZE));
+    int stepX = direction.x > 0 ? 1 : -1;
+    int stepY = direction.y > 0 ? 1 : -1;
+    // Boundary distances are computed from the origin every step rather than
+    // accumulated, so walks started at different points agree exactly
+    float inverseX = direction.x != 0 ? 1.f / direction.x : 0.f;
+    float inverseY = direction.y != 0 ? 1.f / direction.y : 0.f;
+    auto boundaryX = [&]() {
+        return direction.x != 0 ? ((x + (stepX > 0)) * VOXEL_SIZE - origin.x) * inverseX : infinity;
+    };
+    auto boundaryY = [&]() {
+        return direction.y != 0 ? ((y + (stepY > 0)) * VOXEL_SIZE - origin.y) * inverseY : infinity;
+    };
+    float nextX = boundaryX();
+    float nextY = boundaryY();
+
+    paused = false;
+    t = start;
+    while (t <= end)
+    {
+        if (grid.isSolid(x, y))
+            return true;
+        if ((x < 0 && stepX < 0) || (x >= grid.getWidth() && stepX > 0) ||
+            (y < 0 && stepY < 0) || (y >= grid.getHeight() && stepY > 0))
+            return false;
+
+        if (nextX < nextY)
+        {
+            t = nextX;
+            x += stepX;
+            nextX = boundaryX();
+        }
+        else
+        {
+            t = nextY;
+            y += stepY;
+            nextY = boundaryY();
+        }
+        if (t <= end && pause(x, y))
+        {
+            paused = true;
+            return false;
+        }
+    }
+    return false;
+}
+
+// Ray cast visiting every cell on the way; the reference for DistanceField::rayCast
+inline bool rayCastCells(const VoxelGrid &grid, const sf::Vector2f &origin, const sf::Vector2f &direction,
+                         float maxDistance, float &hit)
+{
+    bool paused;
+    return walkCells(grid, origin, direction, 0.f, maxDistance, hit, paused, [](int, int) { return false; });
+}
+
+// Coarse distance from every DISTANCE_BLOCK x DISTANCE_BLOCK block of a voxel
+// grid to the nearest block holding a solid cell, in blocks (Chebyshev),
+// capped at DISTANCE_FIELD_MAX. A point in a block at distance d is at least
+// (d - 1) blocks of pixels away from any solid cell, so queries can skip that
+// much empty space at once: rays sphere-trace through open air and only walk
+// cell by cell next to terrain.
+//
+// update() follows the grid's chunk revisions. An edit can only change
+// distances up to the cap away, so each changed chunk recomputes just that
+// window (two chamfer passes over it, plus another cap of margin for the
+// sources), never the whole field.
+class DistanceField
+{
+public:
+    static const int BLOCKS_PER_CHUNK = CHUNK_SIZE / DISTANCE_BLOCK;
+
+    int getBlocksX() const { return blocksX; }
+    int getBlocksY() const { return blocksY; }
+    std::size_t getUpdatedBlocks() const { return updatedBlocks; }
+    int getDistance(int blockX, int blockY) const { return distances[blockY * blocksX + blockX]; }
+
+    // Solid cells as a flat bitmap, bit x % 32 of word y * getWordStride() + x / 32;
+    // a copy of the grid's chunk row words made by update(), for gathers
+    const sf::Uint32 *getSolidWords() const { return solidWords.data(); }
+    int getWordStride() const { return wordStride; }
+    // Block distances row by row, readable 3 bytes past the end (for 32-bit gathers)
+    const sf::Uint8 *getDistances() const { return distances.data(); }
+
+    // Distance of the block holding the cell; 0 off the field
+    int cellDistance(int x, int y) const
+    {
+        unsigned blockX = static_cast<unsigned>(x) / DISTANCE_BLOCK;
+        unsigned blockY = static_cast<unsigned>(y) / DISTANCE_BLOCK;
+        if (blockX >= static_cast<unsigned>(blocksX) || blockY >= static_cast<unsigned>(blocksY))
+            return 0;
+        return distances[blockY * blocksX + blockX];
+    }
+
+    // Forces a full rebuild on the next update (the grid was swapped, not edited)
+    void invalidate()
+    {
+        blocksX = blocksY = 0;
+    }
+
+    // Brings the field up to date with the grid
+    void update(const VoxelGrid &grid)
+    {
+        updatedBlocks = 0;
+        if (blocksX != (grid.getWidth() + DISTANCE_BLOCK - 1) / DISTANCE_BLOCK ||
+            blocksY != (grid.getHeight() + DISTANCE_BLOCK - 1) / DISTANCE_BLOCK ||
+            chunkRevisions.size() != static_cast<std::size_t>(grid.getChunkCount()))
+        {
+            rebuild(grid);
+            return;
+        }
+        if (grid.getRevision() == revision)
+            return;
+
+        for (int chunk = 0; chunk < grid.getChunkCount(); ++chunk)
+        {
+            if (grid.getChunkRevision(chunk) == chunkRevisions[chunk])
+                continue;
+            chunkRevisions[chunk] = grid.getChunkRevision(chunk);
+            if (!updateOccupancy(grid, chunk))
+                continue;
+
+            int blockX = (chunk % grid.getChunksX()) * BLOCKS_PER_CHUNK;
+            int blockY = (chunk / grid.getChunksX()) * BLOCKS_PER_CHUNK;
+            recompute(blockX - DISTANCE_FIELD_MAX, blockY - DISTANCE_FIELD_MAX,
+                      blockX + BLOCKS_PER_CHUNK - 1 + DISTANCE_FIELD_MAX,
+                      blockY + BLOCKS_PER_CHUNK - 1 + DISTANCE_FIELD_MAX);
+        }
+        revision = grid.getRevision();
+    }
+
+    // Pixels around the point guaranteed to be free of solid cells; 0 next to terrain or off the grid
+    float clearance(const sf::Vector2f &point) const
+    {
+        const float blockPixels = static_cast<float>(DISTANCE_BLOCK * VOXEL_SIZE);
+        int blockX = static_cast<int>(std::floor(point.x / blockPixels));
+        int blockY = static_cast<int>(std::floor(point.y / blockPixels));
+        if (blockX < 0 || blockY < 0 || blockX >= blocksX || blockY >= blocksY)
+            return 0.f;
+        return std::max(distances[blockY * blocksX + blockX] - 1, 0) * blockPixels;
+    }
+
+    // Same result as rayCastCells, but skips empty space: next to terrain
+    // the ray walks cells, and as soon as it enters a block with clearance it
+    // jumps ahead by that much
+    bool rayCast(const VoxelGrid &grid, const sf::Vector2f &origin, const sf::Vector2f &direction,
+                 float maxDistance, float &hit) const
+    {
+        const float blockPixels = static_cast<float>(DISTANCE_BLOCK * VOXEL_SIZE);
+        float t = 0.f;
+        float free = 0.f;
+        while (t <= maxDistance)
+        {
+            if (free > 0.f)
+            {
+                t += free;
+                free = clearance(origin + direction * t);
+                continue;
+            }
+
+            bool paused;
+            if (walkCells(grid, origin, direction, t, maxDistance, hit, paused, [&](int x, int y) {
+                    int distance = cellDistance(x, y);
+                    if (distance <= 1)
+                        return false;
+                    free = (distance - 1) * blockPixels;
+                    return true;
+                }))
+                return true;
+            if (!paused)
+                return false;
+            t = hit;
+        }
+        return false;
+    }
+
+private:
+    int blocksX = 0;
+    int blocksY = 0;
+    std::vector<sf::Uint8> distances;
+    std::vector<char> occupied;               // Block holds a solid cell
+    std::vector<sf::Uint32> solidWords;
+    int wordStride = 0;
+    std::vector<sf::Uint32> chunkRevisions;   // Grid chunk revisions the field reflects
+    sf::Uint32 revision = 0;
+    std::size_t updatedBlocks = 0;            // Blocks recomputed by the last update, for stats
+    std::vector<sf::Uint8> scratch;
+
+    void rebuild(const VoxelGrid &grid)
+    {
+        blocksX = (grid.getWidth() + DISTANCE_BLOCK - 1) / DISTANCE_BLOCK;
+        blocksY = (grid.getHeight() + DISTANCE_BLOCK - 1) / DISTANCE_BLOCK;
+        occupied.assign(static_cast<std::size_t>(blocksX) * blocksY, 0);
+        distances.assign(occupied.size() + 3, DISTANCE_FIELD_MAX);
+        wordStride = grid.getChunksX() * CHUNK_SIZE / 32;
+        solidWords.assign(static_cast<std::size_t>(wordStride) * grid.getChunksY() * CHUNK_SIZE, 0);
+        chunkRevisions.resize(grid.getChunkCount());
+        for (int chunk = 0; chunk < grid.getChunkCount(); ++chunk)
+        {
+            chunkRevisions[chunk] = grid.getChunkRevision(chunk);
+            updateOccupancy(grid, chunk);
+        }
+        recompute(0, 0, blocksX - 1, blocksY - 1);
+        revision = grid.getRevision();
+    }
+
+    // Copies a chunk's row words into the bitmap and re-reads the occupancy
+    // of its blocks; true if any block changed
+    bool updateOccupancy(const VoxelGrid &grid, int chunk)
+    {
+        const sf::Uint64 *rows = grid.getChunkRows(chunk);
+        int firstX = (chunk % grid.getChunksX()) * BLOCKS_PER_CHUNK;
+        int firstY = (chunk / grid.getChunksX()) * BLOCKS_PER_CHUNK;
+
+        sf::Uint32 *words = solidWords.data() + static_cast<std::size_t>(firstY * DISTANCE_BLOCK) * wordStride +
+                            firstX * DISTANCE_BLOCK / 32;
+        for (int row = 0; row < CHUNK_SIZE; ++row, words += wordStride)
+        {
+            words[0] = static_cast<sf::Uint32>(rows[row]);
+            words[1] = static_cast<sf::Uint32>(rows[row] >> 32);
+        }
+
+        bool changed = false;
+        for (int by = 0; by < BLOCKS_PER_CHUNK && firstY + by < blocksY; ++by)
+        {
+            sf::Uint64 any = 0;
+            for (int row = 0; row < DISTANCE_BLOCK; ++row)
+                any |= rows[by * DISTANCE_BLOCK + row];
+            for (int bx = 0; bx < BLOCKS_PER_CHUNK && firstX + bx < blocksX; ++bx)
+            {
+                const sf::Uint64 mask = ((sf::Uint64(1) << DISTANCE_BLOCK) - 1) << (bx * DISTANCE_BLOCK);
+                char solid = (any & mask) != 0;
+                char &block = occupied[(firstY + by) * blocksX + firstX + bx];
+                changed |= block != solid;
+                block = solid;
+            }
+        }
+        return changed;
+    }
+
+    // Recomputes the distances of the blocks in the inclusive range (clipped
+    // to the field) from the sources up to the cap around it
+    void recompute(int x0, int y0, int x1, int y1)
+    {
+        x0 = std::max(x0, 0);
+        y0 = std::max(y0, 0);
+        x1 = std::min(x1, blocksX - 1);
+        y1 = std::min(y1, blocksY - 1);
+        const int sx0 = std::max(x0 - DISTANCE_FIELD_MAX, 0), sy0 = std::max(y0 - DISTANCE_FIELD_MAX, 0);
+        const int sx1 = std::min(x1 + DISTANCE_FIELD_MAX, blocksX - 1);
+        const int sy1 = std::min(y1 + DISTANCE_FIELD_MAX, blocksY - 1);
+        const int w = sx1 - sx0 + 1, h = sy1 - sy0 + 1;
+
+        scratch.resize(static_cast<std::size_t>(w) * h);
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w; ++x)
+                scratch[y * w + x] = occupied[(sy0 + y) * blocksX + sx0 + x] ? 0 : DISTANCE_FIELD_MAX;
+
+        // Chebyshev chamfer: forward over the upper-left neighbors, backward over the lower-right ones
+        auto relax = [&](int x, int y, int nx, int ny) {
+            if (nx >= 0 && nx < w && ny >= 0 && ny < h)
+                scratch[y * w + x] = std::min<int>(scratch[y * w + x], scratch[ny * w + nx] + 1);
+        };
+        for (int y = 0; y < h; ++y)
+        {
+            for (int x = 0; x < w; ++x)
+            {
+                relax(x, y, x - 1, y);
+                relax(x, y, x - 1, y - 1);
+                relax(x, y, x, y - 1);
+                relax(x, y, x + 1, y - 1);
+            }
+        }
+        for (int y = h - 1; y >= 0; --y)
+        {
+            for (int x = w - 1; x >= 0; --x)
+            {
+                relax(x, y, x + 1, y);
+                relax(x, y, x + 1, y + 1);
+                relax(x, y, x, y + 1);
+                relax(x, y, x - 1, y + 1);
+            }
+        }
+
+        for (int y = y0; y <= y1; ++y)
+            for (int x = x0; x <= x1; ++x)
+                distances[y * blocksX + x] = scratch[(y - sy0) * w + x - sx0];
+        updatedBlocks += static_cast<std::size_t>(x1 - x0 + 1) * (y1 - y0 + 1);
+    }
+};
+
+// Direction normalized; distances in pixels
+struct Ray
+{
+    sf::Vector2f origin;
+    sf::Vector2f direction;
+    float maxDistance;
+};
+
+struct RayHit
+{
+    bool hit = false;
+    float distance = 0.f; // Where the ray enters the hit cell
+    sf::Vector2i cell;
+};
+
+// Casts count rays over RAY_LANES lanes in lockstep, structure-of-arrays.
+// The cell step is the same branch-free arithmetic for every lane and, with
+// AVX2, so are the solid and distance lookups (gathers from the field's
+// bitmap and distances); without it the lanes are stepped one by one. A lane
+// whose ray ends takes the next one right away, so short rays don't wait for
+// long ones. Lanes skip open space through the field exactly like
+// DistanceField::rayCast and return the very same hits. The field must be up
+// to date with the grid.
+void castRays(const VoxelGrid &grid, const DistanceField &field, const Ray *rays, std::size_t count, RayHit *hits)
+{
+    static_assert(RAY_LANES == 8, "one AVX2 register of lanes");
+    const float infinity = std::numeric_limits<float>::infinity();
+    const float blockPixels = static_cast<float>(DISTANCE_BLOCK * VOXEL_SIZE);
+    alignas(32) float t[RAY_LANES], nextX[RAY_LANES], nextY[RAY_LANES], limit[RAY_LANES];
+    alignas(32) float originX[RAY_LANES], originY[RAY_LANES], inverseX[RAY_LANES], inverseY[RAY_LANES];
+    alignas(32) int x[RAY_LANES], y[RAY_LANES], stepX[RAY_LANES], stepY[RAY_LANES];
+    alignas(32) int forwardX[RAY_LANES], forwardY[RAY_LANES], live[RAY_LANES];
+    std::size_t rayOf[RAY_LANES];
+    std::size_t next = 0;
+    int busy = RAY_LANES;
+
+    // Starts a lane's cell walk at distance start, as walkCells does
+    auto begin = [&](int lane, float start) {
+        const Ray &ray = rays[rayOf[lane]];
+        sf::Vector2f point = ray.origin + ray.direction * start;
+        x[lane] = static_cast<int>(std::floor(point.x / VOXEL_SIZE));
+        y[lane] = static_cast<int>(std::floor(point.y / VOXEL_SIZE));
+        stepX[lane] = ray.direction.x > 0 ? 1 : -1;
+        stepY[lane] = ray.direction.y > 0 ? 1 : -1;
+        forwardX[lane] = stepX[lane] > 0;
+        forwardY[lane] = stepY[lane] > 0;
+        originX[lane] = ray.origin.x;
+        originY[lane] = ray.origin.y;
+        inverseX[lane] = ray.direction.x != 0 ? 1.f / ray.direction.x : 0.f;
+        inverseY[lane] = ray.direction.y != 0 ? 1.f / ray.direction.y : 0.f;
+        nextX[lane] = inverseX[lane] != 0 ? ((x[lane] + forwardX[lane]) * VOXEL_SIZE - originX[lane]) * inverseX[lane]
+                                          : infinity;
+        nextY[lane] = inverseY[lane] != 0 ? ((y[lane] + forwardY[lane]) * VOXEL_SIZE - originY[lane]) * inverseY[lane]
+                                          : infinity;
+        t[lane] = start;
+    };
+    // Gives the lane the next ray, or parks it when there are none left
+    auto load = [&](int lane) {
+        if (next < count)
+        {
+            rayOf[lane] = next++;
+            limit[lane] = rays[rayOf[lane]].maxDistance;
+            live[lane] = -1;
+            begin(lane, 0.f);
+            return;
+        }
+        --busy;
+        live[lane] = 0;
+        x[lane] = y[lane] = stepX[lane] = stepY[lane] = forwardX[lane] = forwardY[lane] = 0;
+        originX[lane] = originY[lane] = inverseX[lane] = inverseY[lane] = 0.f;
+        nextX[lane] = nextY[lane] = t[lane] = limit[lane] = infinity;
+    };
+    auto finish = [&](int lane, bool hit) {
+        RayHit &result = hits[rayOf[lane]];
+        result.hit = hit;
+        result.distance = t[lane];
+        result.cell = sf::Vector2i(x[lane], y[lane]);
+        load(lane);
+    };
+    // Jumps a lane ahead through open space; resumes walking where the field runs out
+    auto resume = [&](int lane, float start) {
+        const Ray &ray = rays[rayOf[lane]];
+        while (start <= ray.maxDistance)
+        {
+            float free = field.clearance(ray.origin + ray.direction * start);
+            if (free <= 0.f)
+            {
+                begin(lane, start);
+                return;
+            }
+            start += free;
+        }
+        t[lane] = start;
+        finish(lane, false);
+    };
+
+    for (int lane = 0; lane < RAY_LANES; ++lane)
+        load(lane);
+
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256(), one = _mm256_set1_epi32(1), none = _mm256_set1_epi32(-1);
+    const __m256i width = _mm256_set1_epi32(grid.getWidth()), height = _mm256_set1_epi32(grid.getHeight());
+    const __m256i wordStride = _mm256_set1_epi32(field.getWordStride());
+    const __m256i blocksX = _mm256_set1_epi32(field.getBlocksX());
+    const __m256i low31 = _mm256_set1_epi32(31), lowByte = _mm256_set1_epi32(0xFF);
+    const __m256i cellSize = _mm256_set1_epi32(VOXEL_SIZE);
+    const __m256 noBoundary = _mm256_set1_ps(infinity), zeroF = _mm256_setzero_ps();
+    const int *words = reinterpret_cast<const int *>(field.getSolidWords());
+    const int *distanceBytes = reinterpret_cast<const int *>(field.getDistances());
+    auto load8 = [](const int *lanes) { return _mm256_load_si256(reinterpret_cast<const __m256i *>(lanes)); };
+    auto inGrid = [&](__m256i cellX, __m256i cellY) {
+        return _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(cellX, none), _mm256_cmpgt_epi32(width, cellX)),
+                                _mm256_and_si256(_mm256_cmpgt_epi32(cellY, none), _mm256_cmpgt_epi32(height, cellY)));
+    };
+    alignas(32) int distance[RAY_LANES];
+
+    while (busy > 0)
+    {
+        // The current cell of every lane, again for lanes that finish and start their next ray
+        for (;;)
+        {
+            __m256i cellX = load8(x), cellY = load8(y);
+            __m256i inside = inGrid(cellX, cellY);
+            __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(cellY, wordStride), _mm256_srai_epi32(cellX, 5));
+            __m256i word = _mm256_mask_i32gather_epi32(zero, words, index, inside, 4);
+            __m256i solid = _mm256_cmpeq_epi32(
+                _mm256_and_si256(_mm256_srlv_epi32(word, _mm256_and_si256(cellX, low31)), one), one);
+            __m256i sX = load8(stepX), sY = load8(stepY);
+            __m256i out = _mm256_or_si256(
+                _mm256_or_si256(_mm256_and_si256(_mm256_cmpgt_epi32(zero, cellX), _mm256_cmpgt_epi32(zero, sX)),
+                                _mm256_and_si256(_mm256_cmpgt_epi32(cellX, _mm256_sub_epi32(width, one)),
+                                                 _mm256_cmpgt_epi32(sX, zero))),
+                _mm256_or_si256(_mm256_and_si256(_mm256_cmpgt_epi32(zero, cellY), _mm256_cmpgt_epi32(zero, sY)),
+                                _mm256_and_si256(_mm256_cmpgt_epi32(cellY, _mm256_sub_epi32(height, one)),
+                                                 _mm256_cmpgt_epi32(sY, zero))));
+            __m256i active = load8(live);
+            int hitLanes = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(solid, active)));
+            int endLanes = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(_mm256_or_si256(solid, out), active)));
+            if (!endLanes)
+                break;
+            for (int lane = 0; lane < RAY_LANES; ++lane)
+            {
+                if (endLanes & (1 << lane))
+                    finish(lane, (hitLanes >> lane) & 1);
+            }
+        }
+
+        // One cell further, all lanes at once
+        __m256 boundaryX = _mm256_load_ps(nextX), boundaryY = _mm256_load_ps(nextY);
+        __m256 alongX = _mm256_cmp_ps(boundaryX, boundaryY, _CMP_LT_OQ);
+        __m256i alongXi = _mm256_castps_si256(alongX);
+        __m256 distanceAlong = _mm256_blendv_ps(boundaryY, boundaryX, alongX);
+        __m256i cellX = _mm256_add_epi32(load8(x), _mm256_and_si256(load8(stepX), alongXi));
+        __m256i cellY = _mm256_add_epi32(load8(y), _mm256_andnot_si256(alongXi, load8(stepY)));
+        __m256 invX = _mm256_load_ps(inverseX), invY = _mm256_load_ps(inverseY);
+        boundaryX = _mm256_mul_ps(
+            _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_mullo_epi32(_mm256_add_epi32(cellX, load8(forwardX)), cellSize)),
+                          _mm256_load_ps(originX)),
+            invX);
+        boundaryY = _mm256_mul_ps(
+            _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_mullo_epi32(_mm256_add_epi32(cellY, load8(forwardY)), cellSize)),
+                          _mm256_load_ps(originY)),
+            invY);
+        boundaryX = _mm256_blendv_ps(noBoundary, boundaryX, _mm256_cmp_ps(invX, zeroF, _CMP_NEQ_OQ));
+        boundaryY = _mm256_blendv_ps(noBoundary, boundaryY, _mm256_cmp_ps(invY, zeroF, _CMP_NEQ_OQ));
+        _mm256_store_ps(t, distanceAlong);
+        _mm256_store_ps(nextX, boundaryX);
+        _mm256_store_ps(nextY, boundaryY);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(x), cellX);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(y), cellY);
+
+        // Lanes past their range miss; lanes entering open space jump
+        __m256i active = load8(live);
+        __m256i past = _mm256_castps_si256(_mm256_cmp_ps(distanceAlong, _mm256_load_ps(limit), _CMP_GT_OQ));
+        __m256i block = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srai_epi32(cellY, 3), blocksX),
+                                         _mm256_srai_epi32(cellX, 3));
+        __m256i blockDistance = _mm256_and_si256(
+            _mm256_mask_i32gather_epi32(zero, distanceBytes, block, inGrid(cellX, cellY), 1), lowByte);
+        __m256i open = _mm256_cmpgt_epi32(blockDistance, one);
+        int pastLanes = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(past, active)));
+        int jumpLanes = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_andnot_si256(past, _mm256_and_si256(open, active))));
+        if (jumpLanes)
+            _mm256_store_si256(reinterpret_cast<__m256i *>(distance), blockDistance);
+        for (int lane = 0; lane < RAY_LANES; ++lane)
+        {
+            if (pastLanes & (1 << lane))
+                finish(lane, false);
+            else if (jumpLanes & (1 << lane))
+                resume(lane, t[lane] + (distance[lane] - 1) * blockPixels);
+        }
+    }
+#else
+    auto leaving = [&](int lane) {
+        return (x[lane] < 0 && stepX[lane] < 0) || (x[lane] >= grid.getWidth() && stepX[lane] > 0) ||
+               (y[lane] < 0 && stepY[lane] < 0) || (y[lane] >= grid.getHeight() && stepY[lane] > 0);
+    };
+
+    while (busy > 0)
+    {
+        // The current cell of every lane; a lane that finishes starts its next ray in the same place
+        for (int lane = 0; lane < RAY_LANES; ++lane)
+        {
+            while (live[lane])
+            {
+                if (grid.isSolid(x[lane], y[lane]))
+                    finish(lane, true);
+                else if (leaving(lane))
+                    finish(lane, false);
+                else
+                    break;
+            }
+        }
+
+        // One cell further, all lanes at once
+        for (int lane = 0; lane < RAY_LANES; ++lane)
+        {
+            bool alongX = nextX[lane] < nextY[lane];
+            t[lane] = alongX ? nextX[lane] : nextY[lane];
+            x[lane] += alongX ? stepX[lane] : 0;
+            y[lane] += alongX ? 0 : stepY[lane];
+            nextX[lane] = inverseX[lane] != 0
+                              ? ((x[lane] + forwardX[lane]) * VOXEL_SIZE - originX[lane]) * inverseX[lane]
+                              : infinity;
+            nextY[lane] = inverseY[lane] != 0
+                              ? ((y[lane] + forwardY[lane]) * VOXEL_SIZE - originY[lane]) * inverseY[lane]
+                              : infinity;
+        }
+
+        // Lanes past their range miss; lanes entering open space jump
+        for (int lane = 0; lane < RAY_LANES; ++lane)
+        {
+            if (!live[lane])
+                continue;
+            if (t[lane] > limit[lane])
+            {
+                finish(lane, false);
+                continue;
+            }
+            int distance = field.cellDistance(x[lane], y[lane]);
+            if (distance > 1)
+                resume(lane, t[lane] + (distance - 1) * blockPixels);
+        }
+    }
+#endif
+}
+
+// Polygon of everything visible from a point within a radius, for fog of war
+// and light cones. Occluders are the edges between solid and empty cells,
+// merged into straight runs. The polygon only bends where a ray grazes the end
+// of an edge, so rays go just to either side of every edge end within the
+// radius (plus a ring of evenly spaced ones for the round outline) and stop at
+// the first solid cell; sorted by angle their ends are the polygon.
+//
+// Edges are cached per chunk and follow the grid's chunk revisions. A chunk
+// owns the edges above its rows and left of its columns, so an edit rebuilds
+// its chunk and the chunks right of and below it, nothing else.
+class VisibilityPolygon
+{
+public:
+    // Between two cell corners (in cells), along a row or a column boundary
+    struct Edge
+    {
+        sf::Vector2i from;
+        sf::Vector2i to;
+
+        bool operator==(const Edge &other) const { return from == other.from && to == other.to; }
+    };
+
+    // Around the eye, ordered by angle; a triangle fan from the eye covers the visible area
+    const std::vector<sf::Vector2f> &getPoints() const { return points; }
+    const std::vector<Edge> &getChunkEdges(int chunk) const { return chunkEdges[chunk]; }
+    std::size_t getRebuiltChunks() const { return rebuiltChunks; }
+    std::size_t getRayCount() const { return rays.size(); }
+
+    // Forces a full rebuild on the next update (the grid was swapped, not edited)
+    void invalidate()
+    {
+        chunkRevisions.clear();
+    }
+
+    // Brings the edge cache up to date with the grid
+    void update(const VoxelGrid &grid)
+    {
+        rebuiltChunks = 0;
+        if (chunkRevisions.size() != static_cast<std::size_t>(grid.getChunkCount()) || chunksX != grid.getChunksX())
+        {
+            chunksX = grid.getChunksX();
+            chunkRevisions.resize(grid.getChunkCount());
+            chunkEdges.assign(grid.getChunkCount(), {});
+            for (int chunk = 0; chunk < grid.getChunkCount(); ++chunk)
+            {
+                chunkRevisions[chunk] = grid.getChunkRevision(chunk);
+                rebuildChunk(grid, chunk);
+            }
+            revision = grid.getRevision();
+            return;
+        }
+        if (grid.getRevision() == revision)
+            return;
+
+        dirty.assign(grid.getChunkCount(), 0);
+        for (int chunk = 0; chunk < grid.getChunkCount(); ++chunk)
+        {
+            if (grid.getChunkRevision(chunk) == chunkRevisions[chunk])
+                continue;
+            chunkRevisions[chunk] = grid.getChunkRevision(chunk);
+            dirty[chunk] = 1;
+            if (chunk % chunksX + 1 < chunksX)
+                dirty[chunk + 1] = 1;
+            if (chunk + chunksX < grid.getChunkCount())
+                dirty[chunk + chunksX] = 1;
+        }
+        for (int chunk = 0; chunk < grid.getChunkCount(); ++chunk)
+        {
+            if (dirty[chunk])
+                rebuildChunk(grid, chunk);
+        }
+        revision = grid.getRevision();
+    }
+
+    // Recomputes the polygon around eye (pixels), bringing the edge cache and field up to date first
+    void compute(const VoxelGrid &grid, DistanceField &field, const sf::Vector2f &eye, float radius)
+    {
+        update(grid);
+        field.update(grid);
+
+        // Just either side of every edge end in reach, plus the ring
+        const float twoPi = 6.2831853f;
+        const float nudge = 1e-4f;
+        angles.clear();
+        for (int i = 0; i < VISIBILITY_RING_RAYS; ++i)
+            angles.push_back(i * twoPi / VISIBILITY_RING_RAYS - twoPi / 2);
+        const int chunkPixels = CHUNK_SIZE * VOXEL_SIZE;
+        int firstX = std::max(static_cast<int>(std::floor((eye.x - radius) / chunkPixels)), 0);
+        int firstY = std::max(static_cast<int>(std::floor((eye.y - radius) / chunkPixels)), 0);
+        int lastX = std::min(static_cast<int>(std::floor((eye.x + radius) / chunkPixels)), grid.getChunksX() - 1);
+        int lastY = std::min(static_cast<int>(std::floor((eye.y + radius) / chunkPixels)), grid.getChunksY() - 1);
+        auto addCorner = [&](const sf::Vector2i &corner) {
+            sf::Vector2f offset(corner.x * VOXEL_SIZE - eye.x, corner.y * VOXEL_SIZE - eye.y);
+            if (offset.x * offset.x + offset.y * offset.y > radius * radius)
+                return;
+            float angle = std::atan2(offset.y, offset.x);
+            angles.push_back(angle - nudge);
+            angles.push_back(angle + nudge);
+        };
+        for (int cy = firstY; cy <= lastY; ++cy)
+        {
+            for (int cx = firstX; cx <= lastX; ++cx)
+            {
+                for (const Edge &edge : chunkEdges[cy * chunksX + cx])
+                {
+                    addCorner(edge.from);
+                    addCorner(edge.to);
+                }
+            }
+        }
+        std::sort(angles.begin(), angles.end());
+        angles.erase(std::unique(angles.begin(), angles.end()), angles.end());
+
+        rays.clear();
+        for (float angle : angles)
+            rays.push_back(Ray{eye, sf::Vector2f(std::cos(angle), std::sin(angle)), radius});
+        hits.resize(rays.size());
+        castRays(grid, field, rays.data(), rays.size(), hits.data());
+
+        points.clear();
+        for (std::size_t i = 0; i < rays.size(); ++i)
+            points.push_back(eye + rays[i].direction * (hits[i].hit ? std::min(hits[i].distance, radius) : radius));
+    }
+
+private:
+    int chunksX = 0;
+    std::vector<std::vector<Edge>> chunkEdges;
+    std::vector<sf::Uint32> chunkRevisions; // Grid chunk revisions the edges reflect
+    sf::Uint32 revision = 0;
+    std::size_t rebuiltChunks = 0;          // By the last update, for stats
+    std::vector<char> dirty;
+    std::vector<float> angles;
+    std::vector<Ray> rays;
+    std::vector<RayHit> hits;
+    std::vector<sf::Vector2f> points;
+
+    // Calls emit(first, end) for every run of set bits in word, bit positions [first, end)
+    template <typename Emit>
+    static void forEachRun(sf::Uint64 word, Emit emit)
+    {
+        while (word)
+        {
+            int first = lowestBit(word);
+            sf::Uint64 rest = ~(word >> first);
+            int length = rest ? lowestBit(rest) : CHUNK_SIZE - first;
+            emit(first, first + length);
+            word &= length == CHUNK_SIZE ? 0 : ~(((sf::Uint64(1) << length) - 1) << first);
+        }
+    }
+
+    // Re-walks a chunk's row and column boundaries against its upper and left neighbors
+    void rebuildChunk(const VoxelGrid &grid, int chunk)
+    {
+        std::vector<Edge> &edges = chunkEdges[chunk];
+        edges.clear();
+        ++rebuiltChunks;
+
+        int originX, originY;
+        grid.chunkOrigin(chunk, originX, originY);
+        const sf::Uint64 *rows = grid.getChunkRows(chunk);
+        const sf::Uint64 *above = originY > 0 ? grid.getChunkRows(chunk - chunksX) : nullptr;
+        const sf::Uint64 *left = originX > 0 ? grid.getChunkRows(chunk - 1) : nullptr;
+
+        // Rows: solid below the boundary and solid above it are separate runs,
+        // so two cells touching at a corner still end their edges there
+        for (int y = 0; y < CHUNK_SIZE; ++y)
+        {
+            sf::Uint64 up = y > 0 ? rows[y - 1] : above ? above[CHUNK_SIZE - 1] : 0;
+            auto emit = [&](int first, int end) {
+                edges.push_back(Edge{sf::Vector2i(originX + first, originY + y), sf::Vector2i(originX + end, originY + y)});
+            };
+            forEachRun(rows[y] & ~up, emit);
+            forEachRun(up & ~rows[y], emit);
+        }
+
+        // Columns: a boundary bit per row, runs followed down the chunk
+        sf::Uint64 openFacing[2] = {0, 0}; // Solid right of / left of the boundary
+        int start[2][CHUNK_SIZE];
+        for (int y = 0; y <= CHUNK_SIZE; ++y)
+        {
+            sf::Uint64 facing[2] = {0, 0};
+            if (y < CHUNK_SIZE)
+            {
+                sf::Uint64 shifted = (rows[y] << 1) | (left ? left[y] >> (CHUNK_SIZE - 1) : 0);
+                facing[0] = rows[y] & ~shifted;
+                facing[1] = shifted & ~rows[y];
+            }
+            for (int side = 0; side < 2; ++side)
+            {
+                for (sf::Uint64 ended = openFacing[side] & ~facing[side]; ended; ended &= ended - 1)
+                {
+                    int x = lowestBit(ended);
+                    edges.push_back(Edge{sf::Vector2i(originX + x, originY + start[side][x]),
+                                         sf::Vector2i(originX + x, originY + y)});
+                }
+                for (sf::Uint64 begun = facing[side] & ~openFacing[side]; begun; begun &= begun - 1)
+                    start[side][lowestBit(begun)] = y;
+                openFacing[side] = facing[side];
+            }
+        }
+    }
+};
+
+enum class Fluid : sf::Uint8
+{
+    None,
+    Water,
+    Lava
+};
+
+struct FluidChunk
+{
+    sf::Uint8 level[CHUNK_SIZE * CHUNK_SIZE]; // Fill of each cell, 255 is full
+    Fluid kind[CHUNK_SIZE * CHUNK_SIZE];
+};
+
+// Water and lava as per-cell fill levels over a voxel grid of the same size.
+// Fluid falls, then levels out sideways; lava only moves every other step
+// and needs a thicker layer to spread. Where water meets lava both vanish
+// and the cell is reported as a reaction (the simulation turns it to stone).
+//
+// Only active chunks are stepped: a chunk stays active while its fluid
+// changes and wakes its four neighbors when it does; wake() activates an
+// area from outside (terrain edits). Chunks are stepped in four passes by
+// the parity of their coordinates, so chunks stepped together are never
+// neighbors and no two threads touch the same cells. Like VoxelGrid, chunks
+// are copy-on-write and all start as one shared empty chunk.
+class FluidLayer
+{
+public:
+    FluidLayer(int width, int height)
+        : width(width), height(height),
+          chunksX((width + CHUNK_SIZE - 1) / CHUNK_SIZE),
+          chunksY((height + CHUNK_SIZE - 1) / CHUNK_SIZE),
+          chunks(static_cast<std::size_t>(chunksX) * chunksY, emptyChunk()),
+          active(chunks.size(), 0), changed(chunks.size(), 0), chunkReactions(chunks.size())
+    {
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    sf::Uint32 getRevision() const { return revision; }
+    int getActiveChunkCount() const { return static_cast<int>(std::count(active.begin(), active.end(), 1)); }
+
+    sf::Uint8 getLevel(int x, int y) const
+    {
+        return contains(x, y) ? chunks[chunkOf(x, y)]->level[cellOf(x, y)] : 0;
+    }
+
+    Fluid getKind(int x, int y) const
+    {
+        return contains(x, y) ? chunks[chunkOf(x, y)]->kind[cellOf(x, y)] : Fluid::None;
+    }
+
+    // Chunks nobody ever poured into can be skipped when drawing
+    bool isChunkEmpty(int chunk) const
+    {
+        return chunks[chunk] == emptyChunk();
+    }
+
+    // Pours fluid into a cell, up to full. A cell holding the other fluid is left alone.
+    void add(int x, int y, Fluid kind, int amount)
+    {
+        if (!contains(x, y) || kind == Fluid::None)
+            return;
+        FluidChunk &chunk = writable(chunkOf(x, y));
+        int cell = cellOf(x, y);
+        if (chunk.kind[cell] != Fluid::None && chunk.kind[cell] != kind)
+            return;
+        chunk.kind[cell] = kind;
+        chunk.level[cell] = static_cast<sf::Uint8>(std::min(255, chunk.level[cell] + amount));
+        wake(x, y, x, y);
+        ++revision;
+    }
+
+    // Activates the chunks touching the inclusive cell range, grown by one cell
+    void wake(int x0, int y0, int x1, int y1)
+    {
+        int cx0 = std::max(x0 - 1, 0) / CHUNK_SIZE, cy0 = std::max(y0 - 1, 0) / CHUNK_SIZE;
+        int cx1 = std::min(x1 + 1, width - 1) / CHUNK_SIZE, cy1 = std::min(y1 + 1, height - 1) / CHUNK_SIZE;
+        for (int cy = cy0; cy <= cy1; ++cy)
+            for (int cx = cx0; cx <= cx1; ++cx)
+                active[cy * chunksX + cx] = 1;
+    }
+
+    // Advances the active chunks one step. Cells where water met lava are
+    // appended to reactions.
+    void step(const VoxelGrid &voxels, unsigned threadCount, std::vector<sf::Vector2i> &reactions)
+    {
+        ++stepCount;
+        // Workers write into their chunk's neighbors; make them all private first
+        for (int chunk = 0; chunk < static_cast<int>(chunks.size()); ++chunk)
+        {
+            if (!active[chunk] || (isChunkEmpty(chunk) && !neighborHasFluid(chunk)))
+            {
+                active[chunk] = 0;
+                continue;
+            }
+            forChunkAndNeighbors(chunk, [this](int neighbor) { writable(neighbor); });
+        }
+
+        std::vector<int> batch;
+        for (int phase = 0; phase < 4; ++phase)
+        {
+            batch.clear();
+            for (int chunk = 0; chunk < static_cast<int>(chunks.size()); ++chunk)
+            {
+                if (active[chunk] && (chunk % chunksX) % 2 == phase % 2 && (chunk / chunksX) % 2 == phase / 2)
+                    batch.push_back(chunk);
+            }
+            // Threads only pay off for a handful of chunks
+            parallelFor(static_cast<int>(batch.size()), batch.size() >= 4 ? threadCount : 1, [&](int i) {
+                changed[batch[i]] = static_cast<char>(stepChunk(batch[i], voxels));
+            });
+        }
+
+        // Chunks that changed stay awake and wake their neighbors; the rest
+        // sleep unless they hold lava that didn't get its turn
+        std::vector<char> next(chunks.size(), 0);
+        bool anyChange = false;
+        for (int chunk = 0; chunk < static_cast<int>(chunks.size()); ++chunk)
+        {
+            if (active[chunk] && changed[chunk] == CHUNK_CHANGED)
+            {
+                forChunkAndNeighbors(chunk, [&next](int neighbor) { next[neighbor] = 1; });
+                anyChange = true;
+            }
+            else if (active[chunk] && changed[chunk] == CHUNK_WAITING)
+            {
+                next[chunk] = 1;
+            }
+            changed[chunk] = 0;
+            reactions.insert(reactions.end(), chunkReactions[chunk].begin(), chunkReactions[chunk].end());
+            chunkReactions[chunk].clear();
+        }
+        active.swap(next);
+        if (anyChange)
+            ++revision;
+    }
+
+private:
+    int width;
+    int height;
+    int chunksX;
+    int chunksY;
+    std::vector<std::shared_ptr<FluidChunk>> chunks;
+    std::vector<char> active;
+    std::vector<char> changed;                               // Per chunk stepChunk result, written by the chunk's worker
+    std::vector<std::vector<sf::Vector2i>> chunkReactions;   // Ditto
+    sf::Uint32 revision = 0;
+    sf::Uint32 stepCount = 0;
+
+    static const int CHUNK_CHANGED = 1;
+    static const int CHUNK_WAITING = 2;
+
+    static const std::shared_ptr<FluidChunk> &emptyChunk()
+    {
+        static const std::shared_ptr<FluidChunk> empty = []() {
+            auto chunk = std::make_shared<FluidChunk>();
+            std::fill(std::begin(chunk->level), std::end(chunk->level), 0);
+            std::fill(std::begin(chunk->kind), std::end(chunk->kind), Fluid::None);
+            return chunk;
+        }();
+        return empty;
+    }
+
+    FluidChunk &writable(int chunk)
+    {
+        std::shared_ptr<FluidChunk> &storage = chunks[chunk];
+        if (storage.use_count() > 1)
+            storage = std::make_shared<FluidChunk>(*storage);
+        return *storage;
+    }
+
+    template <typename Visit>
+    void forChunkAndNeighbors(int chunk, Visit visit) const
+    {
+        int cx = chunk % chunksX, cy = chunk / chunksX;
+        visit(chunk);
+        if (cx > 0)
+            visit(chunk - 1);
+        if (cx + 1 < chunksX)
+            visit(chunk + 1);
+        if (cy > 0)
+            visit(chunk - chunksX);
+        if (cy + 1 < chunksY)
+            visit(chunk + chunksX);
+    }
+
+    bool neighborHasFluid(int chunk) const
+    {
+        bool found = false;
+        forChunkAndNeighbors(chunk, [&](int neighbor) { found = found || !isChunkEmpty(neighbor); });
+        return found;
+    }
+
+    bool contains(int x, int y) const
+    {
+        return x >= 0 && y >= 0 && x < width && y < height;
+    }
+
+    int chunkOf(int x, int y) const
+    {
+        return (y / CHUNK_SIZE) * chunksX + x / CHUNK_SIZE;
+    }
+
+    int cellOf(int x, int y) const
+    {
+        return (y % CHUNK_SIZE) * CHUNK_SIZE + x % CHUNK_SIZE;
+    }
+
+    // Moves as much fluid from one cell into another as fits there, or if
+    // the other cell holds the other fluid, empties both and reports a
+    // reaction. Returns true if anything changed.
+    bool flow(FluidChunk &from, int fromCell, FluidChunk &to, int toCell, const sf::Vector2i &target,
+              std::vector<sf::Vector2i> &reactions)
+    {
+        Fluid kind = from.kind[fromCell];
+        if (to.kind[toCell] != Fluid::None && to.kind[toCell] != kind)
+        {
+            reactions.push_back(target);
+            from.level[fromCell] = to.level[toCell] = 0;
+            from.kind[fromCell] = to.kind[toCell] = Fluid::None;
+            return true;
+        }
+
+        int amount = std::min<int>(from.level[fromCell], 255 - to.level[toCell]);
+        if (amount <= 0)
+            return false;
+        from.level[fromCell] = static_cast<sf::Uint8>(from.level[fromCell] - amount);
+        to.level[toCell] = static_cast<sf::Uint8>(to.level[toCell] + amount);
+        to.kind[toCell] = kind;
+        if (from.level[fromCell] == 0)
+            from.kind[fromCell] = Fluid::None;
+        return true;
+    }
+
+    // True if a chunk row of levels is all zero, eight cells at a time
+    static bool isDry(const sf::Uint8 *levels)
+    {
+        sf::Uint64 any = 0;
+        for (int i = 0; i < CHUNK_SIZE; i += 8)
+        {
+            sf::Uint64 word;
+            std::memcpy(&word, levels + i, sizeof(word));
+            any |= word;
+        }
+        return any == 0;
+    }
+
+    // True if a chunk row is all full of the given fluid
+    static bool isFullOf(const FluidChunk &cells, int row, Fluid kind)
+    {
+        for (int lx = 0; lx < CHUNK_SIZE; ++lx)
+        {
+            if (cells.level[row + lx] != 255 || cells.kind[row + lx] != kind)
+                return false;
+        }
+        return true;
+    }
+
+    static int spreadLevel(Fluid kind)
+    {
+        return kind == Fluid::Lava ? FLUID_SPREAD_LEVEL * 4 : FLUID_SPREAD_LEVEL;
+    }
+
+    // Moves fluid from a run of count cells holding sum in total into the
+    // cell (x, y) next to it, which is either dry or, in the neighboring
+    // chunk, the start of a run going on in direction step. Moves as much as
+    // levels the two runs out. Returns the amount moved.
+    int pourInto(int x, int y, int step, Fluid kind, int sum, int count, const VoxelGrid &voxels)
+    {
+        if (!contains(x, y) || voxels.isSolid(x, y))
+            return 0;
+        FluidChunk &to = *chunks[chunkOf(x, y)];
+        int cell = cellOf(x, y);
+        int level = to.level[cell];
+        if ((to.kind[cell] != Fluid::None && to.kind[cell] != kind) || (level == 0 && sum / count < spreadLevel(kind)))
+            return 0;
+
+        // The neighbor's run, short of that chunk's far column, which
+        // another worker may be writing
+        int otherSum = level, otherCount = 1;
+        for (int lx = x % CHUNK_SIZE + step; level > 0 && lx > 0 && lx < CHUNK_SIZE - 1; lx += step)
+        {
+            int other = cell + lx - x % CHUNK_SIZE;
+            if (to.kind[other] != kind)
+                break;
+            otherSum += to.level[other];
+            ++otherCount;
+        }
+
+        int amount = std::min(255 - level, (sum * otherCount - otherSum * count) / (count + otherCount));
+        if (amount <= 0)
+            return 0;
+        to.level[cell] = static_cast<sf::Uint8>(level + amount);
+        to.kind[cell] = kind;
+        return amount;
+    }
+
+    // flow() towards a neighbor given in chunk-local coordinates. Neighbors
+    // inside the chunk use the chunk's own cells and occupancy words; only
+    // the chunk border goes through the grid.
+    bool flowLocal(FluidChunk &cells, int cell, int chunk, const sf::Uint64 *solidRows, int lx, int ly,
+                   const VoxelGrid &voxels)
+    {
+        int originX = (chunk % chunksX) * CHUNK_SIZE, originY = (chunk / chunksX) * CHUNK_SIZE;
+        sf::Vector2i target(originX + lx, originY + ly);
+        if (lx >= 0 && ly >= 0 && lx < CHUNK_SIZE && ly < CHUNK_SIZE)
+        {
+            if (!contains(target.x, target.y) || (solidRows[ly] >> lx) & 1)
+                return false;
+            return flow(cells, cell, cells, ly * CHUNK_SIZE + lx, target, chunkReactions[chunk]);
+        }
+        if (!contains(target.x, target.y) || voxels.isSolid(target.x, target.y))
+            return false;
+        return flow(cells, cell, *chunks[chunkOf(target.x, target.y)], cellOf(target.x, target.y), target,
+                    chunkReactions[chunk]);
+    }
+
+    // Row by row from the bottom, so falling fluid moves one cell per step.
+    // In each row fluid first falls as far as the cell below takes it; what
+    // is left rests on something, so each run of resting fluid is leveled
+    // out at once and only the ends of a run spread sideways. Leveling by
+    // runs instead of cell pairs lets a pool settle in a few steps.
+    // Returns CHUNK_CHANGED, CHUNK_WAITING or 0.
+    int stepChunk(int chunk, const VoxelGrid &voxels)
+    {
+        FluidChunk &cells = *chunks[chunk];
+        const sf::Uint64 *solidRows = voxels.getChunkRows(chunk);
+        bool lavaMoves = stepCount % 2 == 0;
+        bool anyChange = false;
+        bool waiting = false; // Holds lava that sat this step out
+
+        for (int ly = CHUNK_SIZE - 1; ly >= 0; --ly)
+        {
+            const int row = ly * CHUNK_SIZE;
+            if (isDry(cells.level + row))
+                continue;
+
+            // A row full of one fluid on a full row or on the ground has nothing to drop
+            Fluid rowKind = cells.kind[row];
+            bool resting = ly + 1 < CHUNK_SIZE && isFullOf(cells, row, rowKind) &&
+                           (solidRows[ly + 1] == ~sf::Uint64(0) || isFullOf(cells, row + CHUNK_SIZE, rowKind));
+
+            for (int lx = 0; lx < CHUNK_SIZE && !resting; ++lx)
+            {
+                int cell = row + lx;
+                if (cells.level[cell] == 0)
+                    continue;
+
+                // Terrain was put on top of the fluid
+                if ((solidRows[ly] >> lx) & 1)
+                {
+                    cells.level[cell] = 0;
+                    cells.kind[cell] = Fluid::None;
+                    anyChange = true;
+                    continue;
+                }
+                Fluid kind = cells.kind[cell];
+                if (kind == Fluid::Lava && !lavaMoves)
+                {
+                    waiting = true;
+                    continue;
+                }
+
+                // Most wet cells sit on full ones or on the ground
+                int below = cell + CHUNK_SIZE;
+                if (ly + 1 < CHUNK_SIZE &&
+                    ((solidRows[ly + 1] >> lx) & 1 || (cells.level[below] == 255 && cells.kind[below] == kind)))
+                    continue;
+                anyChange = flowLocal(cells, cell, chunk, solidRows, lx, ly + 1, voxels) || anyChange;
+            }
+
+            for (int first = 0; first < CHUNK_SIZE;)
+            {
+                Fluid kind = cells.kind[row + first];
+                if (kind == Fluid::None || (kind == Fluid::Lava && !lavaMoves))
+                {
+                    ++first;
+                    continue;
+                }
+                int last = first, sum = 0;
+                while (last < CHUNK_SIZE && cells.kind[row + last] == kind)
+                    sum += cells.level[row + last++];
+                int count = last - first;
+
+                // The whole run levels with the cells past its ends, so a pool
+                // spilling over a ledge or into the next chunk drains quickly.
+                // A dry cell it spreads into waits for the next step.
+                bool nextDry = last < CHUNK_SIZE && cells.kind[row + last] == Fluid::None;
+                int originX = (chunk % chunksX) * CHUNK_SIZE, y = (chunk / chunksX) * CHUNK_SIZE + ly;
+                int poured = pourInto(originX + first - 1, y, -1, kind, sum, count, voxels);
+                poured += pourInto(originX + last, y, 1, kind, sum - poured, count, voxels);
+                sum -= poured;
+                anyChange = anyChange || poured > 0;
+
+                for (int lx = first; lx < last && (poured > 0 || !resting); ++lx)
+                {
+                    int level = sum / count + (lx - first < sum % count ? 1 : 0);
+                    anyChange = anyChange || cells.level[row + lx] != level;
+                    cells.level[row + lx] = static_cast<sf::Uint8>(level);
+                }
+
+                // Meeting the other fluid
+                Fluid other = kind == Fluid::Water ? Fluid::Lava : Fluid::Water;
+                if (getKind(originX + first - 1, y) == other)
+                    anyChange = flowLocal(cells, row + first, chunk, solidRows, first - 1, ly, voxels) || anyChange;
+                if (cells.level[row + last - 1] > 0 && getKind(originX + last, y) == other)
+                    anyChange = flowLocal(cells, row + last - 1, chunk, solidRows, last, ly, voxels) || anyChange;
+                first = nextDry ? last + 1 : last;
+            }
+        }
+        return anyChange ? CHUNK_CHANGED : waiting ? CHUNK_WAITING : 0;
+    }
+};
+
+// Temperature of every cell, for fire. Only cells that are warm are ever
+// visited: they are kept in an active list, so a burning forest costs in
+// proportion to its burning front, not to the map. Flammable cells at
+// FIRE_IGNITION or hotter burn: they get hotter by their material's burn
+// rate and heat their flammable neighbors (the one above twice as much,
+// heat rises) until they reach 255 and burn out. Everything else cools
+// down and leaves the list. Water next to a cell puts it out.
+class HeatField
+{
+public:
+    HeatField(int width, int height)
+        : width(width), height(height),
+          temperature(static_cast<std::size_t>(width) * height, 0),
+          listed(static_cast<std::size_t>(width) * height, 0)
+    {
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+
+    sf::Uint8 getTemperature(int x, int y) const
+    {
+        return contains(x, y) ? temperature[y * width + x] : 0;
+    }
+
+    // Warm cells as indices (y * width + x), in the order they are stepped
+    const std::vector<int> &getActiveCells() const { return active; }
+    sf::Uint8 getCellTemperature(int cell) const { return temperature[cell]; }
+
+    // Raises a cell to at least the given temperature
+    void ignite(int x, int y, int heat)
+    {
+        if (contains(x, y))
+            warm(y * width + x, heat, true);
+    }
+
+    // Restores a cell saved from getActiveCells(); cells restored in order keep their step order
+    void restoreCell(int cell, sf::Uint8 heat)
+    {
+        if (cell >= 0 && cell < width * height)
+            warm(cell, heat, true);
+    }
+
+    void clear()
+    {
+        for (int cell : active)
+        {
+            temperature[cell] = 0;
+            listed[cell] = 0;
+        }
+        active.clear();
+    }
+
+    // One step over the warm cells. Cells that burnt out (indices) are
+    // appended to burnt; the caller removes them from the grid.
+    void step(const VoxelGrid &voxels, const FluidLayer &fluid, std::vector<int> &burnt)
+    {
+        // Cells warmed during the step join the list behind this point and wait for the next one
+        const std::size_t count = active.size();
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            int cell = active[i];
+            int x = cell % width, y = cell / width;
+            int heat = temperature[cell];
+            int rate = burnRate(voxels.get(x, y));
+
+            if (heat > 0 && quenched(fluid, x, y))
+            {
+                heat = 0;
+            }
+            else if (rate > 0 && heat >= FIRE_IGNITION)
+            {
+                heat += rate;
+                warmFlammable(voxels, x - 1, y, FIRE_SPREAD_HEAT);
+                warmFlammable(voxels, x + 1, y, FIRE_SPREAD_HEAT);
+                warmFlammable(voxels, x, y + 1, FIRE_SPREAD_HEAT);
+                warmFlammable(voxels, x, y - 1, FIRE_SPREAD_HEAT * 2);
+                if (heat >= 255)
+                {
+                    burnt.push_back(cell);
+                    heat = 0;
+                }
+            }
+            else
+            {
+                heat = std::max(heat - FIRE_COOLING, 0);
+            }
+            temperature[cell] = static_cast<sf::Uint8>(heat);
+        }
+
+        // Cold cells leave the list
+        std::size_t kept = 0;
+        for (int cell : active)
+        {
+            if (temperature[cell] > 0)
+                active[kept++] = cell;
+            else
+                listed[cell] = 0;
+        }
+        active.resize(kept);
+    }
+
+private:
+    int width;
+    int height;
+    std::vector<sf::Uint8> temperature;
+    std::vector<char> listed; // Cell is in active
+    std::vector<int> active;
+
+    bool contains(int x, int y) const
+    {
+        return x >= 0 && y >= 0 && x < width && y < height;
+    }
+
+    // Adds heat to a cell, or with raiseTo, raises it to at least heat
+    void warm(int cell, int heat, bool raiseTo)
+    {
+        int value = raiseTo ? std::max<int>(temperature[cell], heat) : temperature[cell] + heat;
+        temperature[cell] = static_cast<sf::Uint8>(std::min(value, 255));
+        if (temperature[cell] > 0 && !listed[cell])
+        {
+            listed[cell] = 1;
+            active.push_back(cell);
+        }
+    }
+
+    // Cells already burning are left alone; they burn out at their own rate
+    void warmFlammable(const VoxelGrid &voxels, int x, int y, int heat)
+    {
+        if (contains(x, y) && temperature[y * width + x] < FIRE_IGNITION && burnRate(voxels.get(x, y)) > 0)
+            warm(y * width + x, heat, false);
+    }
+
+    static bool quenched(const FluidLayer &fluid, int x, int y)
+    {
+        return fluid.getKind(x, y) == Fluid::Water || fluid.getKind(x - 1, y) == Fluid::Water ||
+               fluid.getKind(x + 1, y) == Fluid::Water || fluid.getKind(x, y - 1) == Fluid::Water ||
+               fluid.getKind(x, y + 1) == Fluid::Water;
+    }
+};
+
+// Wall time and hardware counters (cycles, instructions, cache misses,
+// branch misses) per named phase of the frame, printed as a table per frame.
+// Counters come from Linux perf_event_open, as one group on the calling
+// thread, so work on other threads isn't included; elsewhere, or where the
+// kernel refuses (perf_event_paranoid, containers), only wall time is kept.
+// Phases nest, each including its children, and are told apart by name.
+class PhaseProfiler
+{
+public:
+    static const int COUNTERS = 4;
+
+    struct Sample
+    {
+        sf::Int64 microseconds = 0;
+        sf::Uint64 counters[COUNTERS] = {};
+    };
+
+    PhaseProfiler()
+    {
+#if defined(__linux__)
+        const sf::Uint64 configs[COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                              PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        for (int i = 0; i < COUNTERS; ++i)
+        {
+            perf_event_attr attributes;
+            std::memset(&attributes, 0, sizeof(attributes));
+            attributes.size = sizeof(attributes);
+            attributes.type = PERF_TYPE_HARDWARE;
+            attributes.config = configs[i];
+            attributes.disabled = i == 0; // The group starts with its leader
+            attributes.exclude_kernel = 1;
+            attributes.exclude_hv = 1;
+            attributes.read_format = PERF_FORMAT_GROUP;
+            int fd = static_cast<int>(syscall(__NR_perf_event_open, &attributes, 0, -1, i == 0 ? -1 : descriptors[0], 0));
+            if (fd < 0)
+            {
+                unavailable = std::strerror(errno);
+                closeCounters();
+                return;
+            }
+            descriptors[i] = fd;
+        }
+        ioctl(descriptors[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(descriptors[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+        unavailable = "not on Linux";
+#endif
+    }
+
+    ~PhaseProfiler() { closeCounters(); }
+    PhaseProfiler(const PhaseProfiler &) = delete;
+    PhaseProfiler &operator=(const PhaseProfiler &) = delete;
+
+    bool hasCounters() const { return unavailable.empty(); }
+
+    void sample(Sample &now) const
+    {
+        now.microseconds = clock.getElapsedTime().asMicroseconds();
+#if defined(__linux__)
+        if (hasCounters())
+        {
+            sf::Uint64 values[1 + COUNTERS];
+            if (read(descriptors[0], values, sizeof(values)) == static_cast<ssize_t>(sizeof(values)))
+                std::copy(values + 1, values + 1 + COUNTERS, now.counters);
+        }
+#endif
+    }
+
+    // Enters the named phase and returns its index. Phases are added on
+    // first use, so they print in the order they start, under their parent.
+    std::size_t begin(const char *phase)
+    {
+        ++depth;
+        for (std::size_t i = 0; i < phases.size(); ++i)
+            if (std::strcmp(phases[i].name, phase) == 0)
+                return i;
+        phases.push_back(Phase{phase, depth - 1, 0, {}});
+        return phases.size() - 1;
+    }
+
+    // Leaves the phase, adding what happened between start and now
+    void end(std::size_t phase, const Sample &start)
+    {
+        --depth;
+        Sample now;
+        sample(now);
+        Phase &entry = phases[phase];
+        entry.microseconds += now.microseconds - start.microseconds;
+        for (int i = 0; i < COUNTERS; ++i)
+            entry.counters[i] += now.counters[i] - start.counters[i];
+    }
+
+    // Counts a frame; returns the frames since the last report
+    int endFrame() { return ++frames; }
+
+    // Per-frame averages since the last report, then starts over
+    void report(std::ostream &out)
+    {
+        double perFrame = 1.0 / std::max(frames, 1);
+        out << "profile, per frame over " << frames << " frames"
+            << (hasCounters() ? "" : " (hardware counters unavailable: " + unavailable + ")") << "\n";
+        char line[160];
+        std::snprintf(line, sizeof(line), "  %-24s %9s %9s %6s %12s %12s\n", "phase", "ms", "Mcycles", "IPC",
+                      "cache misses", "branch miss");
+        out << line;
+        for (const Phase &phase : phases)
+        {
+            double cycles = static_cast<double>(phase.counters[0]);
+            std::string name = std::string(2 * phase.depth, ' ') + phase.name;
+            std::snprintf(line, sizeof(line), "  %-24s %9.3f %9.3f %6.2f %12.0f %12.0f\n", name.c_str(),
+                          phase.microseconds * perFrame / 1000.0, cycles * perFrame / 1e6,
+                          cycles > 0 ? phase.counters[1] / cycles : 0.0, phase.counters[2] * perFrame,
+                          phase.counters[3] * perFrame);
+            out << line;
+        }
+        out.flush();
+        phases.clear();
+        frames = 0;
+    }
+
+private:
+    struct Phase
+    {
+        const char *name;
+        int depth;
+        sf::Int64 microseconds;
+        sf::Uint64 counters[COUNTERS];
+    };
+
+    int descriptors[COUNTERS] = {-1, -1, -1, -1};
+    std::string unavailable;
+    sf::Clock clock;
+    std::vector<Phase> phases; // In order of first appearance
+    int depth = 0;             // Phases currently open
+    int frames = 0;
+
+    void closeCounters()
+    {
+#if defined(__linux__)
+        for (int &fd : descriptors)
+        {
+            if (fd >= 0)
+                close(fd);
+            fd = -1;
+        }
+#endif
+    }
+};
+
+// Times the rest of the enclosing block as a phase; does nothing without a profiler
+class ProfileScope
+{
+public:
+    ProfileScope(PhaseProfiler *profiler, const char *phase) : profiler(profiler)
+    {
+        if (!profiler)
+            return;
+        this->phase = profiler->begin(phase);
+        profiler->sample(start);
+    }
+
+    ~ProfileScope()
+    {
+        if (profiler)
+            profiler->end(phase, start);
+    }
+
+private:
+    PhaseProfiler *profiler;
+    std::size_t phase = 0;
+    PhaseProfiler::Sample start;
+};
+
+// Full copy of a Simulation's state. Entities, timers and the RNG are packed
+// into one flat buffer; the voxel grid is a copy-on-write copy, so taking a
+// snapshot of a large world costs one pointer per chunk and only chunks edited
+// afterwards are ever duplicated. Reusing a snapshot object reuses its buffer.
+struct SimulationSnapshot
+{
+    std::vector<sf::Uint8> data;
+    VoxelGrid voxels{0, 0};
+    FluidLayer fluid{0, 0};
+};
+
+// Authoritative game state. Runs headless on the server and in local play;
+// networked clients keep a mirror of it that is overwritten by server snapshots.
+class Simulation
+{
+public:
+    std::vector<Player> players;
+    std::vector<Bullet> bullets;
+    VoxelGrid voxels;
+    FluidLayer fluid;                           // Water and lava over the same cells as voxels
+    HeatField heat;                             // Fire
+    DistanceField distanceField;                // Coarse distance to terrain, for ray casts and early-outs
+    std::vector<Particle> particles;
+    std::vector<VoxelBody> bodies;              // Falling debris, written back into voxels when it lands
+    std::vector<sf::Vector2f> explosionEvents; // Explosions since the last drain, replicated to clients
+    float screenShakeTime = 0.0f;
+    sf::Vector2f screenShakeOffset;
+    std::mt19937 rng{SIMULATION_SEED};
+    bool effectsEnabled = true;                 // Dedicated servers skip purely visual particles
+    EditJournal *journal = nullptr;             // Records voxel edits for undo when set
+    PhaseProfiler *profiler = nullptr;          // Times the steps of update() when set
+
+    Simulation(int gridWidth = GRID_WIDTH, int gridHeight = GRID_HEIGHT)
+        : voxels(gridWidth, gridHeight), fluid(gridWidth, gridHeight), heat(gridWidth, gridHeight)
+    {
+    }
+
+    // Uniform integer in [0, range)
+    int random(int range)
+    {
+        return static_cast<int>(rng() % static_cast<unsigned>(range));
+    }
+
+    void saveSnapshot(SimulationSnapshot &snapshot) const
+    {
+        Header header;
+        header.playerCount = static_cast<sf::Uint32>(players.size());
+        header.bulletCount = static_cast<sf::Uint32>(bullets.size());
+        header.particleCount = static_cast<sf::Uint32>(particles.size());
+        header.bodyCount = static_cast<sf::Uint32>(bodies.size());
+        header.heatCount = static_cast<sf::Uint32>(heat.getActiveCells().size());
+        header.explosionCount = static_cast<sf::Uint32>(explosionEvents.size());
+        header.screenShakeTime = screenShakeTime;
+        header.screenShakeOffset = screenShakeOffset;
+        header.fluidTime = fluidTime;
+        header.heatTime = heatTime;
+        header.rng = rng;
+
+        std::size_t bodyCells = 0;
+        for (const auto &body : bodies)
+            bodyCells += body.cells.size();
+
+        snapshot.data.resize(sizeof(Header) +
+                             players.size() * sizeof(PlayerRecord) +
+                             bullets.size() * sizeof(BulletRecord) +
+                             particles.size() * sizeof(ParticleRecord) +
+                             bodies.size() * sizeof(BodyRecord) + bodyCells * sizeof(VoxelBody::Cell) +
+                             heat.getActiveCells().size() * sizeof(HeatRecord) +
+                             explosionEvents.size() * sizeof(sf::Vector2f));
+        sf::Uint8 *out = snapshot.data.data();
+        write(out, header);
+
+        for (const auto &player : players)
+        {
+            PlayerRecord record = {player.shape.getPosition(), player.velocity, player.shape.getFillColor(),
+                                   player.input, player.lastFireCount, player.id, player.isJumping};
+            write(out, record);
+        }
+        for (const auto &bullet : bullets)
+        {
+            write(out, BulletRecord{bullet.shape.getPosition(), bullet.velocity});
+        }
+        for (const auto &particle : particles)
+        {
+            write(out, ParticleRecord{particle.shape.getPosition(), particle.velocity,
+                                      particle.shape.getFillColor(), particle.lifetime});
+        }
+        for (const auto &body : bodies)
+        {
+            write(out, BodyRecord{body.position, body.velocity, body.restPosition, body.angle, body.angularVelocity,
+                                  body.restAngle, body.restTime, static_cast<sf::Uint32>(body.cells.size())});
+            for (const auto &cell : body.cells)
+                write(out, cell);
+        }
+        for (int cell : heat.getActiveCells())
+        {
+            write(out, HeatRecord{static_cast<sf::Uint32>(cell), heat.getCellTemperature(cell)});
+        }
+        for (const auto &position : explosionEvents)
+        {
+            write(out, position);
+        }
+
+        snapshot.voxels = voxels;
+        snapshot.fluid = fluid;
+    }
+
+    // Existing entity objects are reused so restoring doesn't rebuild shapes
+    void restoreSnapshot(const SimulationSnapshot &snapshot)
+    {
+        const sf::Uint8 *in = snapshot.data.data();
+        Header header;
+        read(in, header);
+
+        screenShakeTime = header.screenShakeTime;
+        screenShakeOffset = header.screenShakeOffset;
+        fluidTime = header.fluidTime;
+        heatTime = header.heatTime;
+        rng = header.rng;
+        distanceField.invalidate(); // The restored grid's revisions say nothing about the field's
+
+        players.resize(header.playerCount);
+        for (auto &player : players)
+        {
+            PlayerRecord record;
+            read(in, record);
+            player.shape.setPosition(record.position);
+            player.shape.setFillColor(record.color);
+            player.velocity = record.velocity;
+            player.input = record.input;
+            player.lastFireCount = record.lastFireCount;
+            player.id = record.id;
+            player.isJumping = record.isJumping;
+        }
+
+        bullets.erase(bullets.begin() + std::min<std::size_t>(bullets.size(), header.bulletCount), bullets.end());
+        while (bullets.size() < header.bulletCount)
+            bullets.emplace_back(sf::Vector2f(), sf::Vector2f());
+        for (auto &bullet : bullets)
+        {
+            BulletRecord record;
+            read(in, record);
+            bullet.shape.setPosition(record.position);
+            bullet.velocity = record.velocity;
+        }
+
+        particles.erase(particles.begin() + std::min<std::size_t>(particles.size(), header.particleCount), particles.end());
+        while (particles.size() < header.particleCount)
+            particles.emplace_back(sf::Vector2f(), sf::Vector2f(), sf::Color::White);
+        for (auto &particle : particles)
+        {
+            ParticleRecord record;
+            read(in, record);
+            particle.shape.setPosition(record.position);
+            particle.shape.setFillColor(record.color);
+            particle.velocity = record.velocity;
+            particle.lifetime = record.lifetime;
+        }
+
+        bodies.resize(header.bodyCount);
+        for (auto &body : bodies)
+        {
+            BodyRecord record;
+            read(in, record);
+            body.position = record.position;
+            body.velocity = record.velocity;
+            body.restPosition = record.restPosition;
+            body.angle = record.angle;
+            body.angularVelocity = record.angularVelocity;
+            body.restAngle = record.restAngle;
+            body.restTime = record.restTime;
+            body.cells.resize(record.cellCount);
+            for (auto &cell : body.cells)
+                read(in, cell);
+            body.updateShape();
+        }
+
+        // Heat is indexed by cell, so it must match the restored grid's size
+        if (heat.getWidth() != snapshot.voxels.getWidth() || heat.getHeight() != snapshot.voxels.getHeight())
+            heat = HeatField(snapshot.voxels.getWidth(), snapshot.voxels.getHeight());
+        heat.clear();
+        for (sf::Uint32 i = 0; i < header.heatCount; ++i)
+        {
+            HeatRecord record;
+            read(in, record);
+            heat.restoreCell(static_cast<int>(record.cell), record.temperature);
+        }
+
+        explosionEvents.resize(header.explosionCount);
+        for (auto &position : explosionEvents)
+        {
+            read(in, position);
+        }
+
+        voxels = snapshot.voxels;
+        fluid = snapshot.fluid;
+    }
+
+    Player &addPlayer(sf::Uint8 id)
+    {
+        players.emplace_back(id);
+        return players.back();
+    }
+
+    void removePlayer(sf::Uint8 id)
+    {
+        for (auto it = players.begin(); it != players.end(); ++it)
+        {
+            if (it->id == id)
+            {
+                players.erase(it);
+                return;
+            }
+        }
+    }
+
+    Player *findPlayer(sf::Uint8 id)
+    {
+        for (auto &player : players)
+        {
+            if (player.id == id)
+                return &player;
+        }
+        return nullptr;
+    }
+
+    void update(float deltaTime)
+    {
+        ProfileScope scope(profiler, "simulation");
+        updatePlayersAndBullets(deltaTime);
+        {
+            ProfileScope bodiesScope(profiler, "bodies");
+            updateBodies(deltaTime);
+        }
+        {
+            ProfileScope fluidScope(profiler, "fluid");
+            updateFluid(deltaTime);
+        }
+        {
+            ProfileScope heatScope(profiler, "heat");
+            updateHeat(deltaTime);
+        }
+        ProfileScope effectsScope(profiler, "effects");
+        updateEffects(deltaTime);
+    }
+
+    void updatePlayersAndBullets(float deltaTime)
+    {
+        ProfileScope scope(profiler, "players and bullets");
+        for (auto &player : players)
+        {
+            updatePlayer(player, deltaTime);
+        }
+        // Move the bullets and cast their paths since the last frame in one
+        // batch, so fast bullets can't skip thin walls
+        bulletRays.clear();
+        for (auto &bullet : bullets)
+        {
+            bulletRays.push_back(Ray{bullet.shape.getPosition(), normalize(bullet.velocity),
+                                     vectorLength(bullet.velocity * deltaTime)});
+            bullet.shape.move(bullet.velocity * deltaTime);
+        }
+        raycast(bulletRays, bulletHits);
+
+        // Update bullets
+        std::size_t bulletIndex = 0;
+        for (auto it = bullets.begin(); it != bullets.end(); ++bulletIndex)
+        {
+
+            // Create bullet trail particles
+            if (effectsEnabled && random(2) == 0)
+            {
+                addParticle(
+                    it->shape.getPosition(),
+                    sf::Vector2f(0, 0),
+                    sf::Color(255, 255, 0, 128));
+            }
+
+            // Check bullet collision with voxels: the path cast above, then
+            // the box, which is only needed close to terrain
+            bool bulletHit = false;
+            const Ray &path = bulletRays[bulletIndex];
+            if (bulletHits[bulletIndex].hit)
+            {
+                bulletHit = true;
+                it->shape.setPosition(path.origin + path.direction * bulletHits[bulletIndex].distance);
+            }
+            else if (distanceField.clearance(it->shape.getPosition()) < vectorLength(it->shape.getSize()))
+            {
+                bulletHit = checkVoxelCollision(it->shape.getGlobalBounds());
+            }
+            if (bulletHit)
+            {
+                createExplosion(it->shape.getPosition());
+            }
+
+            // Remove bullets that are out of bounds or hit voxels
+            if (bulletHit ||
+                it->shape.getPosition().x < 0 ||
+                it->shape.getPosition().x > voxels.getWidth() * VOXEL_SIZE ||
+                it->shape.getPosition().y < 0 ||
+                it->shape.getPosition().y > voxels.getHeight() * VOXEL_SIZE)
+            {
+                it = bullets.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    // Steps the fire at FIRE_TICK_RATE. Burnt-out cells are removed, and
+    // whatever a burnt trunk held up falls.
+    void updateHeat(float deltaTime)
+    {
+        if (heat.getWidth() != voxels.getWidth() || heat.getHeight() != voxels.getHeight())
+            heat = HeatField(voxels.getWidth(), voxels.getHeight());
+
+        const float stepTime = 1.f / FIRE_TICK_RATE;
+        heatTime = std::min(heatTime + deltaTime, stepTime * 4);
+        while (heatTime >= stepTime)
+        {
+            burntCells.clear();
+            heat.step(voxels, fluid, burntCells);
+            for (int cell : burntCells)
+            {
+                int x = cell % voxels.getWidth(), y = cell / voxels.getWidth();
+                bool trunk = voxels.get(x, y) == Material::Wood;
+                setVoxel(x, y, Material::Empty);
+                if (trunk)
+                    detachIslands(x, y, x, y);
+                fluid.wake(x, y, x, y);
+            }
+            heatTime -= stepTime;
+        }
+
+        // Flames and sparks over the burning front
+        if (!effectsEnabled)
+            return;
+        for (int cell : heat.getActiveCells())
+        {
+            if (heat.getCellTemperature(cell) < FIRE_IGNITION || random(64) != 0)
+                continue;
+            sf::Vector2f position((cell % voxels.getWidth() + 0.5f) * VOXEL_SIZE, (cell / voxels.getWidth()) * VOXEL_SIZE);
+            addParticle(position, sf::Vector2f(static_cast<float>(random(41) - 20), -60.f - random(60)),
+                        sf::Color(255, 120 + random(100), 0));
+        }
+    }
+
+    // Steps the fluid at FLUID_TICK_RATE. Where water met lava the cell turns to stone.
+    void updateFluid(float deltaTime)
+    {
+        // The grid was replaced by one of another size (import, load)
+        if (fluid.getWidth() != voxels.getWidth() || fluid.getHeight() != voxels.getHeight())
+            fluid = FluidLayer(voxels.getWidth(), voxels.getHeight());
+
+        const float stepTime = 1.f / FLUID_TICK_RATE;
+        fluidTime = std::min(fluidTime + deltaTime, stepTime * 4);
+        while (fluidTime >= stepTime)
+        {
+            fluidReactions.clear();
+            fluid.step(voxels, workerThreads(), fluidReactions);
+            for (const auto &cell : fluidReactions)
+                setVoxel(cell.x, cell.y, Material::Stone);
+            fluidTime -= stepTime;
+        }
+    }
+
+    // Fills the empty cells around a world position with fluid
+    void pourFluid(const sf::Vector2f &position, Fluid kind)
+    {
+        int centerX = static_cast<int>(std::floor(position.x / VOXEL_SIZE));
+        int centerY = static_cast<int>(std::floor(position.y / VOXEL_SIZE));
+        for (int y = centerY - FLUID_POUR_RADIUS; y <= centerY + FLUID_POUR_RADIUS; ++y)
+        {
+            for (int x = centerX - FLUID_POUR_RADIUS; x <= centerX + FLUID_POUR_RADIUS; ++x)
+            {
+                if (voxels.get(x, y) == Material::Empty)
+                    fluid.add(x, y, kind, 255);
+            }
+        }
+    }
+
+    // Editor tools. Each is one undo step.
+
+    // Fills empty cells within radius of the terrain with material
+    void growVoxels(int radius, Material material)
+    {
+        VoxelMask solid = VoxelMask::solidCells(voxels);
+        VoxelMask grown = dilate(solid, radius, workerThreads());
+        grown.forEach([&](int x, int y) {
+            if (!solid.get(x, y))
+                setVoxel(x, y, material);
+        });
+        if (journal)
+            journal->commit();
+    }
+
+    // Removes solid cells within radius of empty space
+    void shrinkVoxels(int radius)
+    {
+        VoxelMask solid = VoxelMask::solidCells(voxels);
+        VoxelMask kept = erode(solid, radius, workerThreads());
+        solid.forEach([&](int x, int y) {
+            if (!kept.get(x, y))
+                setVoxel(x, y, Material::Empty);
+        });
+        if (journal)
+            journal->commit();
+    }
+
+    // Removes the connected piece of terrain containing the cell
+    void removeConnected(int x, int y)
+    {
+        floodFill(VoxelMask::solidCells(voxels), x, y).forEach([&](int cellX, int cellY) {
+            setVoxel(cellX, cellY, Material::Empty);
+        });
+        if (journal)
+            journal->commit();
+    }
+
+    // Screen shake and particles only; this is all a networked client simulates itself
+    void updateEffects(float deltaTime)
+    {
+        updateScreenShake(deltaTime);
+        distanceField.update(voxels);
+
+        // Update particles
+        for (auto it = particles.begin(); it != particles.end();)
+        {
+            sf::Vector2f before = it->shape.getPosition();
+            if (!it->update(deltaTime))
+            {
+                it = particles.erase(it);
+                continue;
+            }
+
+            // Particles flying into terrain stop at it; only those next to terrain need the cell test
+            sf::Vector2f after = it->shape.getPosition();
+            if (distanceField.clearance(after) == 0.f && solidAt(after) && !solidAt(before))
+            {
+                it->shape.setPosition(before);
+                it->velocity = sf::Vector2f(0, 0);
+            }
+            ++it;
+        }
+    }
+
+    // Ray casts against the world, skipping open space through the distance field
+    RayHit raycast(const sf::Vector2f &origin, const sf::Vector2f &direction, float maxDistance)
+    {
+        distanceField.update(voxels);
+        Ray ray{origin, direction, maxDistance};
+        RayHit hit;
+        castRays(voxels, distanceField, &ray, 1, &hit);
+        return hit;
+    }
+
+    // Many rays at once (see castRays); much faster than one raycast each
+    void raycast(const std::vector<Ray> &rays, std::vector<RayHit> &hits)
+    {
+        distanceField.update(voxels);
+        hits.resize(rays.size());
+        castRays(voxels, distanceField, rays.data(), rays.size(), hits.data());
+    }
+
+    // True if nothing solid lies between the points
+    bool hasLineOfSight(const sf::Vector2f &from, const sf::Vector2f &to)
+    {
+        float length = vectorLength(to - from);
+        return length == 0.f || !raycast(from, (to - from) / length, length).hit;
+    }
+
+    // Movement and collision only. Deterministic for a given input and voxel
+    // grid, and free of allocations, so clients can cheaply re-run it when
+    // reconciling their predicted player with server snapshots.
+    void movePlayer(Player &player, const PlayerInput &input, float deltaTime)
+    {
+        // Player movement
+        player.velocity.x = input.moveX * PLAYER_SPEED;
+
+        if (input.jump && !player.isJumping)
+        {
+            player.velocity.y = JUMP_VELOCITY;
+            player.isJumping = true;
+        }
+
+        // Apply gravity
+        player.velocity.y += GRAVITY * deltaTime;
+
+        // Update player position
+        sf::Vector2f newPos = player.shape.getPosition();
+        newPos += player.velocity * deltaTime;
+
+        handleCollisions(player, newPos);
+
+        // World bounds checking
+        float worldWidth = static_cast<float>(voxels.getWidth() * VOXEL_SIZE);
+        float worldHeight = static_cast<float>(voxels.getHeight() * VOXEL_SIZE);
+        if (newPos.x < 0)
+            newPos.x = 0;
+        if (newPos.x > worldWidth - player.shape.getSize().x)
+            newPos.x = worldWidth - player.shape.getSize().x;
+        if (newPos.y > worldHeight - player.shape.getSize().y)
+        {
+            newPos.y = worldHeight - player.shape.getSize().y;
+            player.velocity.y = 0;
+            player.isJumping = false;
+        }
+
+        player.shape.setPosition(newPos);
+    }
+
+    // Dropped while settings.maxParticles are alive
+    void addParticle(const sf::Vector2f &position, const sf::Vector2f &velocity, const sf::Color &color)
+    {
+        if (particles.size() < static_cast<std::size_t>(settings.maxParticles))
+            particles.emplace_back(position, velocity, color);
+    }
+
+    void spawnExplosionEffects(const sf::Vector2f &position)
+    {
+        // Screen shake
+        screenShakeTime = SCREEN_SHAKE_DURATION;
+
+        if (!effectsEnabled)
+            return;
+
+        // Create explosion particles
+        for (int i = 0; i < 20; ++i)
+        {
+            float angle = random(360) * 3.14159f / 180.f;
+            float speed = 100.f + random(100);
+            sf::Vector2f velocity(cos(angle) * speed, sin(angle) * speed);
+            addParticle(position, velocity, sf::Color(255, 200, 0));
+        }
+    }
+
+private:
+    // Scratch space of detachIslands: per-cell search marks and the search queue
+    std::vector<sf::Uint32> searchMarks;
+    sf::Uint32 searchStamp = 0;
+    std::vector<int> searchQueue;
+    std::vector<int> bodyOrder; // Scratch of resolveBodyContacts
+    float fluidTime = 0.f;      // Time not yet covered by fluid steps
+    std::vector<sf::Vector2i> fluidReactions;
+    float heatTime = 0.f;       // Same for fire steps
+    std::vector<int> burntCells;
+    std::vector<Ray> bulletRays; // Scratch of update
+    std::vector<RayHit> bulletHits;
+
+    // Penetrating outline points of one body, merged into a single contact
+    struct ContactSum
+    {
+        sf::Vector2f armSum;
+        sf::Vector2f normalSum;
+        sf::Vector2f correction; // Push-out of the deepest point
+        float deepest = -1.f;
+        int count = 0;
+
+        void add(const sf::Vector2f &arm, const sf::Vector2f &normal, float depth)
+        {
+            armSum += arm;
+            normalSum += normal;
+            ++count;
+            if (depth > deepest)
+            {
+                deepest = depth;
+                correction = normal * depth;
+            }
+        }
+
+        sf::Vector2f arm() const { return armSum / static_cast<float>(count); }
+        sf::Vector2f normal() const { return normalize(normalSum); }
+    };
+
+    // Flat snapshot layout: Header, then one record per entity
+    struct Header
+    {
+        sf::Uint32 playerCount;
+        sf::Uint32 bulletCount;
+        sf::Uint32 particleCount;
+        sf::Uint32 bodyCount;
+        sf::Uint32 heatCount;
+        sf::Uint32 explosionCount;
+        float screenShakeTime;
+        sf::Vector2f screenShakeOffset;
+        float fluidTime;
+        float heatTime;
+        std::mt19937 rng;
+    };
+
+    struct PlayerRecord
+    {
+        sf::Vector2f position;
+        sf::Vector2f velocity;
+        sf::Color color;
+        PlayerInput input;
+        sf::Uint16 lastFireCount;
+        sf::Uint8 id;
+        bool isJumping;
+    };
+
+    struct BulletRecord
+    {
+        sf::Vector2f position;
+        sf::Vector2f velocity;
+    };
+
+    struct BodyRecord
+    {
+        sf::Vector2f position;
+        sf::Vector2f velocity;
+        sf::Vector2f restPosition;
+        float angle;
+        float angularVelocity;
+        float restAngle;
+        float restTime;
+        sf::Uint32 cellCount; // Followed by this many VoxelBody::Cell
+    };
+
+    struct HeatRecord
+    {
+        sf::Uint32 cell;
+        sf::Uint8 temperature;
+    };
+
+    struct ParticleRecord
+    {
+        sf::Vector2f position;
+        sf::Vector2f velocity;
+        sf::Color color;
+        float lifetime;
+    };
+
+    static_assert(std::is_trivially_copyable<Header>::value, "snapshot records are copied bytewise");
+    static_assert(std::is_trivially_copyable<PlayerRecord>::value, "snapshot records are copied bytewise");
+
+    template <typename T>
+    static void write(sf::Uint8 *&out, const T &value)
+    {
+        std::memcpy(out, &value, sizeof(T));
+        out += sizeof(T);
+    }
+
+    template <typename T>
+    static void read(const sf::Uint8 *&in, T &value)
+    {
+        std::memcpy(&value, in, sizeof(T));
+        in += sizeof(T);
+    }
+
+    bool solidAt(const sf::Vector2f &point) const
+    {
+        return voxels.isSolid(static_cast<int>(std::floor(point.x / VOXEL_SIZE)),
+                              static_cast<int>(std::floor(point.y / VOXEL_SIZE)));
+    }
+
+    bool checkVoxelCollision(const sf::FloatRect &bounds)
+    {
+        // Cells whose square overlaps the bounds; touching edges don't count
+        int x0 = static_cast<int>(std::floor(bounds.left / VOXEL_SIZE));
+        int y0 = static_cast<int>(std::floor(bounds.top / VOXEL_SIZE));
+        int x1 = static_cast<int>(std::ceil((bounds.left + bounds.width) / VOXEL_SIZE)) - 1;
+        int y1 = static_cast<int>(std::ceil((bounds.top + bounds.height) / VOXEL_SIZE)) - 1;
+        return voxels.anySolid(x0, y0, x1, y1);
+    }
+
+    bool canStepUp(const Player &player, const sf::Vector2f &pos)
+    {
+        sf::FloatRect playerBounds = player.shape.getGlobalBounds();
+
+        // Check if there's a block in front of us
+        playerBounds.left = pos.x;
+        playerBounds.top = pos.y;
+        if (!checkVoxelCollision(playerBounds))
+        {
+            return false; // No need to step if no collision
+        }
+
+        // Try stepping up
+        playerBounds.top = pos.y - STEP_HEIGHT;
+        return !checkVoxelCollision(playerBounds);
+    }
+
+    void spawnVoxelsInRadius(float centerX, float centerY)
+    {
+        for (float x = -DRAW_RADIUS; x <= DRAW_RADIUS; x += VOXEL_SIZE)
+        {
+            for (float y = -DRAW_RADIUS; y <= DRAW_RADIUS; y += VOXEL_SIZE)
+            {
+                float distance = std::sqrt(x * x + y * y);
+                if (distance <= DRAW_RADIUS)
+                {
+                    int cellX = static_cast<int>(round((centerX + x) / VOXEL_SIZE));
+                    int cellY = static_cast<int>(round((centerY + y) / VOXEL_SIZE));
+
+                    // Existing voxels are left alone
+                    if (!voxels.isSolid(cellX, cellY))
+                    {
+                        setVoxel(cellX, cellY, Material::Stone);
+                    }
+                }
+            }
+        }
+    }
+
+    void handleCollisions(Player &player, sf::Vector2f &newPos)
+    {
+        sf::FloatRect playerBounds = player.shape.getGlobalBounds();
+        sf::Vector2f oldPos = player.shape.getPosition();
+
+        // First, try horizontal movement
+        playerBounds.left = newPos.x;
+        playerBounds.top = oldPos.y;
+        if (checkVoxelCollision(playerBounds))
+        {
+            // Try stepping up before blocking horizontal movement
+            if (canStepUp(player, sf::Vector2f(newPos.x, oldPos.y)))
+            {
+                // Move up by step height
+                newPos.y = oldPos.y - STEP_HEIGHT;
+            }
+            else
+            {
+                // Can't step up, block horizontal movement
+                newPos.x = oldPos.x;
+                player.velocity.x = 0;
+            }
+        }
+
+        // Then, try vertical movement
+        playerBounds.left = newPos.x;
+        playerBounds.top = newPos.y;
+        if (checkVoxelCollision(playerBounds))
+        {
+            if (player.velocity.y > 0)
+            {
+                newPos.y = oldPos.y;
+                player.velocity.y = 0;
+                player.isJumping = false;
+            }
+            else if (player.velocity.y < 0)
+            {
+                newPos.y = oldPos.y;
+                player.velocity.y = 0;
+            }
+        }
+
+        // Apply gravity after stepping
+        if (!checkVoxelCollision(playerBounds))
+        {
+            sf::FloatRect groundCheck = playerBounds;
+            groundCheck.top += 1.0f;
+            if (!checkVoxelCollision(groundCheck))
+            {
+                player.isJumping = true;
+            }
+        }
+    }
+
+    // All gameplay edits to the grid go through here so they can be journaled
+    void setVoxel(int x, int y, Material material)
+    {
+        Material before = voxels.get(x, y);
+        if (voxels.set(x, y, material) && journal)
+        {
+            journal->record(x, y, before, material);
+        }
+    }
+
+    void createExplosion(const sf::Vector2f &position)
+    {
+        // An explosion is its own undo step, even in the middle of a brush stroke
+        if (journal)
+            journal->commit();
+
+        explosionEvents.push_back(position);
+        spawnExplosionEffects(position);
+
+        // Destroy nearby voxels
+        int x0 = static_cast<int>(std::floor((position.x - EXPLOSION_RADIUS) / VOXEL_SIZE));
+        int y0 = static_cast<int>(std::floor((position.y - EXPLOSION_RADIUS) / VOXEL_SIZE));
+        int x1 = static_cast<int>(std::ceil((position.x + EXPLOSION_RADIUS) / VOXEL_SIZE));
+        int y1 = static_cast<int>(std::ceil((position.y + EXPLOSION_RADIUS) / VOXEL_SIZE));
+
+        for (int cellY = y0; cellY <= y1; ++cellY)
+        {
+            for (int cellX = x0; cellX <= x1; ++cellX)
+            {
+                Material material = voxels.get(cellX, cellY);
+                if (material == Material::Empty)
+                    continue;
+
+                sf::Vector2f voxelPos(cellX * VOXEL_SIZE, cellY * VOXEL_SIZE);
+                float dx = voxelPos.x - position.x;
+                float dy = voxelPos.y - position.y;
+                float distance = sqrt(dx * dx + dy * dy);
+
+                if (distance < EXPLOSION_RADIUS)
+                {
+                    // Create debris particles
+                    for (int i = 0; effectsEnabled && i < 3; ++i)
+                    {
+                        float angle = random(360) * 3.14159f / 180.f;
+                        float speed = 50.f + random(50);
+                        sf::Vector2f velocity(cos(angle) * speed, sin(angle) * speed);
+                        addParticle(voxelPos, velocity, materialColor(material));
+                    }
+                    setVoxel(cellX, cellY, Material::Empty);
+                }
+            }
+        }
+        detachIslands(x0, y0, x1, y1);
+
+        // Fluid held back by the carved terrain starts flowing again
+        fluid.wake(x0, y0, x1, y1);
+
+        // Flammable cells just past the blast catch fire
+        const float igniteRadius = EXPLOSION_RADIUS + 2 * VOXEL_SIZE;
+        for (int cellY = y0 - 2; cellY <= y1 + 2; ++cellY)
+        {
+            for (int cellX = x0 - 2; cellX <= x1 + 2; ++cellX)
+            {
+                float dx = cellX * VOXEL_SIZE - position.x;
+                float dy = cellY * VOXEL_SIZE - position.y;
+                if (burnRate(voxels.get(cellX, cellY)) > 0 && dx * dx + dy * dy < igniteRadius * igniteRadius)
+                    heat.ignite(cellX, cellY, FIRE_IGNITION);
+            }
+        }
+
+        if (journal)
+            journal->commit();
+    }
+
+    // Finds terrain the last blast cut loose and turns it into falling bodies.
+    // A search runs from every solid cell around the blast box over the cells
+    // connected to it; it stops as anchored when it reaches the bottom row of
+    // the world, a cell an earlier anchored search reached, or
+    // ISLAND_SEARCH_LIMIT cells. Whatever is left is an island. The work is
+    // bounded by the blast area and the limit, never by the world size.
+    void detachIslands(int x0, int y0, int x1, int y1)
+    {
+        const int width = voxels.getWidth();
+        const int height = voxels.getHeight();
+        if (searchMarks.size() != static_cast<std::size_t>(width) * height || searchStamp > 0xF0000000u)
+        {
+            searchMarks.assign(static_cast<std::size_t>(width) * height, 0);
+            searchStamp = 0;
+        }
+        const sf::Uint32 firstStamp = searchStamp + 1;
+
+        for (int seedY = std::max(y0 - 1, 0); seedY <= std::min(y1 + 1, height - 1); ++seedY)
+        {
+            for (int seedX = std::max(x0 - 1, 0); seedX <= std::min(x1 + 1, width - 1); ++seedX)
+            {
+                int seed = seedY * width + seedX;
+                if (!voxels.isSolid(seedX, seedY) || searchMarks[seed] >= firstStamp)
+                    continue;
+
+                const sf::Uint32 stamp = ++searchStamp;
+                searchMarks[seed] = stamp;
+                searchQueue.assign(1, seed);
+                bool anchored = false;
+                for (std::size_t head = 0; head < searchQueue.size() && !anchored; ++head)
+                {
+                    int x = searchQueue[head] % width;
+                    int y = searchQueue[head] / width;
+                    if (y == height - 1 || searchQueue.size() >= static_cast<std::size_t>(ISLAND_SEARCH_LIMIT))
+                    {
+                        anchored = true;
+                        break;
+                    }
+
+                    const int neighbors[4][2] = {{x + 1, y}, {x - 1, y}, {x, y + 1}, {x, y - 1}};
+                    for (const auto &neighbor : neighbors)
+                    {
+                        if (!voxels.isSolid(neighbor[0], neighbor[1]))
+                            continue;
+                        int cell = neighbor[1] * width + neighbor[0];
+                        if (searchMarks[cell] == stamp)
+                            continue;
+                        if (searchMarks[cell] >= firstStamp)
+                        {
+                            anchored = true;
+                            break;
+                        }
+                        searchMarks[cell] = stamp;
+                        searchQueue.push_back(cell);
+                    }
+                }
+
+                if (!anchored)
+                    detachBody(searchQueue);
+            }
+        }
+    }
+
+    // Moves the given cells (indices into the grid) out of the grid into a new body
+    void detachBody(const std::vector<int> &cells)
+    {
+        const int width = voxels.getWidth();
+        int minX = width, minY = voxels.getHeight(), maxX = 0, maxY = 0;
+        for (int cell : cells)
+        {
+            minX = std::min(minX, cell % width);
+            minY = std::min(minY, cell / width);
+            maxX = std::max(maxX, cell % width);
+            maxY = std::max(maxY, cell / width);
+        }
+        fluid.wake(minX, minY, maxX, maxY);
+
+        bodies.emplace_back();
+        VoxelBody &body = bodies.back();
+        for (int cell : cells)
+        {
+            int x = cell % width, y = cell / width;
+            body.cells.push_back({static_cast<sf::Int16>(x - minX), static_cast<sf::Int16>(y - minY), voxels.get(x, y)});
+            setVoxel(x, y, Material::Empty);
+        }
+        body.updateShape();
+        body.position = sf::Vector2f(static_cast<float>(minX * VOXEL_SIZE), static_cast<float>(minY * VOXEL_SIZE)) +
+                        body.centerOfMass;
+    }
+
+    // Rigid-body step for the debris: gravity, contacts with the terrain (the
+    // world's sides and bottom count as solid) and contacts between bodies, in
+    // sub-steps small enough that the fastest body moves at most half a cell
+    // per step. Bodies that stay nearly still for BODY_REST_TIME are written
+    // back into the grid.
+    void updateBodies(float deltaTime)
+    {
+        float fastest = 0.f;
+        for (const auto &body : bodies)
+            fastest = std::max(fastest, vectorLength(body.velocity) + std::abs(body.angularVelocity) * body.radius);
+        int steps = std::min(8, std::max(1, static_cast<int>(std::ceil(fastest * deltaTime / (VOXEL_SIZE * 0.5f)))));
+        float step = deltaTime / steps;
+
+        for (int i = 0; i < steps && !bodies.empty(); ++i)
+        {
+            for (auto &body : bodies)
+            {
+                body.velocity.y += GRAVITY * step;
+                body.position += body.velocity * step;
+                body.angle += body.angularVelocity * step;
+            }
+            // Repeated passes let a pile pass its weight down to the terrain
+            for (int pass = 0; pass < BODY_CONTACT_PASSES; ++pass)
+            {
+                for (auto &body : bodies)
+                    resolveGridContacts(body);
+                resolveBodyContacts();
+            }
+        }
+
+        // Resting contacts leave some velocity jitter, so rest is judged by how
+        // far a body got from where it was when it last started moving
+        for (auto it = bodies.begin(); it != bodies.end();)
+        {
+            if (vectorLength(it->position - it->restPosition) < BODY_REST_DISTANCE &&
+                std::abs(it->angle - it->restAngle) * it->radius < BODY_REST_DISTANCE)
+            {
+                it->restTime += deltaTime;
+            }
+            else
+            {
+                it->restPosition = it->position;
+                it->restAngle = it->angle;
+                it->restTime = 0.f;
+            }
+
+            if (it->restTime >= BODY_REST_TIME)
+            {
+                settleBody(*it);
+                it = bodies.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    bool bodyBlockedAt(int x, int y) const
+    {
+        return x < 0 || x >= voxels.getWidth() || y >= voxels.getHeight() || voxels.isSolid(x, y);
+    }
+
+    // Outline points that ended up inside the terrain are merged into one
+    // contact at their average point and normal, so a body landing flat gets
+    // no spin from the order its corners are visited in. The body is then
+    // pushed out along the deepest point.
+    void resolveGridContacts(VoxelBody &body)
+    {
+        // Nothing solid under the bounding box: one masked test instead of one per point
+        int x0 = static_cast<int>(std::floor((body.position.x - body.radius) / VOXEL_SIZE));
+        int y0 = static_cast<int>(std::floor((body.position.y - body.radius) / VOXEL_SIZE));
+        int x1 = static_cast<int>(std::floor((body.position.x + body.radius) / VOXEL_SIZE));
+        int y1 = static_cast<int>(std::floor((body.position.y + body.radius) / VOXEL_SIZE));
+        if (x0 >= 0 && x1 < voxels.getWidth() && y1 < voxels.getHeight() && !voxels.anySolid(x0, y0, x1, y1))
+            return;
+
+        sf::Vector2f axis(std::cos(body.angle), std::sin(body.angle));
+        auto solidAt = [this](int x, int y) { return bodyBlockedAt(x, y); };
+        ContactSum contact;
+        for (const auto &point : body.contactPoints)
+        {
+            sf::Vector2f arm = rotateBy(point, axis);
+            sf::Vector2f normal;
+            float depth;
+            if (cellPenetration(body.position + arm, solidAt, normal, depth))
+                contact.add(arm, normal, depth);
+        }
+
+        if (contact.count > 0)
+        {
+            applyContactImpulse(body, nullptr, contact.arm(), sf::Vector2f(), contact.normal());
+            body.position += contact.correction;
+        }
+    }
+
+    // Sweep over the bodies sorted by the left edge of their bounding circles;
+    // pairs whose circles overlap test each one's outline against the other's cells
+    void resolveBodyContacts()
+    {
+        bodyOrder.resize(bodies.size());
+        for (std::size_t i = 0; i < bodies.size(); ++i)
+            bodyOrder[i] = static_cast<int>(i);
+        std::sort(bodyOrder.begin(), bodyOrder.end(), [this](int a, int b) {
+            return bodies[a].position.x - bodies[a].radius < bodies[b].position.x - bodies[b].radius;
+        });
+
+        for (std::size_t i = 0; i < bodyOrder.size(); ++i)
+        {
+            VoxelBody &a = bodies[bodyOrder[i]];
+            for (std::size_t j = i + 1; j < bodyOrder.size(); ++j)
+            {
+                VoxelBody &b = bodies[bodyOrder[j]];
+                if (b.position.x - b.radius > a.position.x + a.radius)
+                    break;
+                sf::Vector2f offset = b.position - a.position;
+                float reach = a.radius + b.radius;
+                if (offset.x * offset.x + offset.y * offset.y > reach * reach)
+                    continue;
+                collideBodies(a, b);
+                collideBodies(b, a);
+            }
+        }
+    }
+
+    // a's outline points inside b's cells, merged into one contact as in
+    // resolveGridContacts; the bodies are pushed apart by inverse mass
+    void collideBodies(VoxelBody &a, VoxelBody &b)
+    {
+        sf::Vector2f axisA(std::cos(a.angle), std::sin(a.angle));
+        sf::Vector2f axisB(std::cos(b.angle), std::sin(b.angle));
+        auto solidAt = [&b](int x, int y) { return b.solidAt(x, y); };
+        ContactSum contact;
+        for (const auto &point : a.contactPoints)
+        {
+            sf::Vector2f armA = rotateBy(point, axisA);
+            sf::Vector2f local = unrotateBy(a.position + armA - b.position, axisB) + b.centerOfMass;
+            sf::Vector2f normal;
+            float depth;
+            if (cellPenetration(local, solidAt, normal, depth))
+                contact.add(armA, rotateBy(normal, axisB), depth);
+        }
+        if (contact.count == 0)
+            return;
+
+        sf::Vector2f armA = contact.arm();
+        applyContactImpulse(a, &b, armA, a.position + armA - b.position, contact.normal());
+
+        // Only part of the overlap is undone per step, or piles push each
+        // other back and forth forever
+        float push = std::max(contact.deepest - BODY_OVERLAP_SLOP, 0.f) / std::max(contact.deepest, 1e-4f) * 0.5f;
+        float totalInverseMass = a.inverseMass + b.inverseMass;
+        a.position += contact.correction * (push * a.inverseMass / totalInverseMass);
+        b.position -= contact.correction * (push * b.inverseMass / totalInverseMass);
+    }
+
+    // Collision and friction impulse at one contact. normal points from b
+    // (or the terrain, if b is null) towards a; the arms run from each body's
+    // center of mass to the contact point.
+    void applyContactImpulse(VoxelBody &a, VoxelBody *b, const sf::Vector2f &armA, const sf::Vector2f &armB,
+                             const sf::Vector2f &normal)
+    {
+        auto pointVelocity = [](const VoxelBody &body, const sf::Vector2f &arm) {
+            return body.velocity + sf::Vector2f(-body.angularVelocity * arm.y, body.angularVelocity * arm.x);
+        };
+        auto push = [](VoxelBody &body, const sf::Vector2f &arm, const sf::Vector2f &impulse) {
+            body.velocity += impulse * body.inverseMass;
+            body.angularVelocity += cross(arm, impulse) * body.inverseInertia;
+        };
+        // Inverse of the effective mass along a direction
+        auto resistance = [&](const sf::Vector2f &direction) {
+            float armA2 = cross(armA, direction), armB2 = b ? cross(armB, direction) : 0.f;
+            return a.inverseMass + armA2 * armA2 * a.inverseInertia +
+                   (b ? b->inverseMass + armB2 * armB2 * b->inverseInertia : 0.f);
+        };
+
+        sf::Vector2f relative = pointVelocity(a, armA) - (b ? pointVelocity(*b, armB) : sf::Vector2f());
+        float approach = dot(relative, normal);
+        if (approach >= 0.f)
+            return;
+
+        // Slow contacts don't bounce, so resting bodies come to a stop
+        float restitution = approach < -BODY_BOUNCE_SPEED ? BODY_RESTITUTION : 0.f;
+        float impulse = -(1.f + restitution) * approach / resistance(normal);
+        push(a, armA, normal * impulse);
+        if (b)
+            push(*b, armB, -normal * impulse);
+
+        // Coulomb friction against the sliding direction
+        sf::Vector2f tangent = relative - normal * approach;
+        float slide = vectorLength(tangent);
+        if (slide > 1e-4f)
+        {
+            tangent /= slide;
+            float friction = std::min(slide / resistance(tangent), BODY_FRICTION * impulse);
+            push(a, armA, -tangent * friction);
+            if (b)
+                push(*b, armB, tangent * friction);
+        }
+    }
+
+    // Writes a body back into the grid where its cells now are. Cells that
+    // end up inside the terrain or on top of each other are lost. One undo step.
+    void settleBody(const VoxelBody &body)
+    {
+        sf::Vector2f axis(std::cos(body.angle), std::sin(body.angle));
+        if (journal)
+            journal->commit();
+        for (const auto &cell : body.cells)
+        {
+            sf::Vector2f center((cell.x + 0.5f) * VOXEL_SIZE, (cell.y + 0.5f) * VOXEL_SIZE);
+            sf::Vector2f world = body.position + rotateBy(center - body.centerOfMass, axis);
+            int x = static_cast<int>(std::floor(world.x / VOXEL_SIZE));
+            int y = static_cast<int>(std::floor(world.y / VOXEL_SIZE));
+            if (voxels.contains(x, y) && !voxels.isSolid(x, y))
+                setVoxel(x, y, cell.material);
+        }
+        if (journal)
+            journal->commit();
+    }
+
+    void updateScreenShake(float deltaTime)
+    {
+        if (screenShakeTime > 0)
+        {
+            screenShakeTime -= deltaTime;
+            float intensity = (screenShakeTime / SCREEN_SHAKE_DURATION) * SCREEN_SHAKE_INTENSITY;
+            screenShakeOffset = sf::Vector2f(
+                (random(100) - 50) * 0.01f * intensity,
+                (random(100) - 50) * 0.01f * intensity);
+        }
+        else
+        {
+            screenShakeOffset = sf::Vector2f(0, 0);
+        }
+    }
+
+    void updatePlayer(Player &player, float deltaTime)
+    {
+        const PlayerInput &input = player.input;
+
+        // Painting
+        if (input.drawing)
+        {
+            spawnVoxelsInRadius(input.aim.x, input.aim.y);
+        }
+
+        // Shooting
+        if (input.fireCount != player.lastFireCount)
+        {
+            player.lastFireCount = input.fireCount;
+
+            sf::Vector2f playerCenter = player.shape.getPosition() +
+                                        sf::Vector2f(player.shape.getSize().x / 2, player.shape.getSize().y / 2);
+            sf::Vector2f direction = input.aim - playerCenter;
+            if (vectorLength(direction) > 0)
+            {
+                bullets.emplace_back(playerCenter, normalize(direction) * BULLET_SPEED);
+            }
+        }
+
+        movePlayer(player, input, deltaTime);
+    }
+};
+
+// Wire protocol. Every datagram starts with a MessageType byte.
+//   Join     client -> server  (no payload)
+//   Welcome  server -> client  player id
+//   Input      client -> server  PlayerInput, then acknowledged chunk revisions
+//   Leave      client -> server  (no payload)
+//   Snapshot   server -> client  tick, last processed input sequence, players, bullets, explosions
+//   VoxelDelta server -> client  chunk deltas: index, base revision, new revision, encoded cells
+enum class MessageType : sf::Uint8
+{
+    Join,
+    Welcome,
+    Input,
+    Leave,
+    Snapshot,
+    VoxelDelta
+};
+
+// Base revision of a delta that rebuilds the chunk from empty, sent when the
+// client's acknowledged version is no longer in the server's history
+const sf::Uint32 VOXEL_KEYFRAME = 0xFFFFFFFF;
+
+// Integers in sf::Packet are big-endian; raw payloads built next to it follow suit
+void writeBigEndian(std::vector<sf::Uint8> &out, sf::Uint32 value, int bytes)
+{
+    for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8)
+        out.push_back(static_cast<sf::Uint8>(value >> shift));
+}
+
+bool readBigEndian(const sf::Uint8 *&data, const sf::Uint8 *end, sf::Uint32 &value, int bytes)
+{
+    if (end - data < bytes)
+        return false;
+    value = 0;
+    for (int i = 0; i < bytes; ++i)
+        value = (value << 8) | *data++;
+    return true;
+}
+
+sf::Packet &operator<<(sf::Packet &packet, MessageType type)
+{
+    return packet << static_cast<sf::Uint8>(type);
+}
+
+sf::Packet &operator>>(sf::Packet &packet, MessageType &type)
+{
+    sf::Uint8 value = 0;
+    packet >> value;
+    type = static_cast<MessageType>(value);
+    return packet;
+}
+
+sf::Packet &operator<<(sf::Packet &packet, const sf::Vector2f &vec)
+{
+    return packet << vec.x << vec.y;
+}
+
+sf::Packet &operator>>(sf::Packet &packet, sf::Vector2f &vec)
+{
+    return packet >> vec.x >> vec.y;
+}
+
+sf::Packet &operator<<(sf::Packet &packet, const PlayerInput &input)
+{
+    return packet << input.sequence << input.moveX << input.jump << input.drawing
+                  << input.fireCount << input.aim;
+}
+
+sf::Packet &operator>>(sf::Packet &packet, PlayerInput &input)
+{
+    return packet >> input.sequence >> input.moveX >> input.jump >> input.drawing >> input.fireCount >> input.aim;
+}
+
+struct ChunkAck
+{
+    sf::Uint16 chunk;
+    sf::Uint32 revision;
+};
+
+// Authoritative server: owns the only Simulation that matters, steps it at
+// the configured tick rate and broadcasts the results to every connected client.
+class Server
+{
+public:
+    Server(unsigned short port)
+    {
+        if (socket.bind(port) != sf::Socket::Done)
+        {
+            throw std::runtime_error("Could not bind server port " + std::to_string(port));
+        }
+        socket.setBlocking(false);
+        simulation.effectsEnabled = false;
+
+        // Revision 0 of every chunk is the empty chunk all clients start from
+        history.resize(simulation.voxels.getChunkCount());
+        for (auto &versions : history)
+        {
+            versions.push_back({0, std::vector<Material>(VoxelGrid::CHUNK_CELLS, Material::Empty)});
+        }
+    }
+
+    void run(const std::atomic<bool> &running, bool printStats)
+    {
+        const sf::Time tickTime = sf::seconds(1.f / settings.tickRate);
+        sf::Clock clock;
+        sf::Clock statsClock;
+        sf::Time accumulator;
+
+        while (running)
+        {
+            accumulator += clock.restart();
+            receivePackets();
+
+            // Never try to catch up more than a handful of ticks after a stall
+            if (accumulator > tickTime * 5.f)
+                accumulator = tickTime * 5.f;
+
+            while (accumulator >= tickTime)
+            {
+                sf::Clock tickClock;
+                tick(tickTime.asSeconds());
+                recordTickTime(tickClock.getElapsedTime());
+                accumulator -= tickTime;
+            }
+
+            if (printStats && statsClock.getElapsedTime() >= sf::seconds(1.f))
+            {
+                std::cout << statsLine(statsClock.restart().asSeconds()) << std::endl;
+            }
+
+            sf::sleep(sf::milliseconds(1));
+        }
+    }
+
+    // One-line summary of the interval since the previous call, reset afterwards
+    std::string statsLine(float interval)
+    {
+        std::size_t perClient = clients.empty() ? 0 : voxelBytesSent / clients.size();
+        std::string line = "server: clients " + std::to_string(clients.size()) +
+                           " voxels " + std::to_string(simulation.voxels.getCount()) +
+                           " ticks " + std::to_string(ticksMeasured) +
+                           " avg tick " + std::to_string(ticksMeasured ? totalTickTime.asMicroseconds() / ticksMeasured : 0) + "us" +
+                           " max tick " + std::to_string(maxTickTime.asMicroseconds()) + "us" +
+                           " out " + std::to_string(static_cast<long>(bytesSent / interval / 1024)) + " KiB/s" +
+                           " voxel deltas " + std::to_string(static_cast<long>(perClient / interval)) + " B/s per client" +
+                           " (" + std::to_string(keyframesSent) + " keyframes)";
+        ticksMeasured = 0;
+        totalTickTime = sf::Time::Zero;
+        maxTickTime = sf::Time::Zero;
+        bytesSent = 0;
+        voxelBytesSent = 0;
+        keyframesSent = 0;
+        return line;
+    }
+
+private:
+    // What one client is known to have of one chunk
+    struct ChunkSync
+    {
+        sf::Uint32 ackedRevision = 0;
+        sf::Uint32 sentRevision = 0;
+        float sinceSent = 0.f;
+    };
+
+    struct ClientSlot
+    {
+        sf::IpAddress address;
+        unsigned short port;
+        sf::Uint8 playerId;
+        sf::Uint32 receivedSequence;
+        sf::Uint32 processedSequence;
+        float idleTime;
+        std::vector<ChunkSync> chunks;
+        std::deque<PlayerInput> inputs; // Received but not yet simulated, one per tick
+    };
+
+    struct ChunkVersion
+    {
+        sf::Uint32 revision;
+        std::vector<Material> cells;
+    };
+
+    sf::UdpSocket socket;
+    Simulation simulation;
+    std::vector<ClientSlot> clients;
+    sf::Uint8 nextPlayerId = 0;
+    sf::Uint32 tickCount = 0;
+
+    // Recent versions of each chunk, oldest first; the delta bases for clients
+    std::vector<std::deque<ChunkVersion>> history;
+
+    // Stats
+    std::size_t bytesSent = 0;
+    std::size_t voxelBytesSent = 0;
+    std::size_t keyframesSent = 0;
+    int ticksMeasured = 0;
+    sf::Time totalTickTime;
+    sf::Time maxTickTime;
+
+    ClientSlot *findClient(const sf::IpAddress &address, unsigned short port)
+    {
+        for (auto &client : clients)
+        {
+            if (client.address == address && client.port == port)
+                return &client;
+        }
+        return nullptr;
+    }
+
+    void send(sf::Packet &packet, const ClientSlot &client)
+    {
+        bytesSent += packet.getDataSize();
+        socket.send(packet, client.address, client.port);
+    }
+
+    void receivePackets()
+    {
+        sf::Packet packet;
+        sf::IpAddress address;
+        unsigned short port;
+
+        while (socket.receive(packet, address, port) == sf::Socket::Done)
+        {
+            MessageType type;
+            if (!(packet >> type))
+                continue;
+
+            ClientSlot *client = findClient(address, port);
+
+            if (type == MessageType::Join)
+            {
+                if (!client)
+                {
+                    if (clients.size() >= MAX_PLAYERS)
+                        continue;
+                    clients.push_back({address, port, nextPlayerId++, 0, 0, 0.f,
+                                       std::vector<ChunkSync>(simulation.voxels.getChunkCount()), {}});
+                    client = &clients.back();
+                    simulation.addPlayer(client->playerId);
+                }
+
+                // Welcome is resent for every Join in case the previous one was lost
+                sf::Packet welcome;
+                welcome << MessageType::Welcome << client->playerId;
+                send(welcome, *client);
+            }
+            else if (type == MessageType::Input && client)
+            {
+                PlayerInput input;
+                if (!(packet >> input))
+                    continue;
+
+                client->idleTime = 0.f;
+                receiveAcks(packet, *client);
+
+                // Drop stale and reordered inputs
+                if (input.sequence <= client->receivedSequence)
+                    continue;
+
+                client->receivedSequence = input.sequence;
+                client->inputs.push_back(input);
+                if (client->inputs.size() > MAX_QUEUED_INPUTS)
+                    client->inputs.pop_front();
+            }
+            else if (type == MessageType::Leave && client)
+            {
+                client->idleTime = CLIENT_TIMEOUT;
+            }
+        }
+    }
+
+    void receiveAcks(sf::Packet &packet, ClientSlot &client)
+    {
+        sf::Uint8 ackCount = 0;
+        packet >> ackCount;
+        for (sf::Uint8 i = 0; i < ackCount; ++i)
+        {
+            ChunkAck ack = {0, 0};
+            if (!(packet >> ack.chunk >> ack.revision) || ack.chunk >= client.chunks.size())
+                return;
+
+            // Acks can arrive reordered; revisions only move forward
+            ChunkSync &sync = client.chunks[ack.chunk];
+            if (ack.revision > sync.ackedRevision && ack.revision <= simulation.voxels.getChunkRevision(ack.chunk))
+                sync.ackedRevision = ack.revision;
+        }
+    }
+
+    void tick(float deltaTime)
+    {
+        ++tickCount;
+
+        // Drop clients that went quiet
+        for (auto it = clients.begin(); it != clients.end();)
+        {
+            it->idleTime += deltaTime;
+            if (it->idleTime >= CLIENT_TIMEOUT)
+            {
+                simulation.removePlayer(it->playerId);
+                it = clients.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        // Consume one input per client per tick, the same step the client predicted
+        // with. If none arrived the previous input simply repeats.
+        for (auto &client : clients)
+        {
+            if (client.inputs.empty())
+                continue;
+
+            if (Player *player = simulation.findPlayer(client.playerId))
+            {
+                player->input = client.inputs.front();
+            }
+            client.processedSequence = client.inputs.front().sequence;
+            client.inputs.pop_front();
+        }
+
+        simulation.update(deltaTime);
+
+        broadcastSnapshot();
+        simulation.explosionEvents.clear();
+
+        commitChunkHistory();
+        sendVoxelDeltas(deltaTime);
+    }
+
+    void broadcastSnapshot()
+    {
+        for (const auto &client : clients)
+        {
+            sf::Packet packet;
+            packet << MessageType::Snapshot << tickCount << client.processedSequence;
+
+            packet << static_cast<sf::Uint8>(simulation.players.size());
+            for (const auto &player : simulation.players)
+            {
+                packet << player.id << player.shape.getPosition() << player.velocity << player.isJumping;
+            }
+
+            packet << static_cast<sf::Uint16>(simulation.bullets.size());
+            for (const auto &bullet : simulation.bullets)
+            {
+                packet << bullet.shape.getPosition();
+            }
+
+            packet << static_cast<sf::Uint16>(simulation.explosionEvents.size());
+            for (const auto &position : simulation.explosionEvents)
+            {
+                packet << position;
+            }
+
+            send(packet, client);
+        }
+    }
+
+    // Records a version of every chunk that changed this tick
+    void commitChunkHistory()
+    {
+        const VoxelGrid &grid = simulation.voxels;
+        for (int chunk = 0; chunk < grid.getChunkCount(); ++chunk)
+        {
+            std::deque<ChunkVersion> &versions = history[chunk];
+            sf::Uint32 revision = grid.getChunkRevision(chunk);
+            if (versions.back().revision == revision)
+                continue;
+
+            if (versions.size() >= VOXEL_HISTORY_LENGTH)
+            {
+                // Recycle the oldest buffer
+                versions.push_back(std::move(versions.front()));
+                versions.pop_front();
+            }
+            else
+            {
+                versions.emplace_back();
+            }
+
+            const Material *cells = grid.getChunkCells(chunk);
+            versions.back().revision = revision;
+            versions.back().cells.assign(cells, cells + VoxelGrid::CHUNK_CELLS);
+        }
+    }
+
+    const ChunkVersion *findVersion(int chunk, sf::Uint32 revision) const
+    {
+        for (const auto &version : history[chunk])
+        {
+            if (version.revision == revision)
+                return &version;
+        }
+        return nullptr;
+    }
+
+    // Sends every client the chunks it is behind on, diffed against the last
+    // version it acknowledged. Unacknowledged deltas are repeated after
+    // VOXEL_RESEND_INTERVAL, or immediately when the chunk changes again.
+    void sendVoxelDeltas(float deltaTime)
+    {
+        std::vector<sf::Uint8> body;
+        std::vector<sf::Uint8> encoded;
+
+        for (auto &client : clients)
+        {
+            sf::Uint16 entryCount = 0;
+            body.clear();
+
+            auto flush = [&]() {
+                if (entryCount == 0)
+                    return;
+                sf::Packet packet;
+                packet << MessageType::VoxelDelta << entryCount;
+                packet.append(body.data(), body.size());
+                voxelBytesSent += packet.getDataSize();
+                send(packet, client);
+                body.clear();
+                entryCount = 0;
+            };
+
+            for (int chunk = 0; chunk < static_cast<int>(client.chunks.size()); ++chunk)
+            {
+                ChunkSync &sync = client.chunks[chunk];
+                sync.sinceSent += deltaTime;
+
+                const ChunkVersion &current = history[chunk].back();
+                if (current.revision == sync.ackedRevision)
+                    continue;
+                if (current.revision == sync.sentRevision && sync.sinceSent < VOXEL_RESEND_INTERVAL)
+                    continue;
+
+                const ChunkVersion *base = findVersion(chunk, sync.ackedRevision);
+                if (!base)
+                    ++keyframesSent;
+
+                encoded.clear();
+                encodeChunkDelta(base ? base->cells.data() : nullptr, current.cells.data(), encoded);
+
+                if (!body.empty() && body.size() + 12 + encoded.size() > VOXEL_PACKET_BUDGET)
+                    flush();
+
+                // Entry: chunk, base revision, new revision, payload size, payload
+                writeBigEndian(body, static_cast<sf::Uint32>(chunk), 2);
+                writeBigEndian(body, base ? base->revision : VOXEL_KEYFRAME, 4);
+                writeBigEndian(body, current.revision, 4);
+                writeBigEndian(body, static_cast<sf::Uint32>(encoded.size()), 2);
+                body.insert(body.end(), encoded.begin(), encoded.end());
+                ++entryCount;
+
+                sync.sentRevision = current.revision;
+                sync.sinceSent = 0.f;
+            }
+            flush();
+        }
+    }
+
+    void recordTickTime(sf::Time time)
+    {
+        ++ticksMeasured;
+        totalTickTime += time;
+        if (time > maxTickTime)
+            maxTickTime = time;
+    }
+};
+
+// Network endpoint of a player: sends input commands and applies server
+// messages to a mirror Simulation (or just counts them, for bots).
+//
+// The local player is predicted: every input sent is also applied to the
+// mirror right away and kept in a history. When a snapshot arrives the player
+// is rolled back to the server's state for the last input the server
+// processed, and the newer inputs are re-simulated on top of it.
+class Client
+{
+public:
+    sf::Uint8 playerId = 0;
+    bool joined = false;
+    std::size_t bytesSent = 0;
+    std::size_t bytesReceived = 0;
+    std::size_t voxelBytesReceived = 0;
+    std::size_t snapshotsReceived = 0;
+
+    // Prediction stats
+    std::size_t reconciliations = 0;
+    std::size_t resimulatedTicks = 0;
+    sf::Time resimulationTime;
+
+    Client(const sf::IpAddress &serverAddress, unsigned short serverPort)
+        : serverAddress(serverAddress), serverPort(serverPort)
+    {
+        if (socket.bind(sf::Socket::AnyPort) != sf::Socket::Done)
+        {
+            throw std::runtime_error("Could not bind client socket");
+        }
+        socket.setBlocking(false);
+    }
+
+    ~Client()
+    {
+        sf::Packet packet;
+        packet << MessageType::Leave;
+        socket.send(packet, serverAddress, serverPort);
+    }
+
+    // Sends the input for one server tick, or keeps asking to join until welcomed.
+    // With a mirror, the local player is moved by the input immediately.
+    void sendInput(PlayerInput &input, Simulation *mirror)
+    {
+        sf::Packet packet;
+        if (joined)
+        {
+            input.sequence = ++lastSequence;
+            packet << MessageType::Input << input;
+
+            // Piggyback chunk acknowledgements
+            std::size_t ackCount = std::min<std::size_t>(pendingAcks.size(), 255);
+            packet << static_cast<sf::Uint8>(ackCount);
+            for (std::size_t i = 0; i < ackCount; ++i)
+            {
+                packet << pendingAcks[i].chunk << pendingAcks[i].revision;
+            }
+            pendingAcks.erase(pendingAcks.begin(), pendingAcks.begin() + ackCount);
+        }
+        else
+        {
+            packet << MessageType::Join;
+        }
+        bytesSent += packet.getDataSize();
+        socket.send(packet, serverAddress, serverPort);
+
+        if (joined && mirror)
+        {
+            predictedInputs.push_back(input);
+            if (predictedInputs.size() > MAX_PREDICTED_INPUTS)
+                predictedInputs.pop_front();
+
+            if (Player *player = mirror->findPlayer(playerId))
+            {
+                mirror->movePlayer(*player, input, 1.f / settings.tickRate);
+            }
+        }
+    }
+
+    // Drains the socket. Returns true if at least one snapshot arrived.
+    bool receive(Simulation *mirror)
+    {
+        sf::Packet packet;
+        sf::IpAddress address;
+        unsigned short port;
+        bool gotSnapshot = false;
+
+        while (socket.receive(packet, address, port) == sf::Socket::Done)
+        {
+            if (address != serverAddress || port != serverPort)
+                continue;
+
+            bytesReceived += packet.getDataSize();
+
+            MessageType type;
+            if (!(packet >> type))
+                continue;
+
+            if (type == MessageType::Welcome)
+            {
+                joined = static_cast<bool>(packet >> playerId);
+            }
+            else if (type == MessageType::Snapshot)
+            {
+                ++snapshotsReceived;
+                gotSnapshot = true;
+                if (mirror)
+                    applySnapshot(packet, *mirror);
+            }
+            else if (type == MessageType::VoxelDelta && mirror)
+            {
+                voxelBytesReceived += packet.getDataSize();
+                applyVoxelDeltas(packet, *mirror);
+            }
+        }
+        return gotSnapshot;
+    }
+
+private:
+    sf::UdpSocket socket;
+    sf::IpAddress serverAddress;
+    unsigned short serverPort;
+    sf::Uint32 lastSequence = 0;
+    sf::Uint32 lastSnapshotTick = 0;
+
+    // Server-side revision of each chunk in the mirror grid
+    std::vector<sf::Uint32> chunkRevisions;
+    std::vector<ChunkAck> pendingAcks;
+    std::vector<std::pair<sf::Uint32, Material>> decodedCells; // One delta, held until all of it is valid
+
+    // Inputs sent but not yet reflected in a snapshot, oldest first
+    std::deque<PlayerInput> predictedInputs;
+
+    void applySnapshot(sf::Packet &packet, Simulation &mirror)
+    {
+        sf::Uint32 tick = 0, ackedSequence = 0;
+        packet >> tick >> ackedSequence;
+
+        // Snapshots can arrive out of order; only the newest one counts
+        if (tick <= lastSnapshotTick)
+            return;
+        lastSnapshotTick = tick;
+
+        sf::Uint8 playerCount = 0;
+        packet >> playerCount;
+        std::vector<Player> players;
+        for (sf::Uint8 i = 0; i < playerCount; ++i)
+        {
+            sf::Uint8 id = 0;
+            sf::Vector2f position;
+            players.emplace_back();
+            Player &player = players.back();
+            packet >> id >> position >> player.velocity >> player.isJumping;
+            player.id = id;
+            player.shape.setPosition(position);
+            player.shape.setFillColor(id == playerId ? sf::Color::Green : sf::Color::Cyan);
+        }
+
+        sf::Uint16 bulletCount = 0;
+        packet >> bulletCount;
+        std::vector<Bullet> bullets;
+        for (sf::Uint16 i = 0; i < bulletCount; ++i)
+        {
+            sf::Vector2f position;
+            packet >> position;
+            bullets.emplace_back(position, sf::Vector2f(0, 0));
+        }
+
+        sf::Uint16 explosionCount = 0;
+        packet >> explosionCount;
+        std::vector<sf::Vector2f> explosions(explosionCount);
+        for (auto &position : explosions)
+        {
+            packet >> position;
+        }
+
+        if (!packet)
+            return;
+
+        mirror.players.swap(players);
+        mirror.bullets.swap(bullets);
+        for (const auto &position : explosions)
+        {
+            mirror.spawnExplosionEffects(position);
+        }
+
+        reconcile(mirror, ackedSequence);
+    }
+
+    // The local player now holds the server's state as of input ackedSequence;
+    // replay everything the server hasn't seen yet
+    void reconcile(Simulation &mirror, sf::Uint32 ackedSequence)
+    {
+        while (!predictedInputs.empty() && predictedInputs.front().sequence <= ackedSequence)
+            predictedInputs.pop_front();
+
+        Player *player = mirror.findPlayer(playerId);
+        if (!player)
+            return;
+
+        sf::Clock clock;
+        for (const auto &input : predictedInputs)
+        {
+            mirror.movePlayer(*player, input, 1.f / settings.tickRate);
+        }
+        resimulationTime += clock.getElapsedTime();
+        resimulatedTicks += predictedInputs.size();
+        ++reconciliations;
+    }
+
+    void applyVoxelDeltas(sf::Packet &packet, Simulation &mirror)
+    {
+        VoxelGrid &grid = mirror.voxels;
+        if (chunkRevisions.size() != static_cast<std::size_t>(grid.getChunkCount()))
+            chunkRevisions.assign(grid.getChunkCount(), 0);
+
+        sf::Uint16 entryCount = 0;
+        if (!(packet >> entryCount))
+            return;
+
+        // Entries are raw bytes after the message type and entry count
+        const sf::Uint8 *data = static_cast<const sf::Uint8 *>(packet.getData()) + sizeof(sf::Uint8) + sizeof(sf::Uint16);
+        const sf::Uint8 *end = static_cast<const sf::Uint8 *>(packet.getData()) + packet.getDataSize();
+
+        for (sf::Uint16 i = 0; i < entryCount; ++i)
+        {
+            sf::Uint32 chunk, baseRevision, newRevision, size;
+            if (!readBigEndian(data, end, chunk, 2) || !readBigEndian(data, end, baseRevision, 4) ||
+                !readBigEndian(data, end, newRevision, 4) || !readBigEndian(data, end, size, 2) ||
+                size > static_cast<std::size_t>(end - data) || chunk >= chunkRevisions.size())
+                return;
+
+            const sf::Uint8 *payload = data;
+            data += size;
+
+            // A delta only applies on top of exactly the version it was made from
+            sf::Uint32 &revision = chunkRevisions[chunk];
+            if (newRevision > revision && (baseRevision == revision || baseRevision == VOXEL_KEYFRAME))
+            {
+                // Malformed deltas leave the chunk as it was
+                decodedCells.clear();
+                bool valid = decodeChunkDelta(payload, payload + size, [this](sf::Uint32 cell, Material material) {
+                    decodedCells.emplace_back(cell, material);
+                });
+                if (valid)
+                {
+                    int originX, originY;
+                    grid.chunkOrigin(chunk, originX, originY);
+
+                    if (baseRevision == VOXEL_KEYFRAME)
+                    {
+                        for (int y = 0; y < CHUNK_SIZE; ++y)
+                            for (int x = 0; x < CHUNK_SIZE; ++x)
+                                grid.set(originX + x, originY + y, Material::Empty);
+                    }
+                    for (const auto &decoded : decodedCells)
+                        grid.set(originX + static_cast<int>(decoded.first % CHUNK_SIZE),
+                                 originY + static_cast<int>(decoded.first / CHUNK_SIZE), decoded.second);
+                    revision = newRevision;
+                }
+            }
+
+            // Always (re)acknowledge what we hold so the server can pick a usable base
+            pendingAcks.push_back({static_cast<sf::Uint16>(chunk), revision});
+        }
+    }
+};
+
+// Observations counted into buckets by upper bound, cumulative like a
+// Prometheus histogram (the last bucket is +Inf)
+struct Histogram
+{
+    std::vector<double> bounds;
+    std::vector<sf::Uint64> counts; // One per bound plus +Inf, each including the ones before
+    double sum = 0.0;
+
+    explicit Histogram(std::vector<double> upperBounds) : bounds(std::move(upperBounds)), counts(bounds.size() + 1, 0)
+    {
+    }
+
+    void observe(double value)
+    {
+        for (std::size_t i = 0; i < counts.size(); ++i)
+        {
+            if (i == bounds.size() || value <= bounds[i])
+                ++counts[i];
+        }
+        sum += value;
+    }
+};
+
+// Running mean and spread of frame times, for comparing pacing modes
+struct FrameTimeStats
+{
+    sf::Uint64 count = 0;
+    double mean = 0.0;    // Seconds
+    double squares = 0.0; // Sum of squared differences from the mean (Welford)
+    double longest = 0.0;
+
+    void observe(double seconds)
+    {
+        ++count;
+        double delta = seconds - mean;
+        mean += delta / static_cast<double>(count);
+        squares += delta * (seconds - mean);
+        longest = std::max(longest, seconds);
+    }
+
+    double deviation() const { return count > 1 ? std::sqrt(squares / static_cast<double>(count - 1)) : 0.0; }
+};
+
+// Holds frames to a fixed period. Sleeps until shortly before the deadline,
+// then spins the rest of the way; the margin follows how late sleeps wake
+// up on this machine, so the spin is no longer than it needs to be.
+// Deadlines advance by whole periods, so a late frame is made up by the next.
+class FramePacer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit FramePacer(int framesPerSecond)
+        : period(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / framesPerSecond))),
+          deadline(Clock::now() + period)
+    {
+    }
+
+    void wait()
+    {
+        Clock::time_point wake = deadline - margin;
+        if (Clock::now() < wake)
+        {
+            std::this_thread::sleep_until(wake);
+            // Grow at once to a later wake-up, shrink slowly after an early one
+            Clock::duration late = Clock::now() - wake;
+            margin = std::max(late + late / 4, margin - margin / 64);
+            margin = std::min(std::max(margin, Clock::duration(std::chrono::microseconds(50))), period);
+        }
+        while (Clock::now() < deadline)
+            std::this_thread::yield();
+
+        // More than a period behind: start over instead of rushing frames out
+        deadline += period;
+        Clock::time_point now = Clock::now();
+        if (deadline <= now)
+            deadline = now + period;
+    }
+
+    float getMarginMs() const { return std::chrono::duration<float, std::milli>(margin).count(); }
+
+private:
+    Clock::duration period;
+    Clock::time_point deadline;
+    Clock::duration margin = std::chrono::milliseconds(1);
+};
+
+// Serves counters over HTTP in the Prometheus text format on a loopback
+// port, so long sessions can be scraped by a local monitoring stack. Polled
+// from the frame loop and never blocks it: scrapers are accepted and read
+// without blocking, and answered once their request has arrived.
+class MetricsExporter
+{
+public:
+    bool listen(unsigned short port)
+    {
+        listener.setBlocking(false);
+        return listener.listen(port, sf::IpAddress::LocalHost) == sf::Socket::Done;
+    }
+
+    // Accepts and answers scrapers; page() builds the response body when one is due
+    template <typename Page>
+    void poll(Page page)
+    {
+        for (;;)
+        {
+            auto socket = std::make_unique<sf::TcpSocket>();
+            if (listener.accept(*socket) != sf::Socket::Done)
+                break;
+            socket->setBlocking(false);
+            scrapers.push_back(Scraper{std::move(socket), std::string(), sf::Clock()});
+        }
+
+        for (auto it = scrapers.begin(); it != scrapers.end();)
+        {
+            char buffer[1024];
+            std::size_t received = 0;
+            sf::Socket::Status status;
+            while ((status = it->socket->receive(buffer, sizeof(buffer), received)) == sf::Socket::Done)
+                it->request.append(buffer, received);
+
+            if (it->request.find("\r\n\r\n") != std::string::npos)
+            {
+                std::string body = page();
+                std::string response = "HTTP/1.1 200 OK\r\n"
+                                       "Content-Type: text/plain; version=0.0.4\r\n"
+                                       "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                                       "Connection: close\r\n\r\n" + body;
+                // A few kilobytes over loopback; blocking here costs next to nothing
+                it->socket->setBlocking(true);
+                it->socket->send(response.data(), response.size());
+                it->socket->disconnect();
+                it = scrapers.erase(it);
+            }
+            else if (status == sf::Socket::Disconnected || status == sf::Socket::Error ||
+                     it->connected.getElapsedTime().asSeconds() > METRICS_SCRAPE_TIMEOUT)
+            {
+                it = scrapers.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    // One metric with its HELP and TYPE lines
+    static void write(std::string &page, const std::string &name, const char *type, const char *help, double value)
+    {
+        page += "# HELP " + name + " " + help + "\n# TYPE " + name + " " + type + "\n" + name + " " +
+                formatValue(value) + "\n";
+    }
+
+    static void write(std::string &page, const std::string &name, const char *help, const Histogram &histogram)
+    {
+        page += "# HELP " + name + " " + help + "\n# TYPE " + name + " histogram\n";
+        for (std::size_t i = 0; i < histogram.counts.size(); ++i)
+        {
+            std::string bound = i < histogram.bounds.size() ? formatValue(histogram.bounds[i]) : "+Inf";
+            page += name + "_bucket{le=\"" + bound + "\"} " + std::to_string(histogram.counts[i]) + "\n";
+        }
+        page += name + "_sum " + formatValue(histogram.sum) + "\n" + name + "_count " +
+                std::to_string(histogram.counts.back()) + "\n";
+    }
+
+private:
+    struct Scraper
+    {
+        std::unique_ptr<sf::TcpSocket> socket;
+        std::string request;
+        sf::Clock connected;
+    };
+
+    sf::TcpListener listener;
+    std::vector<Scraper> scrapers;
+
+    static std::string formatValue(double value)
+    {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%.9g", value);
+        return text;
+    }
+};
+
+// The atlas texture, generated at startup: one row of white tiles (see
+// AtlasTile) with just enough shading to read as dots, bullets, players and
+// material grain once tinted
+class TextureAtlas
+{
+public:
+    bool create()
+    {
+        const int tiles = static_cast<int>(AtlasTile::FirstMaterial) + static_cast<int>(Material::Count) - 1;
+        sf::Image image;
+        image.create(tiles * ATLAS_TILE, ATLAS_TILE, sf::Color::White);
+        const float center = (ATLAS_TILE - 1) / 2.f;
+        for (int y = 0; y < ATLAS_TILE; ++y)
+        {
+            for (int x = 0; x < ATLAS_TILE; ++x)
+            {
+                float distance = std::sqrt((x - center) * (x - center) + (y - center) * (y - center)) / (ATLAS_TILE / 2.f);
+                float fade = std::max(0.f, 1.f - distance);
+                setTexel(image, AtlasTile::Particle, x, y, sf::Color(255, 255, 255, static_cast<sf::Uint8>(255 * std::min(fade * 2.f, 1.f))));
+                sf::Uint8 core = static_cast<sf::Uint8>(255 - 80 * std::min(distance, 1.f));
+                setTexel(image, AtlasTile::Bullet, x, y, sf::Color(255, 255, core, distance < 1.f ? 255 : 0));
+                bool rim = x < 2 || y < 2 || x >= ATLAS_TILE - 2 || y >= ATLAS_TILE - 2;
+                setTexel(image, AtlasTile::Player, x, y, rim ? sf::Color(170, 170, 170) : sf::Color::White);
+            }
+        }
+
+        // Grain: hashed noise, with streaks along the grain of wood and grass
+        for (int m = static_cast<int>(Material::Stone); m < static_cast<int>(Material::Count); ++m)
+        {
+            Material material = static_cast<Material>(m);
+            AtlasTile tile = static_cast<AtlasTile>(static_cast<int>(AtlasTile::FirstMaterial) + m - 1);
+            for (int y = 0; y < ATLAS_TILE; ++y)
+            {
+                for (int x = 0; x < ATLAS_TILE; ++x)
+                {
+                    sf::Uint32 hash = (x * 73856093u) ^ (y * 19349663u) ^ (m * 83492791u);
+                    hash = (hash ^ (hash >> 13)) * 0x5bd1e995u;
+                    int noise = static_cast<int>((hash ^ (hash >> 15)) & 31);
+                    if (material == Material::Wood)
+                        noise = (y % 5 == 0 ? 40 : 0) + noise / 2;
+                    else if (material == Material::Grass)
+                        noise = (x % 3 == 0 ? 30 : 0) + noise / 2;
+                    sf::Uint8 shade = static_cast<sf::Uint8>(255 - noise);
+                    setTexel(image, tile, x, y, sf::Color(shade, shade, shade));
+                }
+            }
+        }
+
+        if (!texture.loadFromImage(image))
+            return false;
+        texture.setSmooth(false); // Cells sample exact texels
+        return true;
+    }
+
+    const sf::Texture &getTexture() const { return texture; }
+
+private:
+    sf::Texture texture;
+
+    static void setTexel(sf::Image &image, AtlasTile tile, int x, int y, const sf::Color &color)
+    {
+        image.setPixel(static_cast<int>(tile) * ATLAS_TILE + x, y, color);
+    }
+};
+
+// Quads sharing one texture, collected over a frame and drawn in one call.
+// The vertex buffer only ever grows, so adding a sprite is writing its four
+// vertices in place.
+class SpriteBatch
+{
+public:
+    void clear() { count = 0; }
+    std::size_t getSpriteCount() const { return count / 4; }
+
+    void add(const sf::FloatRect &bounds, const sf::FloatRect &texture, const sf::Color &color)
+    {
+        if (count + 4 > vertices.size())
+            vertices.resize(std::max<std::size_t>(vertices.size() * 2, 1024));
+
+        float right = bounds.left + bounds.width, bottom = bounds.top + bounds.height;
+        float textureRight = texture.left + texture.width, textureBottom = texture.top + texture.height;
+        sf::Vertex *quad = &vertices[count];
+        quad[0].position = sf::Vector2f(bounds.left, bounds.top);
+        quad[0].texCoords = sf::Vector2f(texture.left, texture.top);
+        quad[1].position = sf::Vector2f(right, bounds.top);
+        quad[1].texCoords = sf::Vector2f(textureRight, texture.top);
+        quad[2].position = sf::Vector2f(right, bottom);
+        quad[2].texCoords = sf::Vector2f(textureRight, textureBottom);
+        quad[3].position = sf::Vector2f(bounds.left, bottom);
+        quad[3].texCoords = sf::Vector2f(texture.left, textureBottom);
+        quad[0].color = quad[1].color = quad[2].color = quad[3].color = color;
+        count += 4;
+    }
+
+    // Returns the number of draw calls made, 0 or 1
+    int draw(sf::RenderTarget &target, const sf::Texture &texture) const
+    {
+        if (count == 0)
+            return 0;
+        target.draw(vertices.data(), count, sf::Quads, sf::RenderStates(&texture));
+        return 1;
+    }
+
+private:
+    std::vector<sf::Vertex> vertices;
+    std::size_t count = 0; // Vertices in use
+};
+
+// Printable ASCII of one font at one size, rasterized once up front into the
+// font's glyph texture. Strings then become quads in a SpriteBatch, so any
+// number of changing labels is one draw and no sf::Text rebuilds. Other
+// characters are skipped; there is no kerning.
+class GlyphCache
+{
+public:
+    bool load(const sf::Font &font, unsigned characterSize)
+    {
+        this->font = &font;
+        size = characterSize;
+        for (int i = 0; i < GLYPH_COUNT; ++i)
+        {
+            const sf::Glyph &glyph = font.getGlyph(FIRST_GLYPH + i, characterSize, false);
+            glyphs[i].bounds = glyph.bounds;
+            glyphs[i].texture = sf::FloatRect(glyph.textureRect);
+            glyphs[i].advance = glyph.advance;
+        }
+        lineSpacing = font.getLineSpacing(characterSize);
+        return lineSpacing > 0.f;
+    }
+
+    // Holds every cached glyph; stays valid as long as nothing else asks the font for new ones at this size
+    const sf::Texture &getTexture() const { return font->getTexture(size); }
+    float getLineSpacing() const { return lineSpacing; }
+
+    // Appends text with its first line's top-left at position (lines split at '\n'); returns the widest line
+    float addText(SpriteBatch &batch, const std::string &text, const sf::Vector2f &position,
+                  const sf::Color &color) const
+    {
+        sf::Vector2f pen(position.x, position.y + size); // On the baseline
+        float width = 0.f;
+        for (char character : text)
+        {
+            if (character == '\n')
+            {
+                pen = sf::Vector2f(position.x, pen.y + lineSpacing);
+                continue;
+            }
+            int index = static_cast<unsigned char>(character) - FIRST_GLYPH;
+            if (index < 0 || index >= GLYPH_COUNT)
+                continue;
+            const Glyph &glyph = glyphs[index];
+            if (glyph.texture.width > 0)
+            {
+                batch.add(sf::FloatRect(pen.x + glyph.bounds.left, pen.y + glyph.bounds.top, glyph.bounds.width,
+                                        glyph.bounds.height),
+                          glyph.texture, color);
+            }
+            pen.x += glyph.advance;
+            width = std::max(width, pen.x - position.x);
+        }
+        return width;
+    }
+
+private:
+    static const int FIRST_GLYPH = 32;
+    static const int GLYPH_COUNT = 127 - FIRST_GLYPH;
+
+    struct Glyph
+    {
+        sf::FloatRect bounds; // Relative to the pen on the baseline
+        sf::FloatRect texture;
+        float advance = 0.f;
+    };
+
+    const sf::Font *font = nullptr;
+    unsigned size = 0;
+    Glyph glyphs[GLYPH_COUNT];
+    float lineSpacing = 0.f;
+};
+
+class Game
+{
+private:
+    sf::RenderWindow window;
+    Simulation simulation;
+    std::unique_ptr<Client> client; // Null in local play
+    PlayerInput input;
+    sf::Uint8 localPlayerId = 0;
+    float tickAccumulator = 0.f;
+    SimulationSnapshot quickSave;
+    bool hasQuickSave = false;
+    EditJournal journal;
+    bool pendingStrokeEnd = false;
+    std::unique_ptr<AutosaveWriter> autosave; // Local play only
+    float autosaveTimer = 0.f;
+    sf::Font font;
+    GlyphCache overlayGlyphs;
+    SpriteBatch overlaySprites; // HUD and debug labels, rebuilt every frame
+    bool showStats = true;
+    bool showChunkStats = false; // Per-chunk and per-object labels
+    std::unique_ptr<MetricsExporter> metrics; // Only with --metrics
+    std::unique_ptr<PhaseProfiler> profiler;  // Only with --profile
+    Histogram frameHistogram{{0.004, 0.008, 0.0167, 0.0333, 0.05, 0.1, 0.25, 1.0}}; // Seconds
+    sf::Uint64 frameCount = 0;
+    int drawCalls = 0;                  // Last frame
+    sf::Uint64 frameAllocations = 0;    // Last frame
+    sf::Uint64 lastAllocationCount = 0;
+    float cpuUtilization = 0.f;         // Share of all hardware threads busy over the last second
+    std::clock_t lastCpuClock = std::clock();
+    sf::Clock utilizationClock;
+    float frameTime = 0.f; // Smoothed, seconds
+    std::unique_ptr<FramePacer> pacer; // Adaptive pacing only
+    FrameTimeStats sessionFrames;
+    FrameTimeStats recentFrames;        // Since the last second began
+    float frameDeviation = 0.f;         // Over the last second, seconds
+    sf::Shader backgroundShader;
+    sf::Shader glowShader;
+    sf::RenderTexture bulletLayer;
+    sf::Clock shaderClock;
+    sf::VertexArray voxelVertices{sf::Quads};
+    sf::Uint32 renderedVoxelRevision = 0;
+    sf::VertexArray fluidVertices{sf::Quads};
+    sf::Uint32 renderedFluidRevision = 0;
+    TextureAtlas atlas;
+    SpriteBatch fireSprites;   // Rebuilt every frame from the warm cells
+    SpriteBatch bulletSprites;
+    SpriteBatch objectSprites; // Particles and players
+    VisibilityPolygon visibility;             // Around the local player
+    sf::VertexArray visibilityFan{sf::TriangleFan};
+    sf::RenderTexture fogLayer;
+    bool showFog = true;
+
+public:
+    Game(std::unique_ptr<Client> networkClient = nullptr)
+        : window(sf::VideoMode(WINDOW_WIDTH, WINDOW_HEIGHT), "2D Shooter"), client(std::move(networkClient))
+    {
+        window.setVerticalSyncEnabled(settings.pacing == "vsync");
+        window.setFramerateLimit(settings.pacing == "limit" ? settings.frameRateLimit : 0);
+        if (settings.pacing == "adaptive" && settings.frameRateLimit > 0)
+            pacer = std::make_unique<FramePacer>(settings.frameRateLimit);
+
+        // Initialize shaders
+        if (!sf::Shader::isAvailable())
+        {
+            throw std::runtime_error("Shaders are not available!");
+        }
+
+        if (!backgroundShader.loadFromFile("shaders/background.frag", sf::Shader::Fragment))
+        {
+            throw std::runtime_error("Could not load background shader!");
+        }
+
+        if (!glowShader.loadFromFile("shaders/glow.frag", sf::Shader::Fragment))
+        {
+            throw std::runtime_error("Could not load glow shader!");
+        }
+
+        if (!atlas.create())
+        {
+            throw std::runtime_error("Could not create texture atlas!");
+        }
+
+        // Initialize render texture for bullet layer, scaled down at lower glow quality
+        if (settings.glowQuality > 0)
+        {
+            int scale = 3 - settings.glowQuality;
+            bulletLayer.create(WINDOW_WIDTH / scale, WINDOW_HEIGHT / scale);
+            bulletLayer.setSmooth(scale > 1);
+            bulletLayer.setView(sf::View(sf::FloatRect(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT)));
+        }
+        fogLayer.create(WINDOW_WIDTH, WINDOW_HEIGHT);
+
+        // Set shader parameters
+        backgroundShader.setUniform("resolution", sf::Vector2f(WINDOW_WIDTH, WINDOW_HEIGHT));
+        glowShader.setUniform("glowStrength", settings.glowStrength);
+
+        if (!font.loadFromFile("arial.ttf"))
+        {
+            throw std::runtime_error("Could not load font!");
+        }
+        if (!overlayGlyphs.load(font, 12))
+        {
+            throw std::runtime_error("Could not rasterize font!");
+        }
+
+        if (!client)
+        {
+            simulation.addPlayer(localPlayerId);
+            simulation.journal = &journal;
+
+            // Pick up where the last session left off
+            if (!AutosaveWriter::load(AUTOSAVE_PATH, simulation.voxels))
+            {
+                simulation.voxels = VoxelGrid(GRID_WIDTH, GRID_HEIGHT);
+            }
+            autosave = std::make_unique<AutosaveWriter>(AUTOSAVE_PATH);
+        }
+    }
+
+    void run()
+    {
+        sf::Clock clock;
+
+        while (window.isOpen())
+        {
+            // Waiting before the events keeps input as fresh as the pacing allows
+            if (pacer)
+            {
+                ProfileScope scope(profiler.get(), "pacing");
+                pacer->wait();
+            }
+            sf::Time deltaTime = clock.restart();
+            frameTime += (deltaTime.asSeconds() - frameTime) * 0.05f;
+            {
+                ProfileScope scope(profiler.get(), "events");
+                handleEvents();
+            }
+            update(deltaTime.asSeconds());
+            render();
+            countFrame(deltaTime.asSeconds());
+            if (profiler && profiler->endFrame() >= PROFILE_REPORT_FRAMES)
+                profiler->report(std::cout);
+            if (metrics)
+                metrics->poll([this]() { return metricsPage(); });
+
+            // The frame only hands over a copy-on-write grid; the writer thread does the rest
+            autosaveTimer += deltaTime.asSeconds();
+            if (autosave && autosaveTimer >= AUTOSAVE_INTERVAL)
+            {
+                autosave->submit(simulation.voxels);
+                autosaveTimer = 0.f;
+            }
+        }
+
+        bool limited = (settings.pacing == "limit" || settings.pacing == "adaptive") && settings.frameRateLimit > 0;
+        std::cout << "pacing " << settings.pacing
+                  << (limited ? " at " + std::to_string(settings.frameRateLimit) + " fps" : std::string()) << ": "
+                  << sessionFrames.count
+                  << " frames, mean " << sessionFrames.mean * 1000.0 << " ms, deviation "
+                  << sessionFrames.deviation() * 1000.0 << " ms, longest " << sessionFrames.longest * 1000.0 << " ms"
+                  << std::endl;
+
+        // Final save on exit; the writer finishes it before shutting down
+        if (autosave)
+            autosave->submit(simulation.voxels);
+    }
+
+    // Prints per-phase wall time and hardware counters every PROFILE_REPORT_FRAMES frames
+    void enableProfiler()
+    {
+        profiler = std::make_unique<PhaseProfiler>();
+        simulation.profiler = profiler.get();
+    }
+
+    // Serves metricsPage() on a loopback port; false if the port can't be bound
+    bool enableMetrics(unsigned short port)
+    {
+        metrics = std::make_unique<MetricsExporter>();
+        if (metrics->listen(port))
+            return true;
+        metrics.reset();
+        return false;
+    }
+
+    // Replaces the local world with an image, one pixel per voxel cell
+    bool importWorld(const std::string &path)
+    {
+        sf::Image image;
+        if (client || !image.loadFromFile(path))
+            return false;
+
+        importImage(image, simulation.voxels, IMPORT_ALPHA_THRESHOLD, workerThreads());
+        journal.clear();
+        wakeAllFluid();
+        return true;
+    }
+
+    // Replaces the local world with procedurally generated terrain
+    void generateWorld(sf::Uint32 seed)
+    {
+        if (client)
+            return;
+
+        generateTerrain(simulation.voxels, seed, workerThreads());
+        journal.clear();
+        wakeAllFluid();
+    }
+
+private:
+    void handleEvents()
+    {
+        sf::Event event;
+        while (window.pollEvent(event))
+        {
+            if (event.type == sf::Event::Closed)
+                window.close();
+
+            // Fog of war and per-chunk labels
+            if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F4)
+            {
+                showFog = !showFog;
+            }
+            if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F6)
+            {
+                showChunkStats = !showChunkStats;
+            }
+
+            // Quick-save/quick-load, undo/redo and editor tools, local play only
+            if (event.type == sf::Event::KeyPressed && !client)
+            {
+                if (event.key.code == sf::Keyboard::F3)
+                {
+                    showStats = !showStats;
+                }
+                else if (event.key.code == sf::Keyboard::F5)
+                {
+                    simulation.saveSnapshot(quickSave);
+                    hasQuickSave = true;
+                }
+                else if (event.key.code == sf::Keyboard::F9 && hasQuickSave)
+                {
+                    simulation.restoreSnapshot(quickSave);
+                    journal.clear(); // Recorded edits no longer match the grid
+                    visibility.invalidate();
+                }
+                else if (event.key.code == sf::Keyboard::G)
+                {
+                    journal.commit(); // Don't fold into an unfinished brush stroke
+                    simulation.growVoxels(1, Material::Stone);
+                }
+                else if (event.key.code == sf::Keyboard::E)
+                {
+                    journal.commit();
+                    simulation.shrinkVoxels(1);
+                }
+                else if (event.key.code == sf::Keyboard::Delete)
+                {
+                    sf::Vector2i mouse = sf::Mouse::getPosition(window);
+                    journal.commit();
+                    simulation.removeConnected(mouse.x / VOXEL_SIZE, mouse.y / VOXEL_SIZE);
+                }
+                else if (event.key.control && event.key.code == sf::Keyboard::Z && !event.key.shift)
+                {
+                    journal.undo(simulation.voxels);
+                    simulation.bodies.clear(); // Debris in flight belongs to the undone history
+                    wakeAllFluid();
+                }
+                else if (event.key.control && (event.key.code == sf::Keyboard::Y ||
+                                               (event.key.code == sf::Keyboard::Z && event.key.shift)))
+                {
+                    journal.redo(simulation.voxels);
+                    simulation.bodies.clear();
+                    wakeAllFluid();
+                }
+            }
+
+            if (event.type == sf::Event::MouseButtonPressed)
+            {
+                if (event.mouseButton.button == sf::Mouse::Left)
+                {
+                    input.drawing = true;
+                }
+            }
+            if (event.type == sf::Event::MouseButtonReleased)
+            {
+                if (event.mouseButton.button == sf::Mouse::Left)
+                {
+                    input.drawing = false;
+                    pendingStrokeEnd = true;
+                }
+            }
+            if (event.type == sf::Event::MouseButtonPressed)
+            {
+                if (event.mouseButton.button == sf::Mouse::Right)
+                {
+                    // Shoot bullet
+                    ++input.fireCount;
+                }
+            }
+        }
+
+        // Continuous state for this frame
+        sf::Vector2i mousePos = sf::Mouse::getPosition(window);
+        input.aim = sf::Vector2f(mousePos.x, mousePos.y);
+
+        if (sf::Keyboard::isKeyPressed(sf::Keyboard::A))
+            input.moveX = -1;
+        else if (sf::Keyboard::isKeyPressed(sf::Keyboard::D))
+            input.moveX = 1;
+        else
+            input.moveX = 0;
+
+        input.jump = sf::Keyboard::isKeyPressed(sf::Keyboard::Space);
+
+        // Pouring water and lava, local play only
+        if (!client && window.hasFocus())
+        {
+            if (sf::Keyboard::isKeyPressed(sf::Keyboard::Q))
+                simulation.pourFluid(input.aim, Fluid::Water);
+            else if (sf::Keyboard::isKeyPressed(sf::Keyboard::L))
+                simulation.pourFluid(input.aim, Fluid::Lava);
+        }
+    }
+
+    void countFrame(float deltaTime)
+    {
+        frameHistogram.observe(deltaTime);
+        // The first frame includes startup
+        if (++frameCount > 1)
+        {
+            sessionFrames.observe(deltaTime);
+            recentFrames.observe(deltaTime);
+        }
+        sf::Uint64 allocations = allocationCount.load(std::memory_order_relaxed);
+        frameAllocations = allocations - lastAllocationCount;
+        lastAllocationCount = allocations;
+
+        // std::clock is CPU time of the whole process, all threads together
+        float elapsed = utilizationClock.getElapsedTime().asSeconds();
+        if (elapsed >= 1.f)
+        {
+            std::clock_t cpuClock = std::clock();
+            float cpuSeconds = static_cast<float>(cpuClock - lastCpuClock) / CLOCKS_PER_SEC;
+            cpuUtilization = cpuSeconds / elapsed / std::max(std::thread::hardware_concurrency(), 1u);
+            lastCpuClock = cpuClock;
+            frameDeviation = static_cast<float>(recentFrames.deviation());
+            recentFrames = FrameTimeStats();
+            utilizationClock.restart();
+        }
+    }
+
+    std::string metricsPage() const
+    {
+        std::string page;
+        MetricsExporter::write(page, "game_frame_seconds", "Frame time", frameHistogram);
+        MetricsExporter::write(page, "game_frames_total", "counter", "Frames rendered", static_cast<double>(frameCount));
+        MetricsExporter::write(page, "game_frame_deviation_seconds", "gauge",
+                               "Standard deviation of frame time over the last second", frameDeviation);
+        MetricsExporter::write(page, "game_voxels", "gauge", "Solid voxel cells",
+                               static_cast<double>(simulation.voxels.getCount()));
+        MetricsExporter::write(page, "game_particles", "gauge", "Live particles",
+                               static_cast<double>(simulation.particles.size()));
+        MetricsExporter::write(page, "game_bullets", "gauge", "Live bullets", static_cast<double>(simulation.bullets.size()));
+        MetricsExporter::write(page, "game_bodies", "gauge", "Debris bodies in flight",
+                               static_cast<double>(simulation.bodies.size()));
+        MetricsExporter::write(page, "game_fluid_active_chunks", "gauge", "Chunks with moving fluid",
+                               simulation.fluid.getActiveChunkCount());
+        MetricsExporter::write(page, "game_warm_cells", "gauge", "Cells tracked by the fire simulation",
+                               static_cast<double>(simulation.heat.getActiveCells().size()));
+        MetricsExporter::write(page, "game_draw_calls", "gauge", "Draw calls in the last frame", drawCalls);
+        MetricsExporter::write(page, "game_allocations_total", "counter", "Heap allocations since startup",
+                               static_cast<double>(allocationCount.load(std::memory_order_relaxed)));
+        MetricsExporter::write(page, "game_frame_allocations", "gauge", "Heap allocations in the last frame",
+                               static_cast<double>(frameAllocations));
+        MetricsExporter::write(page, "process_cpu_seconds_total", "counter", "CPU time of all threads",
+                               static_cast<double>(std::clock()) / CLOCKS_PER_SEC);
+        MetricsExporter::write(page, "game_cpu_utilization", "gauge",
+                               "Share of all hardware threads busy over the last second", cpuUtilization);
+        MetricsExporter::write(page, "game_hardware_threads", "gauge", "Hardware threads",
+                               std::max(std::thread::hardware_concurrency(), 1u));
+        if (autosave)
+        {
+            MetricsExporter::write(page, "game_autosaves_total", "counter", "Background saves written",
+                                   autosave->saveCount.load());
+            MetricsExporter::write(page, "game_autosave_seconds", "gauge", "Duration of the last background save",
+                                   autosave->lastDurationUs.load() / 1e6);
+        }
+        return page;
+    }
+
+    // The grid changed behind the simulation's back; let all fluid settle again
+    void wakeAllFluid()
+    {
+        simulation.fluid.wake(0, 0, simulation.voxels.getWidth() - 1, simulation.voxels.getHeight() - 1);
+    }
+
+    void update(float deltaTime)
+    {
+        ProfileScope scope(profiler.get(), "update");
+        if (client)
+        {
+            // Inputs go out at the server tick rate so each one is predicted
+            // with exactly the step the server will simulate it with
+            const float tickTime = 1.f / settings.tickRate;
+            tickAccumulator = std::min(tickAccumulator + deltaTime, tickTime * 5);
+            while (tickAccumulator >= tickTime)
+            {
+                client->sendInput(input, &simulation);
+                tickAccumulator -= tickTime;
+            }
+
+            client->receive(&simulation);
+            localPlayerId = client->playerId;
+            simulation.updateEffects(deltaTime);
+        }
+        else
+        {
+            if (Player *player = simulation.findPlayer(localPlayerId))
+            {
+                player->input = input;
+            }
+            simulation.update(deltaTime);
+
+            // A brush stroke is one undo step, from button press to release
+            if (pendingStrokeEnd)
+            {
+                journal.commit();
+                pendingStrokeEnd = false;
+            }
+        }
+    }
+
+    void renderStats()
+    {
+        std::string text = "frame " + std::to_string(frameTime * 1000.f).substr(0, 5) + " ms +-" +
+                           std::to_string(frameDeviation * 1000.f).substr(0, 5) + " (" + settings.pacing + ")" +
+                           "  voxels " + std::to_string(simulation.voxels.getCount()) +
+                           "  particles " + std::to_string(simulation.particles.size()) +
+                           "  bullets " + std::to_string(simulation.bullets.size()) +
+                           "  fluid chunks " + std::to_string(simulation.fluid.getActiveChunkCount()) +
+                           "  warm cells " + std::to_string(simulation.heat.getActiveCells().size()) +
+                           "\ndraws " + std::to_string(drawCalls) +
+                           "  allocations " + std::to_string(frameAllocations) +
+                           "  cpu " + std::to_string(static_cast<int>(cpuUtilization * 100.f)) + "%";
+        if (showFog)
+        {
+            text += "  sight rays " + std::to_string(visibility.getRayCount()) +
+                    "  edge chunks rebuilt " + std::to_string(visibility.getRebuiltChunks());
+        }
+        if (autosave)
+        {
+            text += "\nautosave #" + std::to_string(autosave->saveCount.load()) +
+                    "  " + std::to_string(autosave->lastDurationUs.load() / 1000.f).substr(0, 5) + " ms" +
+                    "  " + std::to_string(autosave->lastBytesWritten.load()) + " bytes" +
+                    "  " + std::to_string(autosave->lastChunksEncoded.load()) + " chunks encoded";
+        }
+        overlaySprites.clear();
+        if (showStats)
+        {
+            overlayGlyphs.addText(overlaySprites, text, sf::Vector2f(6.f, 4.f), sf::Color::White);
+        }
+        if (showChunkStats)
+        {
+            addChunkLabels();
+        }
+
+        // Overlay ignores screen shake
+        window.setView(window.getDefaultView());
+        drawCalls += overlaySprites.draw(window, overlayGlyphs.getTexture());
+    }
+
+    // Solid cells, revision and fluid of every chunk, and a tag on every player and piece of debris
+    void addChunkLabels()
+    {
+        const VoxelGrid &grid = simulation.voxels;
+        const sf::Color chunkColor(255, 255, 160, 200);
+        for (int chunk = 0; chunk < grid.getChunkCount(); ++chunk)
+        {
+            int x, y;
+            grid.chunkOrigin(chunk, x, y);
+            std::string label = "#" + std::to_string(chunk) + " solid " + std::to_string(grid.getChunkSolidCount(chunk)) +
+                                "\nrev " + std::to_string(grid.getChunkRevision(chunk)) +
+                                (simulation.fluid.isChunkEmpty(chunk) ? "" : "  fluid");
+            overlayGlyphs.addText(overlaySprites, label, sf::Vector2f(x * VOXEL_SIZE + 2.f, y * VOXEL_SIZE + 2.f),
+                                  chunkColor);
+        }
+        for (const auto &player : simulation.players)
+        {
+            overlayGlyphs.addText(overlaySprites, "player " + std::to_string(player.id),
+                                  player.shape.getPosition() - sf::Vector2f(0.f, overlayGlyphs.getLineSpacing()),
+                                  sf::Color::White);
+        }
+        for (const auto &body : simulation.bodies)
+        {
+            overlayGlyphs.addText(overlaySprites, std::to_string(body.cells.size()) + " cells", body.position,
+                                  sf::Color(200, 200, 255));
+        }
+    }
+
+    void rebuildVoxelVertices()
+    {
+        const VoxelGrid &grid = simulation.voxels;
+        voxelVertices.clear();
+
+        for (int y = 0; y < grid.getHeight(); ++y)
+        {
+            for (int x = 0; x < grid.getWidth(); ++x)
+            {
+                Material material = grid.get(x, y);
+                if (material == Material::Empty)
+                    continue;
+
+                appendQuad(voxelVertices,
+                           sf::FloatRect(static_cast<float>(x * VOXEL_SIZE), static_cast<float>(y * VOXEL_SIZE),
+                                         VOXEL_SIZE, VOXEL_SIZE),
+                           materialTexture(material, x, y), materialColor(material));
+            }
+        }
+        renderedVoxelRevision = grid.getRevision();
+    }
+
+    // One quad per wet cell, as high as the cell is full unless more fluid sits on top
+    void rebuildFluidVertices()
+    {
+        const FluidLayer &fluid = simulation.fluid;
+        const int chunksX = (fluid.getWidth() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        const int chunksY = (fluid.getHeight() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        fluidVertices.clear();
+
+        for (int chunk = 0; chunk < chunksX * chunksY; ++chunk)
+        {
+            if (fluid.isChunkEmpty(chunk))
+                continue;
+            int originX = (chunk % chunksX) * CHUNK_SIZE, originY = (chunk / chunksX) * CHUNK_SIZE;
+            for (int y = originY; y < std::min(originY + CHUNK_SIZE, fluid.getHeight()); ++y)
+            {
+                for (int x = originX; x < std::min(originX + CHUNK_SIZE, fluid.getWidth()); ++x)
+                {
+                    sf::Uint8 level = fluid.getLevel(x, y);
+                    if (level == 0)
+                        continue;
+
+                    sf::Color color = fluid.getKind(x, y) == Fluid::Lava ? sf::Color(255, 100, 30, 230)
+                                                                          : sf::Color(50, 110, 230, 170);
+                    float fill = fluid.getLevel(x, y - 1) > 0 ? 1.f : level / 255.f;
+                    float left = static_cast<float>(x * VOXEL_SIZE);
+                    float bottom = static_cast<float>((y + 1) * VOXEL_SIZE);
+                    float top = bottom - fill * VOXEL_SIZE;
+                    appendQuad(fluidVertices, sf::FloatRect(left, top, VOXEL_SIZE, bottom - top),
+                               atlasTile(AtlasTile::White), color);
+                }
+            }
+        }
+        renderedFluidRevision = fluid.getRevision();
+    }
+
+    // One glowing quad per warm cell, redder and more opaque the hotter it is
+    void rebuildFireVertices()
+    {
+        const HeatField &heat = simulation.heat;
+        fireSprites.clear();
+        for (int cell : heat.getActiveCells())
+        {
+            int temperature = heat.getCellTemperature(cell);
+            sf::Color color(255, static_cast<sf::Uint8>(220 - temperature * 180 / 255),
+                            0, static_cast<sf::Uint8>(std::min(temperature * 2, 230)));
+            float left = static_cast<float>((cell % heat.getWidth()) * VOXEL_SIZE);
+            float top = static_cast<float>((cell / heat.getWidth()) * VOXEL_SIZE);
+            fireSprites.add(sf::FloatRect(left, top, VOXEL_SIZE, VOXEL_SIZE), atlasTile(AtlasTile::White), color);
+        }
+    }
+
+    // Darkens everything the local player can't see: the fog layer is cleared
+    // through the visibility polygon, one triangle fan from the eye
+    void renderFog()
+    {
+        const Player *player = simulation.findPlayer(localPlayerId);
+        if (!player)
+            return;
+        sf::Vector2f eye = player->shape.getPosition() + player->shape.getSize() / 2.f;
+        visibility.compute(simulation.voxels, simulation.distanceField, eye, VISIBILITY_RADIUS);
+
+        const sf::Color clear = sf::Color::Transparent;
+        visibilityFan.clear();
+        visibilityFan.append(sf::Vertex(eye, clear));
+        for (const sf::Vector2f &point : visibility.getPoints())
+            visibilityFan.append(sf::Vertex(point, clear));
+        if (!visibility.getPoints().empty())
+            visibilityFan.append(sf::Vertex(visibility.getPoints().front(), clear));
+
+        fogLayer.clear(sf::Color(0, 0, 0, 200));
+        fogLayer.draw(visibilityFan, sf::RenderStates(sf::BlendNone));
+        fogLayer.display();
+        window.draw(sf::Sprite(fogLayer.getTexture()));
+        drawCalls += 2;
+    }
+
+    void render()
+    {
+        ProfileScope scope(profiler.get(), "render");
+
+        // Clear all layers
+        window.clear();
+        if (settings.glowQuality > 0)
+            bulletLayer.clear(sf::Color::Transparent);
+
+        // Update background shader time
+        backgroundShader.setUniform("time", shaderClock.getElapsedTime().asSeconds());
+
+        // Draw background with shader
+        sf::RectangleShape background(sf::Vector2f(WINDOW_WIDTH, WINDOW_HEIGHT));
+        window.draw(background, &backgroundShader);
+        drawCalls = 1;
+
+        // Apply screen shake to view
+        sf::View view = window.getDefaultView();
+        view.move(simulation.screenShakeOffset);
+        window.setView(view);
+
+        // Everything below is drawn from the atlas, one draw per layer
+        const sf::Texture &atlasTexture = atlas.getTexture();
+
+        // Draw voxels
+        {
+            ProfileScope voxelScope(profiler.get(), "draw voxels");
+            if (simulation.voxels.getRevision() != renderedVoxelRevision)
+            {
+                rebuildVoxelVertices();
+            }
+            window.draw(voxelVertices, sf::RenderStates(&atlasTexture));
+            ++drawCalls;
+        }
+
+        // Draw water and lava
+        {
+            ProfileScope fluidScope(profiler.get(), "draw fluid");
+            if (simulation.fluid.getRevision() != renderedFluidRevision)
+            {
+                rebuildFluidVertices();
+            }
+            window.draw(fluidVertices, sf::RenderStates(&atlasTexture));
+            ++drawCalls;
+        }
+
+        {
+            ProfileScope objectScope(profiler.get(), "draw objects");
+
+            // Draw fire over the burning cells
+            rebuildFireVertices();
+            drawCalls += fireSprites.draw(window, atlasTexture);
+
+            // Draw debris, each body's cached vertices moved into place
+            for (const auto &body : simulation.bodies)
+            {
+                sf::RenderStates states(body.getTransform());
+                states.texture = &atlasTexture;
+                window.draw(body.vertices, states);
+                ++drawCalls;
+            }
+
+            // Draw bullets to separate layer with glow shader
+            bulletSprites.clear();
+            for (const auto &bullet : simulation.bullets)
+            {
+                bulletSprites.add(sf::FloatRect(bullet.shape.getPosition(), bullet.shape.getSize()),
+                                  atlasTile(AtlasTile::Bullet), bullet.shape.getFillColor());
+            }
+            if (settings.glowQuality == 0)
+            {
+                drawCalls += bulletSprites.draw(window, atlasTexture);
+            }
+            else
+            {
+                drawCalls += bulletSprites.draw(bulletLayer, atlasTexture);
+                bulletLayer.display();
+
+                // Draw bullet layer with glow effect
+                sf::Sprite bulletSprite(bulletLayer.getTexture());
+                float scale = static_cast<float>(3 - settings.glowQuality);
+                bulletSprite.setScale(scale, scale);
+                window.draw(bulletSprite, &glowShader);
+                ++drawCalls;
+            }
+
+            // Draw particles, then players over them
+            objectSprites.clear();
+            for (const auto &particle : simulation.particles)
+            {
+                float diameter = particle.shape.getRadius() * 2.f;
+                objectSprites.add(sf::FloatRect(particle.shape.getPosition(), sf::Vector2f(diameter, diameter)),
+                                  atlasTile(AtlasTile::Particle), particle.shape.getFillColor());
+            }
+            for (const auto &player : simulation.players)
+            {
+                objectSprites.add(sf::FloatRect(player.shape.getPosition(), player.shape.getSize()),
+                                  atlasTile(AtlasTile::Player), player.shape.getFillColor());
+            }
+            drawCalls += objectSprites.draw(window, atlasTexture);
+        }
+
+        if (showFog)
+        {
+            ProfileScope fogScope(profiler.get(), "draw fog");
+            renderFog();
+        }
+
+        if (showStats || showChunkStats)
+        {
+            ProfileScope overlayScope(profiler.get(), "draw overlay");
+            renderStats();
+        }
+
+        // Waits for the driver and, with vsync, the display
+        ProfileScope displayScope(profiler.get(), "display");
+        window.display();
+    }
+};
+
+// Headless load-test client that wanders, paints and shoots at random.
+// Aggressive bots paint every tick and fire several shots a second.
+class BotClient
+{
+public:
+    Client client;
+
+    BotClient(const sf::IpAddress &serverAddress, unsigned short serverPort, bool aggressive)
+        : client(serverAddress, serverPort), aggressive(aggressive)
+    {
+        mirror.effectsEnabled = false;
+    }
+
+    void update(float deltaTime)
+    {
+        decisionTimer -= deltaTime;
+        if (decisionTimer <= 0)
+        {
+            decisionTimer = 0.5f + (rand() % 150) * 0.01f;
+            input.moveX = static_cast<sf::Int8>(rand() % 3 - 1);
+            input.drawing = aggressive || rand() % 3 == 0;
+            input.aim = sf::Vector2f(rand() % WINDOW_WIDTH, rand() % WINDOW_HEIGHT);
+        }
+
+        if (aggressive)
+        {
+            // Drag the brush around so every tick paints fresh cells
+            input.aim += sf::Vector2f(rand() % 21 - 10, rand() % 21 - 10);
+        }
+
+        input.jump = rand() % 30 == 0;
+        if (rand() % (aggressive ? 8 : 20) == 0)
+        {
+            ++input.fireCount;
+            input.aim = visibleTarget();
+        }
+
+        client.sendInput(input, &mirror);
+        client.receive(&mirror);
+    }
+
+private:
+    Simulation mirror;
+    PlayerInput input;
+    bool aggressive;
+    float decisionTimer = 0.f;
+    std::vector<Ray> sightRays;
+    std::vector<RayHit> sightHits;
+
+    // Center of the nearest other player in line of sight, or a random point
+    sf::Vector2f visibleTarget()
+    {
+        const Player *self = mirror.findPlayer(client.playerId);
+        sf::Vector2f target(rand() % WINDOW_WIDTH, rand() % WINDOW_HEIGHT);
+        if (!self)
+            return target;
+
+        // One batched ray per other player
+        sf::FloatRect bounds = self->shape.getGlobalBounds();
+        sf::Vector2f eye(bounds.left + bounds.width / 2, bounds.top + bounds.height / 2);
+        sightRays.clear();
+        for (const auto &player : mirror.players)
+        {
+            sf::FloatRect other = player.shape.getGlobalBounds();
+            sf::Vector2f center(other.left + other.width / 2, other.top + other.height / 2);
+            if (&player != self && center != eye)
+                sightRays.push_back(Ray{eye, normalize(center - eye), vectorLength(center - eye)});
+        }
+        mirror.raycast(sightRays, sightHits);
+
+        float nearest = std::numeric_limits<float>::max();
+        for (std::size_t i = 0; i < sightRays.size(); ++i)
+        {
+            if (!sightHits[i].hit && sightRays[i].maxDistance < nearest)
+            {
+                nearest = sightRays[i].maxDistance;
+                target = sightRays[i].origin + sightRays[i].direction * sightRays[i].maxDistance;
+            }
+        }
+        return target;
+    }
+};
+
+// Drives `count` bots at the server tick rate and prints per-client traffic every second
+void runBots(int count, const sf::IpAddress &address, unsigned short port, float duration, bool aggressive,
+             Server *localServer)
+{
+    std::vector<std::unique_ptr<BotClient>> bots;
+    for (int i = 0; i < count; ++i)
+    {
+        bots.push_back(std::make_unique<BotClient>(address, port, aggressive));
+    }
+
+    const sf::Time tickTime = sf::seconds(1.f / settings.tickRate);
+    sf::Clock total;
+    sf::Clock statsClock;
+    sf::Clock frameClock;
+
+    while (total.getElapsedTime().asSeconds() < duration)
+    {
+        float deltaTime = frameClock.restart().asSeconds();
+        for (auto &bot : bots)
+        {
+            bot->update(deltaTime);
+        }
+
+        if (statsClock.getElapsedTime() >= sf::seconds(1.f))
+        {
+            float interval = statsClock.restart().asSeconds();
+            std::size_t joined = 0, sent = 0, received = 0, voxelReceived = 0, snapshots = 0;
+            std::size_t reconciliations = 0, resimulatedTicks = 0;
+            sf::Time resimulationTime;
+            for (auto &bot : bots)
+            {
+                reconciliations += bot->client.reconciliations;
+                resimulatedTicks += bot->client.resimulatedTicks;
+                resimulationTime += bot->client.resimulationTime;
+                bot->client.reconciliations = 0;
+                bot->client.resimulatedTicks = 0;
+                bot->client.resimulationTime = sf::Time::Zero;
+                joined += bot->client.joined;
+                sent += bot->client.bytesSent;
+                received += bot->client.bytesReceived;
+                voxelReceived += bot->client.voxelBytesReceived;
+                snapshots += bot->client.snapshotsReceived;
+                bot->client.bytesSent = 0;
+                bot->client.bytesReceived = 0;
+                bot->client.voxelBytesReceived = 0;
+                bot->client.snapshotsReceived = 0;
+            }
+
+            std::cout << "bots: joined " << joined << "/" << count
+                      << " per client: in " << received / count / interval / 1024 << " KiB/s"
+                      << " (voxels " << voxelReceived / count / interval << " B/s)"
+                      << " out " << sent / count / interval << " B/s"
+                      << " snapshots " << snapshots / count / interval << "/s" << std::endl;
+            if (reconciliations > 0)
+            {
+                std::cout << "prediction: " << static_cast<float>(resimulatedTicks) / reconciliations
+                          << " ticks re-simulated per snapshot, "
+                          << resimulationTime.asMicroseconds() / static_cast<float>(reconciliations) << "us per rollback" << std::endl;
+            }
+            if (localServer)
+            {
+                std::cout << localServer->statsLine(interval) << std::endl;
+            }
+        }
+
+        sf::sleep(tickTime - frameClock.getElapsedTime());
+    }
+}
+
+// Times snapshot and restore of a 1024x1024-cell world with a busy entity load
+void runSnapshotBenchmark()
+{
+    const int size = 1024;
+    const int iterations = 1000;
+    Simulation simulation(size, size);
+
+    // Solid lower half with some caves, like a painted level
+    for (int y = size / 2; y < size; ++y)
+    {
+        for (int x = 0; x < size; ++x)
+        {
+            if ((x * 7 + y * 13) % 97 > 10)
+                simulation.voxels.set(x, y, Material::Stone);
+        }
+    }
+    for (int i = 0; i < 8; ++i)
+    {
+        simulation.addPlayer(static_cast<sf::Uint8>(i));
+    }
+    for (int i = 0; i < 500; ++i)
+    {
+        simulation.bullets.emplace_back(sf::Vector2f(i, i), sf::Vector2f(BULLET_SPEED, 0));
+    }
+    for (int i = 0; i < 250; ++i) // 5000 particles within the default budget
+    {
+        simulation.spawnExplosionEffects(sf::Vector2f(simulation.random(size * VOXEL_SIZE), 100.f));
+    }
+
+    SimulationSnapshot snapshot;
+    simulation.saveSnapshot(snapshot); // Warm up buffers
+
+    sf::Clock clock;
+    for (int i = 0; i < iterations; ++i)
+    {
+        simulation.saveSnapshot(snapshot);
+    }
+    float saveTime = clock.restart().asMicroseconds() / static_cast<float>(iterations);
+
+    for (int i = 0; i < iterations; ++i)
+    {
+        simulation.restoreSnapshot(snapshot);
+    }
+    float restoreTime = clock.restart().asMicroseconds() / static_cast<float>(iterations);
+
+    // Snapshot, then paint into a shared chunk: measures the copy-on-write clone
+    for (int i = 0; i < iterations; ++i)
+    {
+        simulation.saveSnapshot(snapshot);
+        simulation.voxels.set(i % size, (i * 31) % size, Material::Stone);
+    }
+    float saveAndEditTime = clock.restart().asMicroseconds() / static_cast<float>(iterations);
+
+    // Reference: what copying every cell would cost
+    std::vector<Material> flatCopy(static_cast<std::size_t>(simulation.voxels.getChunkCount()) * VoxelGrid::CHUNK_CELLS);
+    for (int i = 0; i < 100; ++i)
+    {
+        for (int chunk = 0; chunk < simulation.voxels.getChunkCount(); ++chunk)
+        {
+            std::memcpy(&flatCopy[static_cast<std::size_t>(chunk) * VoxelGrid::CHUNK_CELLS],
+                        simulation.voxels.getChunkCells(chunk), VoxelGrid::CHUNK_CELLS);
+        }
+    }
+    float deepCopyTime = clock.restart().asMicroseconds() / 100.f;
+
+    std::cout << "snapshot benchmark: " << size << "x" << size << " cells, " << simulation.voxels.getCount() << " solid, "
+              << simulation.bullets.size() << " bullets, " << simulation.particles.size() << " particles\n"
+              << "  save             " << saveTime << " us (" << snapshot.data.size() << " byte entity buffer)\n"
+              << "  restore          " << restoreTime << " us\n"
+              << "  save + 1 edit    " << saveAndEditTime << " us (one chunk cloned)\n"
+              << "  deep grid copy   " << deepCopyTime << " us (reference)" << std::endl;
+}
+
+// Times converting a size x size image into a voxel grid of the same size
+void runImportBenchmark(int size)
+{
+    // Terrain-like test image: transparent sky, colored bands below a wavy horizon
+    std::vector<sf::Uint8> pixels(static_cast<std::size_t>(size) * size * 4);
+    for (int y = 0; y < size; ++y)
+    {
+        for (int x = 0; x < size; ++x)
+        {
+            sf::Uint8 *pixel = &pixels[(static_cast<std::size_t>(y) * size + x) * 4];
+            int horizon = size / 3 + static_cast<int>(std::sin(x * 0.01f) * size / 10);
+            sf::Color color = y < horizon ? sf::Color::Transparent
+                                          : materialColor(static_cast<Material>(1 + (y - horizon) / 64 % 4));
+            pixel[0] = color.r;
+            pixel[1] = color.g;
+            pixel[2] = color.b;
+            pixel[3] = color.a;
+        }
+    }
+    sf::Image image;
+    image.create(size, size, pixels.data());
+
+    unsigned threads = workerThreads();
+    VoxelGrid grid(size, size);
+
+    sf::Clock clock;
+    importImage(image, grid, IMPORT_ALPHA_THRESHOLD, threads);
+    float firstTime = clock.restart().asSeconds() * 1000.f;
+    importImage(image, grid, IMPORT_ALPHA_THRESHOLD, threads);
+    float secondTime = clock.restart().asSeconds() * 1000.f;
+    importImage(image, grid, IMPORT_ALPHA_THRESHOLD, 1);
+    float singleThreadTime = clock.restart().asSeconds() * 1000.f;
+
+    // Reference: one set() call per pixel
+    VoxelGrid reference(size, size);
+    clock.restart();
+    for (int y = 0; y < size; ++y)
+    {
+        for (int x = 0; x < size; ++x)
+        {
+            sf::Color color = image.getPixel(x, y);
+            if (color.a > IMPORT_ALPHA_THRESHOLD)
+                reference.set(x, y, nearestMaterial(color));
+        }
+    }
+    float perCellTime = clock.restart().asSeconds() * 1000.f;
+
+    std::cout << "import benchmark: " << size << "x" << size << " image, " << grid.getCount() << " voxels, "
+              << threads << " threads\n"
+              << "  parallel, fresh grid     " << firstTime << " ms\n"
+              << "  parallel, existing grid  " << secondTime << " ms\n"
+              << "  one thread               " << singleThreadTime << " ms\n"
+              << "  per-cell set() calls     " << perCellTime << " ms (reference)" << std::endl;
+}
+
+// Times terrain generation of a width x height world and checks that single
+// chunks regenerate to identical contents
+void runGenerateBenchmark(int width, int height)
+{
+    const sf::Uint32 seed = 42;
+    unsigned threads = workerThreads();
+    VoxelGrid grid(width, height);
+
+    sf::Clock clock;
+    generateTerrain(grid, seed, threads);
+    float parallelTime = clock.restart().asSeconds() * 1000.f;
+
+    VoxelGrid serial(width, height);
+    clock.restart();
+    generateTerrain(serial, seed, 1);
+    float serialTime = clock.restart().asSeconds() * 1000.f;
+
+    // Regenerate every chunk on its own, on demand, and compare
+    TerrainGenerator generator(seed, height);
+    VoxelGrid regenerated(width, height);
+    for (int chunk = 0; chunk < regenerated.getChunkCount(); ++chunk)
+    {
+        regenerated.writeChunk(chunk, [&](int index, Material *cells) {
+            generator.generateChunk(regenerated, index, cells);
+        });
+    }
+    float onDemandTime = clock.restart().asSeconds() * 1000.f / regenerated.getChunkCount();
+
+    bool identical = true;
+    for (int chunk = 0; chunk < grid.getChunkCount(); ++chunk)
+    {
+        identical = identical &&
+                    std::memcmp(grid.getChunkCells(chunk), serial.getChunkCells(chunk), VoxelGrid::CHUNK_CELLS) == 0 &&
+                    std::memcmp(grid.getChunkCells(chunk), regenerated.getChunkCells(chunk), VoxelGrid::CHUNK_CELLS) == 0;
+    }
+
+    std::cout << "generate benchmark: " << width << "x" << height << " cells, " << grid.getChunkCount() << " chunks, "
+              << grid.getCount() << " solid, " << threads << " threads\n"
+              << "  parallel          " << parallelTime << " ms\n"
+              << "  one thread        " << serialTime << " ms\n"
+              << "  one chunk         " << onDemandTime * 1000.f << " us\n"
+              << "  deterministic     " << (identical ? "yes" : "NO") << std::endl;
+}
+
+// Times box-vs-world queries on a generated window-sized world: the
+// player's 30x30 box and a wide 240x240 box, with the occupancy bitmask
+// (scalar and SIMD), a per-cell loop, and the original scan over one
+// RectangleShape per voxel
+void runCollisionBenchmark()
+{
+    VoxelGrid grid(GRID_WIDTH, GRID_HEIGHT);
+    generateTerrain(grid, 7, workerThreads());
+
+    std::vector<sf::RectangleShape> shapes;
+    for (int y = 0; y < grid.getHeight(); ++y)
+    {
+        for (int x = 0; x < grid.getWidth(); ++x)
+        {
+            if (grid.isSolid(x, y))
+            {
+                shapes.emplace_back(sf::Vector2f(VOXEL_SIZE, VOXEL_SIZE));
+                shapes.back().setPosition(static_cast<float>(x * VOXEL_SIZE), static_cast<float>(y * VOXEL_SIZE));
+            }
+        }
+    }
+
+    std::mt19937 rng(99);
+    std::uniform_real_distribution<float> coordinate(0.f, 1.f);
+    std::cout << "collision benchmark: " << grid.getWidth() << "x" << grid.getHeight() << " cells, "
+              << grid.getCount() << " solid" << std::endl;
+
+    for (float boxSize : {30.f, 240.f})
+    {
+        const int queryCount = 20000;
+        std::vector<sf::FloatRect> boxes;
+        for (int i = 0; i < queryCount; ++i)
+        {
+            boxes.emplace_back(coordinate(rng) * (WINDOW_WIDTH - boxSize), coordinate(rng) * (WINDOW_HEIGHT - boxSize),
+                               boxSize, boxSize);
+        }
+
+        // Same cell range as Simulation::checkVoxelCollision
+        auto cellRange = [](const sf::FloatRect &box, int &x0, int &y0, int &x1, int &y1) {
+            x0 = static_cast<int>(std::floor(box.left / VOXEL_SIZE));
+            y0 = static_cast<int>(std::floor(box.top / VOXEL_SIZE));
+            x1 = static_cast<int>(std::ceil((box.left + box.width) / VOXEL_SIZE)) - 1;
+            y1 = static_cast<int>(std::ceil((box.top + box.height) / VOXEL_SIZE)) - 1;
+        };
+
+        // Runs query over every box, returns ns per query and the hits of one pass
+        auto time = [&](int passes, auto query, int &hits) {
+            sf::Clock clock;
+            hits = 0;
+            for (int pass = 0; pass < passes; ++pass)
+                for (const sf::FloatRect &box : boxes)
+                    hits += query(box);
+            hits /= passes;
+            return clock.getElapsedTime().asMicroseconds() * 1000.f / (static_cast<float>(passes) * queryCount);
+        };
+
+        int simdHits, scalarHits, cellHits, shapeHits;
+        float simdTime = time(50, [&](const sf::FloatRect &box) {
+            int x0, y0, x1, y1;
+            cellRange(box, x0, y0, x1, y1);
+            return grid.anySolid(x0, y0, x1, y1);
+        }, simdHits);
+        float scalarTime = time(50, [&](const sf::FloatRect &box) {
+            int x0, y0, x1, y1;
+            cellRange(box, x0, y0, x1, y1);
+            return grid.anySolidScalar(x0, y0, x1, y1);
+        }, scalarHits);
+        float cellTime = time(5, [&](const sf::FloatRect &box) {
+            int x0, y0, x1, y1;
+            cellRange(box, x0, y0, x1, y1);
+            for (int y = y0; y <= y1; ++y)
+                for (int x = x0; x <= x1; ++x)
+                    if (grid.isSolid(x, y))
+                        return true;
+            return false;
+        }, cellHits);
+        float shapeTime = time(1, [&](const sf::FloatRect &box) {
+            for (const auto &shape : shapes)
+                if (shape.getGlobalBounds().intersects(box))
+                    return true;
+            return false;
+        }, shapeHits);
+
+        bool agree = scalarHits == simdHits && cellHits == simdHits && shapeHits == simdHits;
+        std::cout << "  " << boxSize << "x" << boxSize << " px box, " << simdHits << "/" << queryCount << " hit\n"
+                  << "    bitmask, SIMD     " << simdTime << " ns\n"
+                  << "    bitmask, scalar   " << scalarTime << " ns\n"
+                  << "    per-cell loop     " << cellTime << " ns\n"
+                  << "    per-shape scan    " << shapeTime << " ns (original)\n"
+                  << "    results agree     " << (agree ? "yes" : "NO") << std::endl;
+    }
+}
+
+// Ray-cast throughput with and without the distance field, one ray at a
+// time and batched, on generated terrain (mostly open sky) and on a solid
+// world riddled with caves, plus the cost of building the field and of
+// keeping it current under explosions
+void runRaycastBenchmark(int width, int height)
+{
+    unsigned threads = workerThreads();
+    std::cout << "ray-cast benchmark: " << width << "x" << height << " cells, rays up to "
+              << width * VOXEL_SIZE / 2 << " px" << std::endl;
+
+    for (bool dense : {false, true})
+    {
+        Simulation simulation(width, height);
+        VoxelGrid &grid = simulation.voxels;
+        std::mt19937 rng(dense ? 11 : 12);
+        if (dense)
+        {
+            grid.writeChunksParallel([&grid](int chunk, Material *cells) {
+                int originX, originY;
+                grid.chunkOrigin(chunk, originX, originY);
+                for (int y = 0; y < CHUNK_SIZE; ++y)
+                    for (int x = 0; x < CHUNK_SIZE; ++x)
+                        cells[y * CHUNK_SIZE + x] = grid.contains(originX + x, originY + y) ? Material::Stone
+                                                                                            : Material::Empty;
+            }, threads);
+            std::uniform_int_distribution<int> cellX(0, width - 1), cellY(0, height - 1), radius(3, 12);
+            for (int cave = 0; cave < width * height / 200; ++cave)
+            {
+                int cx = cellX(rng), cy = cellY(rng), r = radius(rng);
+                for (int y = cy - r; y <= cy + r; ++y)
+                    for (int x = cx - r; x <= cx + r; ++x)
+                        if ((x - cx) * (x - cx) + (y - cy) * (y - cy) <= r * r)
+                            grid.set(x, y, Material::Empty);
+            }
+        }
+        else
+        {
+            generateTerrain(grid, 3, threads);
+        }
+
+        sf::Clock clock;
+        simulation.distanceField.update(grid);
+        float buildTime = clock.getElapsedTime().asMicroseconds() / 1000.f;
+
+        // Rays start in empty cells, in every direction
+        const int rayCount = 200000;
+        const float maxDistance = width * VOXEL_SIZE / 2.f;
+        std::uniform_real_distribution<float> unit(0.f, 1.f);
+        std::vector<sf::Vector2f> origins, directions;
+        while (static_cast<int>(origins.size()) < rayCount)
+        {
+            sf::Vector2f origin(unit(rng) * width * VOXEL_SIZE, unit(rng) * height * VOXEL_SIZE);
+            if (grid.isSolid(static_cast<int>(origin.x) / VOXEL_SIZE, static_cast<int>(origin.y) / VOXEL_SIZE))
+                continue;
+            float angle = unit(rng) * 6.2831853f;
+            origins.push_back(origin);
+            directions.emplace_back(std::cos(angle), std::sin(angle));
+        }
+
+        // Hit distance of every ray, -1 for a miss
+        std::vector<float> plainHits(rayCount), fieldHits(rayCount);
+        clock.restart();
+        for (int i = 0; i < rayCount; ++i)
+        {
+            if (!rayCastCells(grid, origins[i], directions[i], maxDistance, plainHits[i]))
+                plainHits[i] = -1.f;
+        }
+        float plainTime = clock.getElapsedTime().asMicroseconds() / 1000.f;
+        clock.restart();
+        for (int i = 0; i < rayCount; ++i)
+        {
+            if (!simulation.distanceField.rayCast(grid, origins[i], directions[i], maxDistance, fieldHits[i]))
+                fieldHits[i] = -1.f;
+        }
+        float fieldTime = clock.getElapsedTime().asMicroseconds() / 1000.f;
+        std::vector<Ray> rays;
+        for (int i = 0; i < rayCount; ++i)
+            rays.push_back(Ray{origins[i], directions[i], maxDistance});
+        std::vector<RayHit> batchHits(rayCount);
+        clock.restart();
+        castRays(grid, simulation.distanceField, rays.data(), rays.size(), batchHits.data());
+        float batchTime = clock.getElapsedTime().asMicroseconds() / 1000.f;
+
+        int hits = 0, mismatches = 0;
+        for (int i = 0; i < rayCount; ++i)
+        {
+            hits += plainHits[i] >= 0.f;
+            mismatches += plainHits[i] != fieldHits[i] ||
+                          (batchHits[i].hit ? batchHits[i].distance : -1.f) != plainHits[i];
+        }
+
+        // Explosion-sized craters across the world, the field brought up to date after each
+        std::uniform_int_distribution<int> craterX(0, width - 1), craterY(0, height - 1);
+        const int explosions = 200;
+        const int craterRadius = static_cast<int>(EXPLOSION_RADIUS / VOXEL_SIZE);
+        std::size_t updatedBlocks = 0;
+        clock.restart();
+        for (int i = 0; i < explosions; ++i)
+        {
+            int cx = craterX(rng), cy = craterY(rng);
+            for (int y = cy - craterRadius; y <= cy + craterRadius; ++y)
+                for (int x = cx - craterRadius; x <= cx + craterRadius; ++x)
+                    if ((x - cx) * (x - cx) + (y - cy) * (y - cy) <= craterRadius * craterRadius)
+                        grid.set(x, y, Material::Empty);
+            simulation.distanceField.update(grid);
+            updatedBlocks += simulation.distanceField.getUpdatedBlocks();
+        }
+        float updateTime = clock.getElapsedTime().asMicroseconds() / 1000.f;
+
+        // The incrementally updated field must equal one built from scratch
+        DistanceField rebuilt;
+        rebuilt.update(grid);
+        bool incrementalAgrees = true;
+        for (int y = 0; y < rebuilt.getBlocksY(); ++y)
+            for (int x = 0; x < rebuilt.getBlocksX(); ++x)
+                incrementalAgrees &= rebuilt.getDistance(x, y) == simulation.distanceField.getDistance(x, y);
+
+        std::cout << "  " << (dense ? "dense (caves)" : "sparse (terrain)") << ", " << grid.getCount() << " solid, "
+                  << hits << "/" << rayCount << " rays hit\n"
+                  << "    cell walk          " << rayCount / plainTime / 1000.f << " M rays/s\n"
+                  << "    distance field     " << rayCount / fieldTime / 1000.f << " M rays/s ("
+                  << plainTime / fieldTime << "x)\n"
+                  << "    field, batched     " << rayCount / batchTime / 1000.f << " M rays/s ("
+                  << plainTime / batchTime << "x, " << RAY_LANES << " lanes)\n"
+                  << "    results agree      " << (mismatches == 0 ? "yes" : "NO, " + std::to_string(mismatches)) << "\n"
+                  << "    field build        " << buildTime << " ms for " << simulation.distanceField.getBlocksX()
+                  << "x" << simulation.distanceField.getBlocksY() << " blocks\n"
+                  << "    crater + update    " << updateTime * 1000.f / explosions << " us, "
+                  << updatedBlocks / explosions << " blocks recomputed each\n"
+                  << "    matches rebuild    " << (incrementalAgrees ? "yes" : "NO") << std::endl;
+    }
+}
+
+// Times filling a sprite batch, the CPU side of drawing particles, bullets
+// and players
+void runSpriteBenchmark(int count)
+{
+    std::mt19937 rng(17);
+    std::uniform_real_distribution<float> coordinate(0.f, static_cast<float>(WINDOW_WIDTH));
+    std::vector<sf::Vector2f> positions(count);
+    for (auto &position : positions)
+        position = sf::Vector2f(coordinate(rng), coordinate(rng));
+    std::cout << "sprite benchmark: " << count << " sprites per frame" << std::endl;
+
+    const int frames = 100;
+    const sf::FloatRect texture = atlasTile(AtlasTile::Particle);
+    SpriteBatch batch;
+    sf::Clock clock;
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        batch.clear();
+        for (const auto &position : positions)
+            batch.add(sf::FloatRect(position.x, position.y, 4.f, 4.f), texture, sf::Color(255, 200, 80, frame));
+    }
+    float batchTime = clock.getElapsedTime().asMicroseconds() / 1000.f;
+
+    std::cout << "  sprite batch       " << batchTime * 1e6f / (static_cast<float>(frames) * count) << " ns per sprite, "
+              << batch.getSpriteCount() << " sprites in 1 draw" << std::endl;
+}
+
+// Times laying out changing numeric labels through the glyph cache, as the
+// chunk overlay does every frame
+void runTextBenchmark(int labels)
+{
+    sf::Font font;
+    GlyphCache glyphs;
+    if (!font.loadFromFile("arial.ttf") || !glyphs.load(font, 12))
+    {
+        std::cerr << "Could not load arial.ttf" << std::endl;
+        return;
+    }
+    std::cout << "text benchmark: " << labels << " labels per frame" << std::endl;
+
+    const int frames = 100;
+    SpriteBatch batch;
+    std::size_t characters = 0;
+    sf::Clock clock;
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        batch.clear();
+        for (int i = 0; i < labels; ++i)
+        {
+            std::string label = "#" + std::to_string(i) + " solid " + std::to_string(frame * 37 + i);
+            characters += label.size();
+            glyphs.addText(batch, label, sf::Vector2f((i % 20) * 40.f, (i / 20) * 14.f), sf::Color::White);
+        }
+    }
+    float time = clock.getElapsedTime().asMicroseconds() / 1000.f;
+
+    std::cout << "  per frame          " << time / frames << " ms, " << batch.getSpriteCount() << " glyphs in 1 draw\n"
+              << "  per label          " << time * 1e6f / (static_cast<float>(frames) * labels) << " ns\n"
+              << "  per character      " << time * 1e6f / characters << " ns" << std::endl;
+}
+
+// Times visibility polygons from random points over generated terrain with
+// caves, and the edge cache rebuilds after explosion-sized craters
+void runVisibilityBenchmark(int width, int height)
+{
+    unsigned threads = workerThreads();
+    Simulation simulation(width, height);
+    VoxelGrid &grid = simulation.voxels;
+    generateTerrain(grid, 3, threads);
+    std::mt19937 rng(13);
+    std::uniform_int_distribution<int> cellX(0, width - 1), cellY(0, height - 1), radius(3, 12);
+    for (int cave = 0; cave < width * height / 400; ++cave)
+    {
+        int cx = cellX(rng), cy = cellY(rng), r = radius(rng);
+        for (int y = cy - r; y <= cy + r; ++y)
+            for (int x = cx - r; x <= cx + r; ++x)
+                if ((x - cx) * (x - cx) + (y - cy) * (y - cy) <= r * r)
+                    grid.set(x, y, Material::Empty);
+    }
+    std::cout << "visibility benchmark: " << width << "x" << height << " cells, " << grid.getCount()
+              << " solid, radius " << VISIBILITY_RADIUS << " px" << std::endl;
+
+    VisibilityPolygon visibility;
+    sf::Clock clock;
+    visibility.update(grid);
+    float buildTime = clock.getElapsedTime().asMicroseconds() / 1000.f;
+    std::size_t edges = 0;
+    for (int chunk = 0; chunk < grid.getChunkCount(); ++chunk)
+        edges += visibility.getChunkEdges(chunk).size();
+    simulation.distanceField.update(grid);
+
+    // Eyes in empty cells, as a player would be
+    const int polygons = 2000;
+    std::vector<sf::Vector2f> eyes;
+    while (static_cast<int>(eyes.size()) < polygons)
+    {
+        int x = cellX(rng), y = cellY(rng);
+        if (!grid.isSolid(x, y))
+            eyes.emplace_back((x + 0.5f) * VOXEL_SIZE, (y + 0.5f) * VOXEL_SIZE);
+    }
+    std::size_t rays = 0;
+    clock.restart();
+    for (const sf::Vector2f &eye : eyes)
+    {
+        visibility.compute(grid, simulation.distanceField, eye, VISIBILITY_RADIUS);
+        rays += visibility.getRayCount();
+    }
+    float polygonTime = clock.getElapsedTime().asMicroseconds() / 1000.f;
+
+    // Explosion-sized craters, the edge cache brought up to date after each
+    const int explosions = 200;
+    const int craterRadius = static_cast<int>(EXPLOSION_RADIUS / VOXEL_SIZE);
+    std::size_t rebuiltChunks = 0;
+    clock.restart();
+    for (int i = 0; i < explosions; ++i)
+    {
+        int cx = cellX(rng), cy = cellY(rng);
+        for (int y = cy - craterRadius; y <= cy + craterRadius; ++y)
+            for (int x = cx - craterRadius; x <= cx + craterRadius; ++x)
+                if ((x - cx) * (x - cx) + (y - cy) * (y - cy) <= craterRadius * craterRadius)
+                    grid.set(x, y, Material::Empty);
+        visibility.update(grid);
+        rebuiltChunks += visibility.getRebuiltChunks();
+    }
+    float updateTime = clock.getElapsedTime().asMicroseconds() / 1000.f;
+
+    // The incrementally updated edges must equal ones built from scratch
+    VisibilityPolygon rebuilt;
+    rebuilt.update(grid);
+    bool incrementalAgrees = true;
+    for (int chunk = 0; chunk < grid.getChunkCount(); ++chunk)
+        incrementalAgrees &= rebuilt.getChunkEdges(chunk) == visibility.getChunkEdges(chunk);
+
+    std::cout << "  edge build         " << buildTime << " ms, " << edges << " edges in " << grid.getChunkCount()
+              << " chunks\n"
+              << "  polygon            " << polygonTime * 1000.f / polygons << " us, " << rays / polygons
+              << " rays on average\n"
+              << "  crater + update    " << updateTime * 1000.f / explosions << " us, "
+              << static_cast<float>(rebuiltChunks) / explosions << " chunks rebuilt each\n"
+              << "  matches rebuild    " << (incrementalAgrees ? "yes" : "NO") << std::endl;
+}
+
+// Times the bulk voxel operations on generated terrain and checks them against
+// straightforward per-cell versions
+void runMorphologyBenchmark(int width, int height)
+{
+    unsigned threads = workerThreads();
+    VoxelGrid grid(width, height);
+    generateTerrain(grid, 42, threads);
+    // Punch holes so there are floating islands and cavities to find
+    std::mt19937 rng(5);
+    for (int i = 0; i < width * height / 2000; ++i)
+    {
+        int centerX = static_cast<int>(rng() % width), centerY = static_cast<int>(rng() % height);
+        for (int y = centerY - 6; y <= centerY + 6; ++y)
+            for (int x = centerX - 6; x <= centerX + 6; ++x)
+                if ((x - centerX) * (x - centerX) + (y - centerY) * (y - centerY) <= 36)
+                    grid.set(x, y, Material::Empty);
+    }
+
+    sf::Clock clock;
+    VoxelMask solid = VoxelMask::solidCells(grid);
+    float maskTime = clock.restart().asMicroseconds() / 1000.f;
+    VoxelMask dilated = dilate(solid, 3, threads);
+    float dilateTime = clock.restart().asMicroseconds() / 1000.f;
+    VoxelMask eroded = erode(solid, 3, threads);
+    float erodeTime = clock.restart().asMicroseconds() / 1000.f;
+    VoxelComponents components = labelComponents(solid, threads);
+    float labelTime = clock.restart().asMicroseconds() / 1000.f;
+    labelComponents(solid, 1);
+    float labelSerialTime = clock.restart().asMicroseconds() / 1000.f;
+
+    // Fill from the bottom-left cell: the ground
+    VoxelMask ground = floodFill(solid, 0, height - 1);
+    float fillTime = clock.restart().asMicroseconds() / 1000.f;
+
+    // Per-cell references
+    auto disk = [&](int x, int y, bool erosion) {
+        for (int dy = -3; dy <= 3; ++dy)
+        {
+            for (int dx = -3; dx <= 3; ++dx)
+            {
+                if (dx * dx + dy * dy > 9)
+                    continue;
+                bool inside = grid.contains(x + dx, y + dy);
+                if (erosion && inside && !grid.isSolid(x + dx, y + dy))
+                    return false;
+                if (!erosion && inside && grid.isSolid(x + dx, y + dy))
+                    return true;
+            }
+        }
+        return erosion;
+    };
+    bool morphologyMatches = true;
+    clock.restart();
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            morphologyMatches = morphologyMatches && dilated.get(x, y) == disk(x, y, false);
+    float cellDilateTime = clock.restart().asMicroseconds() / 1000.f;
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            morphologyMatches = morphologyMatches && eroded.get(x, y) == (grid.isSolid(x, y) && disk(x, y, true));
+
+    // Breadth-first labeling, one cell at a time
+    clock.restart();
+    std::vector<int> labels(static_cast<std::size_t>(width) * height, 0);
+    std::vector<int> queue;
+    int referenceCount = 0;
+    bool labelsMatch = true;
+    for (int start = 0; start < width * height; ++start)
+    {
+        if (labels[start] || !grid.isSolid(start % width, start / width))
+            continue;
+        ++referenceCount;
+        labels[start] = referenceCount;
+        queue.assign(1, start);
+        int size = 0;
+        for (std::size_t head = 0; head < queue.size(); ++head)
+        {
+            int cell = queue[head], x = cell % width, y = cell / width;
+            ++size;
+            const int offsets[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+            for (const auto &offset : offsets)
+            {
+                int nx = x + offset[0], ny = y + offset[1];
+                if (grid.isSolid(nx, ny) && !labels[ny * width + nx])
+                {
+                    labels[ny * width + nx] = referenceCount;
+                    queue.push_back(ny * width + nx);
+                }
+            }
+        }
+        // Same partition: every cell of this component carries one label, used by no one else
+        int label = components.labels[start];
+        labelsMatch = labelsMatch && label > 0 && components.sizes[label] == size;
+        for (int cell : queue)
+            labelsMatch = labelsMatch && components.labels[cell] == label;
+    }
+    float bfsTime = clock.restart().asMicroseconds() / 1000.f;
+    labelsMatch = labelsMatch && referenceCount == components.getCount();
+    bool fillMatches = ground.count() == static_cast<std::size_t>(components.sizes[components.at(0, height - 1)]);
+
+    std::cout << "morphology benchmark: " << width << "x" << height << " cells, " << solid.count() << " solid, "
+              << threads << " threads\n"
+              << "  solid mask             " << maskTime << " ms\n"
+              << "  dilate r=3             " << dilateTime << " ms (per cell: " << cellDilateTime << " ms)\n"
+              << "  erode r=3              " << erodeTime << " ms\n"
+              << "  components             " << labelTime << " ms, one thread " << labelSerialTime << " ms (BFS: "
+              << bfsTime << " ms), " << components.getCount() << " found\n"
+              << "  flood fill ground      " << fillTime << " ms, " << ground.count() << " cells\n"
+              << "  results match          " << (morphologyMatches && labelsMatch && fillMatches ? "yes" : "NO") << std::endl;
+}
+
+// Drops count pieces of debris onto generated terrain and times the
+// simulation at 60 Hz until they have all come to rest (or 20 seconds pass)
+void runBodiesBenchmark(int count)
+{
+    Simulation simulation(512, 256);
+    simulation.effectsEnabled = false;
+    generateTerrain(simulation.voxels, 11, 1);
+
+    // Random rectangles and L shapes in rows above the terrain
+    std::mt19937 rng(3);
+    const int perRow = 40;
+    for (int i = 0; i < count; ++i)
+    {
+        VoxelBody body;
+        int width = 3 + static_cast<int>(rng() % 8), height = 3 + static_cast<int>(rng() % 6);
+        bool lShape = rng() % 2 == 0;
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x)
+                if (!lShape || x < 2 || y >= height - 2)
+                    body.cells.push_back({static_cast<sf::Int16>(x), static_cast<sf::Int16>(y),
+                                          static_cast<Material>(1 + rng() % 4)});
+        body.updateShape();
+        body.position = sf::Vector2f((6 + (i % perRow) * 12.5f) * VOXEL_SIZE, (6 + (i / perRow) * 12) * VOXEL_SIZE);
+        body.angularVelocity = (static_cast<int>(rng() % 200) - 100) / 100.f;
+        simulation.bodies.push_back(std::move(body));
+    }
+
+    std::vector<float> tickTimes;
+    sf::Clock clock;
+    std::size_t peakBodies = simulation.bodies.size();
+    while (!simulation.bodies.empty() && tickTimes.size() < 20 * 60)
+    {
+        clock.restart();
+        simulation.update(1.f / 60.f);
+        tickTimes.push_back(clock.getElapsedTime().asMicroseconds() / 1000.f);
+        peakBodies = std::max(peakBodies, simulation.bodies.size());
+    }
+
+    // Ticks while all bodies were still in the air are the interesting ones
+    std::vector<float> sorted(tickTimes);
+    std::sort(sorted.begin(), sorted.end());
+    float total = 0.f;
+    for (float time : tickTimes)
+        total += time;
+    std::cout << "bodies benchmark: " << count << " bodies on " << simulation.voxels.getWidth() << "x"
+              << simulation.voxels.getHeight() << " cells, one thread\n"
+              << "  ticks until all settled  " << tickTimes.size() << " (" << simulation.bodies.size() << " still moving)\n"
+              << "  first 60 ticks           " << std::accumulate(tickTimes.begin(), tickTimes.begin() + std::min<std::size_t>(60, tickTimes.size()), 0.f) /
+                                                    std::max<std::size_t>(1, std::min<std::size_t>(60, tickTimes.size()))
+              << " ms per tick\n"
+              << "  average                  " << total / std::max<std::size_t>(1, tickTimes.size()) << " ms per tick\n"
+              << "  p99 / max                " << (sorted.empty() ? 0.f : sorted[sorted.size() * 99 / 100]) << " / "
+              << (sorted.empty() ? 0.f : sorted.back()) << " ms (budget at 60 Hz: 16.7 ms)" << std::endl;
+}
+
+// Flooding: the sky above generated terrain is filled with water, with a
+// lava lake on one side, and the fluid is stepped until it comes to rest
+void runFluidBenchmark(int width, int height)
+{
+    Simulation simulation(width, height);
+    simulation.effectsEnabled = false;
+    unsigned threads = workerThreads();
+    generateTerrain(simulation.voxels, 5, threads);
+
+    for (int y = 0; y < height / 4; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            if (simulation.voxels.get(x, y) == Material::Empty)
+                simulation.fluid.add(x, y, x < width / 8 ? Fluid::Lava : Fluid::Water, 255);
+        }
+    }
+    auto totalLevel = [&simulation, width, height](Fluid kind) {
+        long long total = 0;
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x)
+                if (simulation.fluid.getKind(x, y) == kind)
+                    total += simulation.fluid.getLevel(x, y);
+        return total;
+    };
+    long long waterBefore = totalLevel(Fluid::Water);
+
+    std::vector<float> tickTimes;
+    long long activeChunks = 0;
+    std::size_t voxelsBefore = simulation.voxels.getCount();
+    sf::Clock clock;
+    const int ticks = 20 * 60;
+    for (int tick = 0; tick < ticks; ++tick)
+    {
+        clock.restart();
+        simulation.updateFluid(1.f / FLUID_TICK_RATE);
+        tickTimes.push_back(clock.getElapsedTime().asMicroseconds() / 1000.f);
+        activeChunks += simulation.fluid.getActiveChunkCount();
+        if (simulation.fluid.getActiveChunkCount() == 0)
+            break;
+    }
+
+    std::vector<float> sorted(tickTimes);
+    std::sort(sorted.begin(), sorted.end());
+    float total = std::accumulate(tickTimes.begin(), tickTimes.end(), 0.f);
+    std::size_t collapseTicks = std::min<std::size_t>(tickTimes.size(), 5 * 60);
+    float collapse = std::accumulate(tickTimes.begin(), tickTimes.begin() + collapseTicks, 0.f);
+    const int chunkCount = ((width + CHUNK_SIZE - 1) / CHUNK_SIZE) * ((height + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    std::cout << "fluid benchmark: flooding " << width << "x" << height << " cells, " << threads << " threads\n"
+              << "  ticks                    " << tickTimes.size()
+              << (simulation.fluid.getActiveChunkCount() ? " (still flowing)" : " (at rest)") << "\n"
+              << "  active chunks            " << activeChunks / static_cast<long long>(tickTimes.size()) << " of "
+              << chunkCount << " on average\n"
+              << "  first 5 s (collapse)     " << collapse / collapseTicks << " ms per tick\n"
+              << "  afterwards               "
+              << (total - collapse) / std::max<std::size_t>(1, tickTimes.size() - collapseTicks) << " ms per tick\n"
+              << "  average                  " << total / tickTimes.size() << " ms per tick\n"
+              << "  p99 / max                " << sorted[sorted.size() * 99 / 100] << " / " << sorted.back()
+              << " ms (target 4 ms)\n"
+              << "  water level sum          " << waterBefore << " -> " << totalLevel(Fluid::Water)
+              << " (lost only where it met lava)\n"
+              << "  stone from reactions     " << simulation.voxels.getCount() - voxelsBefore << " cells" << std::endl;
+}
+
+// Forest fire: generated terrain is planted with a dense forest, lit at one
+// end and stepped until the fire dies out. Step time should follow the
+// number of warm cells, not the size of the world.
+void runFireBenchmark(int width, int height)
+{
+    Simulation simulation(width, height);
+    simulation.effectsEnabled = false;
+    unsigned threads = workerThreads();
+    generateTerrain(simulation.voxels, 5, threads);
+
+    // Replace the sky right above the ground with a band of leaves, trunks
+    // every 6 columns; tall enough to bridge the steps in the terrain
+    const int forestHeight = 48;
+    int surfaceY = 0;
+    for (int x = 0; x < width; ++x)
+    {
+        int y = 0;
+        while (y < height && simulation.voxels.get(x, y) == Material::Empty)
+            ++y;
+        for (int cellY = std::max(y - forestHeight, 0); cellY < y; ++cellY)
+            simulation.voxels.set(x, cellY, x % 6 == 0 ? Material::Wood : Material::Leaves);
+        if (x == 0)
+            surfaceY = y;
+    }
+    std::size_t flammableBefore = 0;
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            flammableBefore += burnRate(simulation.voxels.get(x, y)) > 0;
+    for (int y = std::max(surfaceY - forestHeight, 0); y < surfaceY; ++y)
+        simulation.heat.ignite(0, y, FIRE_IGNITION);
+
+    std::vector<float> tickTimes;
+    long long warmCells = 0;
+    std::size_t peakWarm = 0;
+    sf::Clock clock;
+    const int maxTicks = 600 * static_cast<int>(FIRE_TICK_RATE);
+    for (int tick = 0; tick < maxTicks && !simulation.heat.getActiveCells().empty(); ++tick)
+    {
+        clock.restart();
+        simulation.updateHeat(1.f / FIRE_TICK_RATE);
+        tickTimes.push_back(clock.getElapsedTime().asMicroseconds() / 1000.f);
+        warmCells += simulation.heat.getActiveCells().size();
+        peakWarm = std::max(peakWarm, simulation.heat.getActiveCells().size());
+    }
+    if (tickTimes.empty())
+        return;
+
+    std::size_t flammableAfter = 0;
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            flammableAfter += burnRate(simulation.voxels.get(x, y)) > 0;
+    std::vector<float> sorted(tickTimes);
+    std::sort(sorted.begin(), sorted.end());
+    float total = std::accumulate(tickTimes.begin(), tickTimes.end(), 0.f);
+    std::cout << "fire benchmark: forest on " << width << "x" << height << " cells\n"
+              << "  ticks                    " << tickTimes.size()
+              << (simulation.heat.getActiveCells().empty() ? " (burnt out)" : " (still burning)") << "\n"
+              << "  warm cells               " << warmCells / static_cast<long long>(tickTimes.size())
+              << " on average, " << peakWarm << " at peak, of " << static_cast<long long>(width) * height << "\n"
+              << "  average                  " << total / tickTimes.size() << " ms per tick\n"
+              << "  per warm cell            " << total * 1e6f / std::max<long long>(warmCells, 1) << " ns\n"
+              << "  p99 / max                " << sorted[sorted.size() * 99 / 100] << " / " << sorted.back() << " ms\n"
+              << "  flammable cells          " << flammableBefore << " -> " << flammableAfter << std::endl;
+}
+
+// A reproducible workload for the performance harness, read from a scenario
+// file: the world, the players, and inputs and events scripted by tick.
+// One directive per line, '#' starts a comment:
+//   world WIDTH HEIGHT [generate SEED | fill ROW]   grid size in cells; terrain, or stone from ROW down
+//   players COUNT                                   players standing in a row, all fed the same input
+//   ticks COUNT                                     simulation steps of 1/tickRate s (1/60 s by default) per run
+//   runs COUNT                                      default number of runs
+//   seed SEED                                       for random positions and directions
+//   at TICK ACTION...                               ACTION on that tick
+//   from TICK TICK ACTION...                        ACTION on every tick of the range, end excluded
+// Actions:
+//   input MOVEX JUMP DRAW    the players' movement (-1..1), jump and paint buttons, kept until changed
+//   aim X Y                  the players' aim, in pixels
+//   aim sweep STEP           the aim walks the screen row by row, STEP pixels per tick
+//   fire                     every player shoots once at the aim
+//   bullets COUNT [X Y]      COUNT bullets from random players in random directions, or at the point
+//   explode COUNT            COUNT bullets placed in random solid cells; they all go off on the next step
+//   pour water|lava X Y      pours fluid at the point
+// The tick rate changes how much happens per step, so a baseline recorded at
+// one --set tickRate says nothing about runs at another.
+struct Scenario
+{
+    struct Action
+    {
+        int first = 0;
+        int end = 0; // Excluded
+        std::vector<std::string> words;
+    };
+
+    std::string name;
+    int width = GRID_WIDTH;
+    int height = GRID_HEIGHT;
+    std::string terrain = "empty";
+    int terrainValue = 0;
+    int players = 1;
+    int ticks = 600;
+    int runs = 5;
+    unsigned seed = 1;
+    std::vector<Action> actions;
+};
+
+bool loadScenario(const std::string &path, Scenario &scenario, std::string &error)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        error = "can't open " + path;
+        return false;
+    }
+    std::size_t slash = path.find_last_of("/\\");
+    scenario.name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+    scenario.name = scenario.name.substr(0, scenario.name.find('.'));
+
+    // Whole words only, so the harness can read them again without checking
+    auto integer = [](const std::string &word, int minimum) {
+        std::size_t used = 0;
+        int value = std::stoi(word, &used);
+        if (used != word.size() || value < minimum)
+            throw std::invalid_argument(word);
+        return value;
+    };
+    auto number = [](const std::string &word) {
+        std::size_t used = 0;
+        float value = std::stof(word, &used);
+        if (used != word.size())
+            throw std::invalid_argument(word);
+        return value;
+    };
+    // Checks the arguments of an action as runScenario reads them
+    auto checkAction = [&integer, &number](const std::vector<std::string> &words) {
+        const std::string &verb = words[0];
+        std::size_t count = words.size();
+        if (verb == "input" && count == 4)
+        {
+            if (std::abs(integer(words[1], -1)) > 1)
+                throw std::invalid_argument(words[1]);
+            integer(words[2], 0);
+            integer(words[3], 0);
+        }
+        else if (verb == "aim" && count == 3 && words[1] == "sweep")
+        {
+            if (!(number(words[2]) > 0.f))
+                throw std::invalid_argument(words[2]);
+        }
+        else if (verb == "aim" && count == 3)
+        {
+            number(words[1]);
+            number(words[2]);
+        }
+        else if (verb == "fire" && count == 1)
+        {
+        }
+        else if (verb == "bullets" && (count == 2 || count == 4))
+        {
+            integer(words[1], 0);
+            if (count == 4)
+            {
+                number(words[2]);
+                number(words[3]);
+            }
+        }
+        else if (verb == "explode" && count == 2)
+            integer(words[1], 0);
+        else if (verb == "pour" && count == 4 && (words[1] == "water" || words[1] == "lava"))
+        {
+            number(words[2]);
+            number(words[3]);
+        }
+        else
+            throw std::invalid_argument(verb);
+    };
+
+    std::string line;
+    for (int lineNumber = 1; std::getline(file, line); ++lineNumber)
+    {
+        std::istringstream words(line.substr(0, line.find('#')));
+        std::vector<std::string> tokens;
+        for (std::string word; words >> word;)
+            tokens.push_back(word);
+        if (tokens.empty())
+            continue;
+
+        try
+        {
+            const std::string &directive = tokens[0];
+            if (directive == "world" && (tokens.size() == 3 || tokens.size() == 5))
+            {
+                scenario.width = integer(tokens[1], 1);
+                scenario.height = integer(tokens[2], 1);
+                if (tokens.size() == 5)
+                {
+                    scenario.terrain = tokens[3];
+                    scenario.terrainValue = integer(tokens[4], 0);
+                }
+            }
+            else if (directive == "players" && tokens.size() == 2)
+                scenario.players = std::min(integer(tokens[1], 1), MAX_PLAYERS);
+            else if (directive == "ticks" && tokens.size() == 2)
+                scenario.ticks = integer(tokens[1], 1);
+            else if (directive == "runs" && tokens.size() == 2)
+                scenario.runs = integer(tokens[1], 1);
+            else if (directive == "seed" && tokens.size() == 2)
+            {
+                std::size_t used = 0;
+                scenario.seed = static_cast<unsigned>(std::stoul(tokens[1], &used));
+                if (used != tokens[1].size())
+                    throw std::invalid_argument(tokens[1]);
+            }
+            else if (directive == "at" && tokens.size() >= 3)
+            {
+                int tick = integer(tokens[1], 0);
+                std::vector<std::string> action(tokens.begin() + 2, tokens.end());
+                checkAction(action);
+                scenario.actions.push_back(Scenario::Action{tick, tick + 1, action});
+            }
+            else if (directive == "from" && tokens.size() >= 4)
+            {
+                int first = integer(tokens[1], 0);
+                int end = integer(tokens[2], first + 1);
+                std::vector<std::string> action(tokens.begin() + 3, tokens.end());
+                checkAction(action);
+                scenario.actions.push_back(Scenario::Action{first, end, action});
+            }
+            else
+                throw std::invalid_argument(directive);
+        }
+        catch (const std::exception &)
+        {
+            error = path + ":" + std::to_string(lineNumber) + ": can't read \"" + line + "\"";
+            return false;
+        }
+    }
+    if (scenario.terrain != "empty" && scenario.terrain != "generate" && scenario.terrain != "fill")
+    {
+        error = path + ": unknown terrain " + scenario.terrain;
+        return false;
+    }
+    return true;
+}
+
+// Heap in use, for what one scenario run allocates. Elsewhere than glibc,
+// resident memory stands in, though freed memory may be reused between
+// runs there; 0 where neither can be read.
+float memoryMegabytes()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 heap = mallinfo2();
+    return static_cast<float>(heap.uordblks + heap.hblkhd) / (1024.f * 1024.f);
+#elif defined(__linux__)
+    long pages = 0, resident = 0;
+    if (FILE *statm = std::fopen("/proc/self/statm", "r"))
+    {
+        if (std::fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        std::fclose(statm);
+    }
+    return resident * static_cast<float>(sysconf(_SC_PAGESIZE)) / (1024.f * 1024.f);
+#else
+    return 0.f;
+#endif
+}
+
+struct ScenarioResult
+{
+    float medianMs = 0.f;       // Of the runs' median tick times
+    float p99Ms = 0.f;          // Of the runs' 99th percentile tick times
+    float memoryMb = 0.f;       // Most memory a run added, measured at its end
+    float allocationsPerTick = 0.f;
+    std::size_t peakBullets = 0;
+    std::size_t peakParticles = 0;
+};
+
+// Plays the scenario headless like the server would, one step per tick at
+// the configured tick rate, runs times from scratch, timing every step
+ScenarioResult runScenario(const Scenario &scenario, int runs, std::string &error, PhaseProfiler *profiler = nullptr)
+{
+    std::vector<float> medians, p99s;
+    ScenarioResult result;
+    sf::Uint64 allocations = 0;
+    for (int run = 0; run < runs; ++run)
+    {
+        float memoryBefore = memoryMegabytes();
+        Simulation simulation(scenario.width, scenario.height);
+        simulation.profiler = profiler;
+        VoxelGrid &grid = simulation.voxels;
+        if (scenario.terrain == "generate")
+            generateTerrain(grid, static_cast<sf::Uint32>(scenario.terrainValue), workerThreads());
+        else if (scenario.terrain == "fill")
+            for (int y = std::max(scenario.terrainValue, 0); y < grid.getHeight(); ++y)
+                for (int x = 0; x < grid.getWidth(); ++x)
+                    grid.set(x, y, Material::Stone);
+        for (int id = 0; id < scenario.players; ++id)
+            simulation.addPlayer(static_cast<sf::Uint8>(id));
+
+        std::mt19937 rng(scenario.seed);
+        PlayerInput input;
+        float sweepStep = 0.f;
+        std::vector<float> tickTimes;
+        sf::Uint64 allocationsBefore = allocationCount.load(std::memory_order_relaxed);
+        for (int tick = 0; tick < scenario.ticks; ++tick)
+        {
+            if (sweepStep > 0.f)
+            {
+                input.aim.x += sweepStep;
+                if (input.aim.x >= scenario.width * VOXEL_SIZE)
+                    input.aim = sf::Vector2f(0.f, std::fmod(input.aim.y + sweepStep, scenario.height * VOXEL_SIZE));
+            }
+            for (const Scenario::Action &action : scenario.actions)
+            {
+                if (tick < action.first || tick >= action.end)
+                    continue;
+                const std::vector<std::string> &words = action.words;
+                const std::string &verb = words[0];
+                if (verb == "input" && words.size() == 4)
+                {
+                    input.moveX = static_cast<sf::Int8>(std::stoi(words[1]));
+                    input.jump = words[2] != "0";
+                    input.drawing = words[3] != "0";
+                }
+                else if (verb == "aim" && words.size() == 3 && words[1] == "sweep")
+                {
+                    sweepStep = std::stof(words[2]);
+                    input.aim = sf::Vector2f();
+                }
+                else if (verb == "aim" && words.size() == 3)
+                {
+                    sweepStep = 0.f;
+                    input.aim = sf::Vector2f(std::stof(words[1]), std::stof(words[2]));
+                }
+                else if (verb == "fire")
+                    ++input.fireCount;
+                else if (verb == "bullets" && (words.size() == 2 || words.size() == 4) && !simulation.players.empty())
+                {
+                    std::uniform_real_distribution<float> angle(0.f, 6.2831853f);
+                    for (int i = std::stoi(words[1]); i > 0; --i)
+                    {
+                        const Player &player = simulation.players[rng() % simulation.players.size()];
+                        sf::Vector2f center = player.shape.getPosition() + player.shape.getSize() / 2.f;
+                        float a = angle(rng);
+                        sf::Vector2f direction(std::cos(a), std::sin(a));
+                        if (words.size() == 4)
+                        {
+                            sf::Vector2f target(std::stof(words[2]), std::stof(words[3]));
+                            direction = vectorLength(target - center) > 0.f ? normalize(target - center) : direction;
+                        }
+                        simulation.bullets.emplace_back(center, direction * BULLET_SPEED);
+                    }
+                }
+                else if (verb == "explode" && words.size() == 2 && grid.getCount() > 0)
+                {
+                    for (int i = std::stoi(words[1]); i > 0;)
+                    {
+                        int x = static_cast<int>(rng() % grid.getWidth()), y = static_cast<int>(rng() % grid.getHeight());
+                        if (!grid.isSolid(x, y))
+                            continue;
+                        simulation.bullets.emplace_back(sf::Vector2f(x * VOXEL_SIZE + 1.f, y * VOXEL_SIZE + 1.f),
+                                                        sf::Vector2f(0.f, 1.f));
+                        --i;
+                    }
+                }
+                else if (verb == "pour" && words.size() == 4)
+                    simulation.pourFluid(sf::Vector2f(std::stof(words[2]), std::stof(words[3])),
+                                         words[1] == "lava" ? Fluid::Lava : Fluid::Water);
+                else
+                {
+                    error = scenario.name + ": unknown action " + verb;
+                    return result;
+                }
+            }
+            for (auto &player : simulation.players)
+                player.input = input;
+
+            sf::Clock clock;
+            simulation.update(1.f / settings.tickRate);
+            tickTimes.push_back(clock.getElapsedTime().asMicroseconds() / 1000.f);
+            if (profiler)
+                profiler->endFrame();
+            result.peakBullets = std::max(result.peakBullets, simulation.bullets.size());
+            result.peakParticles = std::max(result.peakParticles, simulation.particles.size());
+        }
+        allocations += allocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+
+        std::sort(tickTimes.begin(), tickTimes.end());
+        medians.push_back(tickTimes[tickTimes.size() / 2]);
+        p99s.push_back(tickTimes[tickTimes.size() * 99 / 100]);
+        result.memoryMb = std::max(result.memoryMb, memoryMegabytes() - memoryBefore);
+    }
+
+    std::sort(medians.begin(), medians.end());
+    std::sort(p99s.begin(), p99s.end());
+    result.medianMs = medians[medians.size() / 2];
+    result.p99Ms = p99s[p99s.size() / 2];
+    result.allocationsPerTick = static_cast<float>(allocations) / (static_cast<float>(runs) * scenario.ticks);
+    return result;
+}
+
+// Runs scenario files and compares them with the stored baseline (scenario
+// name, median and p99 tick in ms, MB allocated per line). Returns the exit
+// code: 1 if anything regressed by more than tolerance or failed to run.
+// saveBaseline records the results as the new baseline instead; profile
+// prints each scenario's ticks broken down by phase.
+int runPerfHarness(const std::vector<std::string> &paths, int runs, const std::string &baselinePath, float tolerance,
+                   bool saveBaseline, bool profile)
+{
+    std::unique_ptr<PhaseProfiler> profiler;
+    if (profile)
+        profiler = std::make_unique<PhaseProfiler>();
+    struct Baseline
+    {
+        float medianMs, p99Ms, memoryMb;
+    };
+    std::vector<std::pair<std::string, Baseline>> baseline;
+    {
+        std::ifstream file(baselinePath);
+        std::string line;
+        while (std::getline(file, line))
+        {
+            std::istringstream fields(line);
+            std::string name;
+            Baseline values;
+            if (line.empty() || line[0] == '#' || !(fields >> name >> values.medianMs >> values.p99Ms >> values.memoryMb))
+                continue;
+            baseline.emplace_back(name, values);
+        }
+    }
+    auto findBaseline = [&baseline](const std::string &name) -> Baseline * {
+        for (auto &entry : baseline)
+            if (entry.first == name)
+                return &entry.second;
+        return nullptr;
+    };
+
+    std::cout << "perf harness: " << paths.size() << " scenarios, tolerance " << tolerance * 100.f << "%" << std::endl;
+    bool failed = false;
+    for (const std::string &path : paths)
+    {
+        Scenario scenario;
+        std::string error;
+        ScenarioResult result;
+        if (loadScenario(path, scenario, error))
+            result = runScenario(scenario, runs > 0 ? runs : scenario.runs, error, profiler.get());
+        if (!error.empty())
+        {
+            std::cout << "  " << error << std::endl;
+            failed = true;
+            continue;
+        }
+
+        std::cout << "  " << scenario.name << ": median " << result.medianMs << " ms, p99 " << result.p99Ms << " ms, "
+                  << result.memoryMb << " MB allocated, " << result.allocationsPerTick << " allocations per tick";
+        if (profiler)
+        {
+            // Reading the counters costs a few microseconds per phase, so these times don't compare
+            std::cout << " (profiled, not compared)\n";
+            profiler->report(std::cout);
+            continue;
+        }
+        Baseline *reference = findBaseline(scenario.name);
+        if (saveBaseline)
+        {
+            Baseline values{result.medianMs, result.p99Ms, result.memoryMb};
+            if (reference)
+                *reference = values;
+            else
+                baseline.emplace_back(scenario.name, values);
+            std::cout << std::endl;
+            continue;
+        }
+        if (!reference)
+        {
+            std::cout << "\n    no baseline" << std::endl;
+            continue;
+        }
+
+        // Checks one number against its baseline; a zero baseline (memory not measured) always passes
+        std::string regressions;
+        auto check = [&](const char *what, float value, float reference, float noiseFloor) {
+            if (reference > 0.f && value > reference * (1.f + tolerance) && value - reference > noiseFloor)
+                regressions += std::string(" ") + what + " +" +
+                               std::to_string(static_cast<int>((value / reference - 1.f) * 100.f)) + "%";
+        };
+        check("median", result.medianMs, reference->medianMs, PERF_NOISE_FLOOR_MS);
+        check("p99", result.p99Ms, reference->p99Ms, PERF_NOISE_FLOOR_MS);
+        check("memory", result.memoryMb, reference->memoryMb, PERF_NOISE_FLOOR_MB);
+        std::cout << "\n    " << (regressions.empty() ? "ok" : "REGRESSED:" + regressions) << " (baseline "
+                  << reference->medianMs << " / " << reference->p99Ms << " ms, " << reference->memoryMb << " MB)"
+                  << std::endl;
+        failed |= !regressions.empty();
+    }
+
+    if (saveBaseline)
+    {
+        std::ofstream file(baselinePath);
+        file << "# scenario median_ms p99_ms memory_mb, written by --perf --save-baseline\n";
+        for (const auto &entry : baseline)
+            file << entry.first << " " << entry.second.medianMs << " " << entry.second.p99Ms << " "
+                 << entry.second.memoryMb << "\n";
+        if (!file)
+        {
+            std::cerr << "Could not write " << baselinePath << std::endl;
+            return 1;
+        }
+        std::cout << "baseline written to " << baselinePath << std::endl;
+    }
+    return failed ? 1 : 0;
+}
+
+// Writes the scenario in the format loadScenario reads
+bool saveScenario(const Scenario &scenario, const std::string &path, const std::string &comment)
+{
+    std::ofstream file(path);
+    file << "# " << comment << "\n"
+         << "world " << scenario.width << " " << scenario.height;
+    if (scenario.terrain != "empty")
+        file << " " << scenario.terrain << " " << scenario.terrainValue;
+    file << "\nplayers " << scenario.players << "\nticks " << scenario.ticks << "\nruns " << scenario.runs
+         << "\nseed " << scenario.seed << "\n";
+    for (const Scenario::Action &action : scenario.actions)
+    {
+        if (action.end == action.first + 1)
+            file << "at " << action.first;
+        else
+            file << "from " << action.first << " " << action.end;
+        for (const std::string &word : action.words)
+            file << " " << word;
+        file << "\n";
+    }
+    return static_cast<bool>(file);
+}
+
+// Synthesizes worst-case loads as scenarios and raises each one level by
+// level (doubling) until a tick no longer fits the server tick budget, to
+// find where the game falls over. kind is fill, bullets, explosions or all.
+// writeDirectory, when not empty, receives every generated level as a
+// scenario file for the perf harness.
+void runStress(const std::string &kind, int ticks, const std::string &writeDirectory)
+{
+    const float budgetMs = 1000.f / settings.tickRate;
+    struct Load
+    {
+        const char *name;
+        const char *description;
+        const char *unit;
+        int firstLevel;
+        int lastLevel;
+        Scenario (*make)(int level, int ticks);
+    };
+    const Load loads[] = {
+        {"fill", "full-screen voxel fill with 8 players painting and shooting into it", "cells per side", 64, 4096,
+         [](int level, int ticks) {
+             Scenario scenario;
+             scenario.width = scenario.height = level;
+             scenario.terrain = "fill";
+             scenario.players = 8;
+             scenario.ticks = ticks;
+             scenario.actions.push_back(Scenario::Action{0, 1, {"input", "1", "1", "1"}});
+             scenario.actions.push_back(Scenario::Action{0, 1, {"aim", "sweep", "8"}});
+             scenario.actions.push_back(Scenario::Action{0, ticks, {"fire"}});
+             return scenario;
+         }},
+        {"bullets", "bullet storm from 8 players into a dense wall", "bullets per tick", 8, 8192,
+         [](int level, int ticks) {
+             Scenario scenario;
+             scenario.terrain = "fill";
+             scenario.terrainValue = GRID_HEIGHT / 2;
+             scenario.players = 8;
+             scenario.ticks = ticks;
+             std::string target[] = {std::to_string(WINDOW_WIDTH / 2), std::to_string(WINDOW_HEIGHT - 1)};
+             scenario.actions.push_back(Scenario::Action{0, ticks, {"bullets", std::to_string(level), target[0], target[1]}});
+             return scenario;
+         }},
+        {"explosions", "explosions every tick in solid ground, each throwing debris particles", "explosions per tick", 1,
+         1024,
+         [](int level, int ticks) {
+             Scenario scenario;
+             scenario.terrain = "fill";
+             scenario.ticks = ticks;
+             scenario.actions.push_back(Scenario::Action{0, ticks, {"explode", std::to_string(level)}});
+             return scenario;
+         }},
+    };
+
+    bool found = false;
+    for (const Load &load : loads)
+    {
+        if (kind != "all" && kind != load.name)
+            continue;
+        found = true;
+        std::cout << "stress: " << load.description << ", " << ticks << " ticks per level, budget " << budgetMs
+                  << " ms per tick" << std::endl;
+
+        int ceiling = 0;
+        for (int level = load.firstLevel; level <= load.lastLevel; level *= 2)
+        {
+            Scenario scenario = load.make(level, ticks);
+            scenario.name = std::string("stress_") + load.name + "_" + std::to_string(level);
+            scenario.runs = 1;
+            if (!writeDirectory.empty())
+                saveScenario(scenario, writeDirectory + "/" + scenario.name + ".scenario",
+                             std::string("Generated by --stress ") + load.name + ": " + load.description + ", " +
+                                 std::to_string(level) + " " + load.unit);
+
+            std::string error;
+            ScenarioResult result = runScenario(scenario, 1, error);
+            if (!error.empty())
+            {
+                std::cout << "  " << error << std::endl;
+                break;
+            }
+            std::cout << "  " << level << " " << load.unit << ": median " << result.medianMs << " ms, p99 "
+                      << result.p99Ms << " ms (" << 1000.f / std::max(result.medianMs, 0.001f) << " ticks/s), peak "
+                      << result.peakBullets << " bullets, " << result.peakParticles << " particles, "
+                      << result.memoryMb << " MB" << std::endl;
+            if (result.p99Ms > budgetMs)
+                break;
+            ceiling = level;
+        }
+        if (ceiling == 0)
+            std::cout << "  ceiling: below " << load.firstLevel << " " << load.unit << std::endl;
+        else
+            std::cout << "  ceiling: " << ceiling << " " << load.unit << " with every tick within budget" << std::endl;
+    }
+    if (!found)
+        std::cerr << "Unknown stress load " << kind << "; use fill, bullets, explosions or all" << std::endl;
+}
+
+void printUsage(const char *program)
+{
+    std::cout << "usage: " << program << " [--import image]     local single player, optionally starting from an image\n"
+              << "                                  any game mode takes --metrics [port] to serve Prometheus metrics\n"
+              << "                                  on 127.0.0.1 (default port " << DEFAULT_METRICS_PORT << ")\n"
+              << "                                  and --profile to print time and hardware counters per frame phase\n"
+              << "       every mode reads " << SETTINGS_PATH << " if present (or --config file), then --set name=value overrides\n"
+              << "                                  (these options go before or after the mode):\n"
+              << "                                  tickRate, threads, maxParticles, particleLifetime, glowQuality (0-2),\n"
+              << "                                  glowStrength, pacing (vsync|limit|adaptive|uncapped), frameRateLimit\n"
+              << "       " << program << " --generate [seed]    local single player on generated terrain\n"
+              << "       " << program << " --server [port]      dedicated headless server\n"
+              << "       " << program << " --host [port]        loopback server plus a local client\n"
+              << "       " << program << " --connect addr [port]\n"
+              << "       " << program << " --bots count [addr [port]] [--duration seconds] [--aggressive]\n"
+              << "                                  headless bot clients; starts a loopback server if no addr is given.\n"
+              << "                                  --aggressive bots paint and blast continuously (replication benchmark)\n"
+              << "       " << program << " --perf scenario... [--runs N] [--baseline file] [--tolerance fraction] [--save-baseline] [--profile]\n"
+              << "                                  run scenario files headless and compare tick times and memory with\n"
+              << "                                  the baseline (default " << PERF_BASELINE_PATH << ", " << PERF_TOLERANCE * 100.f << "%); exits 1 on a regression.\n"
+              << "                                  --profile breaks each scenario's ticks down by phase\n"
+              << "       " << program << " --stress [fill|bullets|explosions|all] [--ticks N] [--write dir]\n"
+              << "                                  raise worst-case loads until a tick misses the budget (default all, 120 ticks);\n"
+              << "                                  --write saves each generated level as a scenario file\n"
+              << "       " << program << " --bench-snapshot     time whole-state snapshot/restore on a 1M-cell world\n"
+              << "       " << program << " --bench-import [size]  time image-to-voxel conversion (default 4096)\n"
+              << "       " << program << " --bench-generate [width height]  time terrain generation (default 4096x1024)\n"
+              << "       " << program << " --bench-collision    time box-vs-world collision queries\n"
+              << "       " << program << " --bench-raycast [width height]  time ray casts with and without the distance field (default 2048x1024)\n"
+              << "       " << program << " --bench-sprites [count]  time filling the sprite batch (default 100000)\n"
+              << "       " << program << " --bench-text [labels]  time laying out overlay labels (default 1000)\n"
+              << "       " << program << " --bench-visibility [width height]  time visibility polygons and edge cache updates (default 2048x1024)\n"
+              << "       " << program << " --bench-bodies [count]  time rigid-body debris until it settles (default 200)\n"
+              << "       " << program << " --bench-morphology [width height]  time dilate/erode/fill/labeling (default 2048x1024)\n"
+              << "       " << program << " --bench-fluid [width height]  time a flood until the fluid settles (default 2048x1024)\n"
+              << "       " << program << " --bench-fire [width height]  time a forest fire until it burns out (default 2048x1024)\n";
+}
+
+int main(int argc, char **argv)
+{
+    // Options every mode takes can go anywhere; they are taken out here, so
+    // the mode is the first of the remaining arguments (none is local play)
+    unsigned short metricsPort = 0; // Metrics endpoint off
+    bool profile = false;
+    std::string settingsPath = SETTINGS_PATH;
+    bool settingsRequired = false;
+    std::vector<std::string> overrides;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (option == "--config" && hasValue)
+        {
+            settingsPath = argv[++i];
+            settingsRequired = true;
+        }
+        else if (option == "--set" && hasValue)
+            overrides.push_back(argv[++i]);
+        else if (option == "--metrics")
+        {
+            // The port is optional
+            bool port = hasValue && *argv[i + 1] && std::strspn(argv[i + 1], "0123456789") == std::strlen(argv[i + 1]);
+            metricsPort = static_cast<unsigned short>(port ? std::stoi(argv[++i]) : DEFAULT_METRICS_PORT);
+        }
+        else if (option == "--profile")
+            profile = true;
+        else
+            args.push_back(option);
+    }
+    // Bot options are taken out too, so they don't shift the positionals
+    float duration = 30.f;
+    bool aggressive = false;
+    for (std::size_t i = 0; i < args.size();)
+    {
+        if (args[i] == "--duration" && i + 1 < args.size())
+        {
+            duration = std::stof(args[i + 1]);
+            args.erase(args.begin() + i, args.begin() + i + 2);
+        }
+        else if (args[i] == "--aggressive")
+        {
+            aggressive = true;
+            args.erase(args.begin() + i);
+        }
+        else
+            ++i;
+    }
+    std::string mode = args.empty() ? "" : args[0];
+
+    // Positional argument after the mode, or a default
+    auto arg = [&args](std::size_t index, const std::string &fallback) {
+        return index < args.size() && args[index].rfind("--", 0) != 0 ? args[index] : fallback;
+    };
+
+    // The settings file first, then --set in order
+    std::string settingsError;
+    if (!settings.load(settingsPath, settingsRequired, settingsError))
+    {
+        std::cerr << settingsError << std::endl;
+        return 1;
+    }
+    for (const std::string &assignment : overrides)
+    {
+        std::size_t equals = assignment.find('=');
+        if (equals == std::string::npos || !settings.set(assignment.substr(0, equals), assignment.substr(equals + 1)))
+        {
+            std::cerr << "Can't apply --set " << assignment << std::endl;
+            return 1;
+        }
+    }
+
+    // Options every game mode shares
+    auto setUpGame = [metricsPort, profile](Game &game) {
+        if (profile)
+            game.enableProfiler();
+        if (metricsPort == 0)
+            return;
+        if (game.enableMetrics(metricsPort))
+            std::cout << "Metrics at http://127.0.0.1:" << metricsPort << "/metrics" << std::endl;
+        else
+            std::cerr << "Could not serve metrics on port " << metricsPort << std::endl;
+    };
+
+    if (mode.empty() || mode == "--import" || mode == "--generate")
+    {
+        Game game;
+        setUpGame(game);
+        if (mode == "--import" && !game.importWorld(arg(1, "")))
+        {
+            std::cerr << "Could not import " << arg(1, "") << std::endl;
+            return 1;
+        }
+        if (mode == "--generate")
+        {
+            game.generateWorld(static_cast<sf::Uint32>(std::stoul(arg(1, "1"))));
+        }
+        game.run();
+    }
+    else if (mode == "--perf")
+    {
+        std::vector<std::string> paths;
+        int runs = 0; // Each scenario's own
+        std::string baselinePath = PERF_BASELINE_PATH;
+        float tolerance = PERF_TOLERANCE;
+        bool saveBaseline = false;
+        for (std::size_t i = 1; i < args.size(); ++i)
+        {
+            if (args[i] == "--runs" && i + 1 < args.size())
+                runs = std::stoi(args[++i]);
+            else if (args[i] == "--baseline" && i + 1 < args.size())
+                baselinePath = args[++i];
+            else if (args[i] == "--tolerance" && i + 1 < args.size())
+                tolerance = std::stof(args[++i]);
+            else if (args[i] == "--save-baseline")
+                saveBaseline = true;
+            else
+                paths.push_back(args[i]);
+        }
+        return runPerfHarness(paths, runs, baselinePath, tolerance, saveBaseline, profile);
+    }
+    else if (mode == "--stress")
+    {
+        int ticks = 120;
+        std::string writeDirectory;
+        for (std::size_t i = 1; i + 1 < args.size(); ++i)
+        {
+            if (args[i] == "--ticks")
+                ticks = std::stoi(args[i + 1]);
+            else if (args[i] == "--write")
+                writeDirectory = args[i + 1];
+        }
+        runStress(arg(1, "all"), ticks, writeDirectory);
+    }
+    else if (mode == "--bench-fire")
+    {
+        runFireBenchmark(std::stoi(arg(1, "2048")), std::stoi(arg(2, "1024")));
+    }
+    else if (mode == "--bench-fluid")
+    {
+        runFluidBenchmark(std::stoi(arg(1, "2048")), std::stoi(arg(2, "1024")));
+    }
+    else if (mode == "--bench-bodies")
+    {
+        runBodiesBenchmark(std::stoi(arg(1, "200")));
+    }
+    else if (mode == "--bench-morphology")
+    {
+        runMorphologyBenchmark(std::stoi(arg(1, "2048")), std::stoi(arg(2, "1024")));
+    }
+    else if (mode == "--bench-raycast")
+    {
+        runRaycastBenchmark(std::stoi(arg(1, "2048")), std::stoi(arg(2, "1024")));
+    }
+    else if (mode == "--bench-sprites")
+    {
+        runSpriteBenchmark(std::stoi(arg(1, "100000")));
+    }
+    else if (mode == "--bench-text")
+    {
+        runTextBenchmark(std::stoi(arg(1, "1000")));
+    }
+    else if (mode == "--bench-visibility")
+    {
+        runVisibilityBenchmark(std::stoi(arg(1, "2048")), std::stoi(arg(2, "1024")));
+    }
+    else if (mode == "--bench-collision")
+    {
+        runCollisionBenchmark();
+    }
+    else if (mode == "--bench-generate")
+    {
+        runGenerateBenchmark(std::stoi(arg(1, "4096")), std::stoi(arg(2, "1024")));
+    }
+    else if (mode == "--bench-import")
+    {
+        runImportBenchmark(std::stoi(arg(1, "4096")));
+    }
+    else if (mode == "--bench-snapshot")
+    {
+        runSnapshotBenchmark();
+    }
+    else if (mode == "--server")
+    {
+        unsigned short port = static_cast<unsigned short>(std::stoi(arg(1, std::to_string(DEFAULT_SERVER_PORT))));
+        Server server(port);
+        std::atomic<bool> running(true);
+        std::cout << "Server listening on port " << port << std::endl;
+        server.run(running, true);
+    }
+    else if (mode == "--host" || mode == "--bots")
+    {
+        bool bots = mode == "--bots";
+        int botCount = bots ? std::stoi(arg(1, "32")) : 0;
+        std::string address = bots ? arg(2, "") : "";
+        unsigned short port = static_cast<unsigned short>(
+            std::stoi(arg(bots ? 3 : 1, std::to_string(DEFAULT_SERVER_PORT))));
+
+        // Without an explicit address, run the server in-process on loopback
+        std::unique_ptr<Server> server;
+        std::atomic<bool> running(true);
+        std::thread serverThread;
+        if (address.empty())
+        {
+            server = std::make_unique<Server>(port);
+            serverThread = std::thread([&server, &running]() { server->run(running, false); });
+        }
+        sf::IpAddress serverAddress = address.empty() ? sf::IpAddress::LocalHost : sf::IpAddress(address);
+
+        if (bots)
+        {
+            runBots(botCount, serverAddress, port, duration, aggressive, server.get());
+        }
+        else
+        {
+            Game game(std::make_unique<Client>(serverAddress, port));
+            setUpGame(game);
+            game.run();
+        }
+
+        running = false;
+        if (serverThread.joinable())
+            serverThread.join();
+    }
+    else if (mode == "--connect" && args.size() >= 2)
+    {
+        unsigned short port = static_cast<unsigned short>(std::stoi(arg(2, std::to_string(DEFAULT_SERVER_PORT))));
+        Game game(std::make_unique<Client>(sf::IpAddress(args[1]), port));
+        setUpGame(game);
+        game.run();
+    }
+    else
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+    return 0;
+}